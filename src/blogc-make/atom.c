@@ -6,13 +6,23 @@
  * See the file LICENSE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
-#include <unistd.h>
+#include "../blogc/loader.h"
+#include "../blogc/renderer.h"
+#include "../blogc/template-parser.h"
 #include "../common/error.h"
+#include "../common/file.h"
 #include "../common/utils.h"
+#include "ctx.h"
+#include "exec-native.h"
 #include "settings.h"
+#include "trace.h"
 #include "atom.h"
 
 static const char atom_template[] =
@@ -49,45 +59,93 @@ static const char atom_template[] =
 
 
 char*
-bm_atom_deploy(bm_settings_t *settings, bc_error_t **err)
+bm_atom_generate(bm_settings_t *settings)
 {
-    if (err == NULL || *err != NULL)
-        return NULL;
-
-    // this is not really portable
-    char fname[] = "/tmp/blogc-make_XXXXXX";
-    int fd;
-    if (-1 == (fd = mkstemp(fname))) {
-        *err = bc_error_new_printf(BLOGC_MAKE_ERROR_ATOM,
-            "Failed to create temporary atom template: %s", strerror(errno));
+    if (settings == NULL)
         return NULL;
-    }
 
     const char *atom_prefix = bc_trie_lookup(settings->settings, "atom_prefix");
     const char *atom_ext = bc_trie_lookup(settings->settings, "atom_ext");
     const char *post_prefix = bc_trie_lookup(settings->settings, "post_prefix");
 
-    char *content = bc_strdup_printf(atom_template, atom_prefix, atom_ext,
+    return bc_strdup_printf(atom_template, atom_prefix, atom_ext,
         atom_prefix, atom_ext, post_prefix, post_prefix);
+}
 
-    if (-1 == write(fd, content, strlen(content))) {
-        *err = bc_error_new_printf(BLOGC_MAKE_ERROR_ATOM,
-            "Failed to write to temporary atom template: %s", strerror(errno));
-        free(content);
-        close(fd);
-        unlink(fname);
-        return NULL;
-    }
-
-    free(content);
-    close(fd);
 
-    return bc_strdup(fname);
+static void
+insert_variable(const char *key, void *data, void *user_data)
+{
+    bc_trie_insert(user_data, key, bc_strdup(data));
 }
 
 
-void
-bm_atom_destroy(const char *fname)
+int
+bm_atom_render(bm_ctx_t *ctx, bc_trie_t *variables, bm_filectx_t *output,
+    bc_slist_t *sources)
 {
-    unlink(fname);
+    // the built-in atom template is rendered in-process, instead of calling
+    // blogc with a temporary template file. it is parsed only once, and
+    // shared by all the feeds built from the same context.
+    if (ctx == NULL || output == NULL)
+        return 3;
+
+    if (ctx->verbose)
+        printf("Rendering '%s' with built-in atom template\n", output->path);
+    else
+        printf("  BLOGC    %s\n", output->short_path);
+    fflush(stdout);
+
+    double start = ctx->trace != NULL ? bm_trace_now() : 0;
+
+    bc_error_t *err = NULL;
+
+    if (ctx->atom_template_stmts == NULL) {
+        ctx->atom_template_stmts = blogc_template_parse(ctx->atom_template,
+            strlen(ctx->atom_template), &err);
+        if (err != NULL) {
+            bc_error_print(err, "blogc-make");
+            bc_error_free(err);
+            return 3;
+        }
+    }
+
+    // same configuration built by blogc from the command line arguments
+    // passed by bm_exec_build_blogc_cmd().
+    bc_trie_t *config = bc_trie_new(free);
+    bc_trie_insert(config, "BLOGC_VERSION", bc_strdup(PACKAGE_VERSION));
+    bc_trie_foreach(ctx->settings->global, insert_variable, config);
+    bc_trie_foreach(variables, insert_variable, config);
+    if (ctx->dev) {
+        bc_trie_insert(config, "MAKE_ENV_DEV", bc_strdup("1"));
+        bc_trie_insert(config, "MAKE_ENV", bc_strdup("dev"));
+    }
+
+    bc_slist_t *files = NULL;
+    for (bc_slist_t *l = sources; l != NULL; l = l->next)
+        files = bc_slist_append(files, ((bm_filectx_t*) l->data)->path);
+
+    int rv = 0;
+
+    bc_slist_t *s = blogc_source_parse_from_files(config, files, &err);
+    if (err == NULL) {
+        char *out = blogc_render(ctx->atom_template_stmts, s, config, true);
+        bm_exec_native_mkdir_parents(output->path);
+        bc_file_write_if_changed(output->path, out,
+            out != NULL ? strlen(out) : 0, &err);
+        free(out);
+    }
+    if (err != NULL) {
+        bc_error_print(err, "blogc");
+        rv = 3;
+    }
+
+    bm_trace_add(ctx->trace, "output", output->short_path, start);
+
+    bc_error_free(err);
+    bc_slist_free_full(s, (bc_free_func_t) bc_trie_free);
+    bc_slist_free(files);
+    bc_trie_free(config);
+
+    return rv;
 }
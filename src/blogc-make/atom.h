@@ -9,10 +9,12 @@
 #ifndef _MAKE_ATOM_H
 #define _MAKE_ATOM_H
 
-#include "../common/error.h"
+#include "../common/utils.h"
+#include "ctx.h"
 #include "settings.h"
 
-char* bm_atom_deploy(bm_settings_t *settings, bc_error_t **err);
-void bm_atom_destroy(const char *fname);
+char* bm_atom_generate(bm_settings_t *settings);
+int bm_atom_render(bm_ctx_t *ctx, bc_trie_t *variables, bm_filectx_t *output,
+    bc_slist_t *sources);
 
 #endif /* _MAKE_ATOM_H */
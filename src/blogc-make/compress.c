@@ -0,0 +1,356 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif /* HAVE_ZLIB */
+#include "../common/error.h"
+#include "../common/file.h"
+#include "../common/utils.h"
+#include "ctx.h"
+#include "trace.h"
+#include "compress.h"
+
+#define BM_COMPRESS_MAX_THREADS 8
+
+
+typedef struct {
+    char *path;
+    char *short_path;
+} bm_compress_job_t;
+
+typedef struct {
+    bm_ctx_t *ctx;
+    bm_compress_job_t *jobs;
+    size_t jobs_len;
+    size_t next;
+    int level;
+    unsigned long min_size;
+    int rv;
+    pthread_mutex_t mutex;
+} bm_compress_pool_t;
+
+
+static const char* compressible_ext[] = {
+    ".html",
+    ".xml",
+    ".css",
+    ".js",
+    ".svg",
+    ".txt",
+    NULL,
+};
+
+
+static bool
+is_compressible(const char *path)
+{
+    size_t path_len = strlen(path);
+    for (size_t i = 0; compressible_ext[i] != NULL; i++) {
+        size_t ext_len = strlen(compressible_ext[i]);
+        if (path_len > ext_len &&
+            0 == strcmp(path + path_len - ext_len, compressible_ext[i]))
+            return true;
+    }
+    return false;
+}
+
+
+static int
+get_level(bm_ctx_t *ctx)
+{
+    const char *value = bc_trie_lookup(ctx->settings->settings, "gzip_level");
+    if (value == NULL)
+        return 0;
+    char *endptr;
+    long level = strtol(value, &endptr, 10);
+    if (*value == '\0' || *endptr != '\0' || level < 0 || level > 9)
+        return -1;
+    return level;
+}
+
+
+void
+bm_compress_queue(bm_ctx_t *ctx, bm_filectx_t *output)
+{
+    if (ctx == NULL || output == NULL || !is_compressible(output->path))
+        return;
+
+    // a compressed file left by a previous build with compression enabled
+    // would shadow the new output in most web servers.
+    if (get_level(ctx) == 0) {
+        char *gz_path = bc_strdup_printf("%s.gz", output->path);
+        unlink(gz_path);
+        free(gz_path);
+        return;
+    }
+
+    bm_compress_job_t *job = bc_malloc(sizeof(bm_compress_job_t));
+    job->path = bc_strdup(output->path);
+    job->short_path = bc_strdup(output->short_path);
+    ctx->compress_queue = bc_slist_prepend(ctx->compress_queue, job);
+}
+
+
+static void
+free_job(bm_compress_job_t *job)
+{
+    if (job == NULL)
+        return;
+    free(job->path);
+    free(job->short_path);
+    free(job);
+}
+
+
+#ifdef HAVE_ZLIB
+
+static int
+compress_file(bm_ctx_t *ctx, bm_compress_job_t *job, int level,
+    unsigned long min_size)
+{
+    struct stat src;
+    if (0 != stat(job->path, &src)) {
+        fprintf(stderr, "blogc-make: error: failed to compress file (%s): %s\n",
+            job->path, strerror(errno));
+        return 3;
+    }
+
+    char *gz_path = bc_strdup_printf("%s.gz", job->path);
+
+    // small files aren't worth it. a stale compressed file would shadow the
+    // new output in most web servers, so it must go away.
+    if ((unsigned long) src.st_size < min_size) {
+        unlink(gz_path);
+        free(gz_path);
+        return 0;
+    }
+
+    // the compressed file gets the mtime of the output, so an output that
+    // was rebuilt with the same content (and mtime) is not compressed again.
+    struct stat dst;
+    if (0 == stat(gz_path, &dst) &&
+        dst.st_mtim_tv_sec == src.st_mtim_tv_sec &&
+        dst.st_mtim_tv_nsec == src.st_mtim_tv_nsec)
+    {
+        free(gz_path);
+        return 0;
+    }
+
+    double start = ctx->trace != NULL ? bm_trace_now() : 0;
+
+    if (ctx->verbose)
+        printf("Compressing file '%s'\n", job->path);
+    else
+        printf("  GZIP     %s.gz\n", job->short_path);
+    fflush(stdout);
+
+    bc_error_t *err = NULL;
+    size_t len;
+    char *content = bc_file_get_contents(job->path, false, &len, &err);
+    if (err != NULL) {
+        bc_error_print(err, "blogc-make");
+        bc_error_free(err);
+        free(gz_path);
+        return 3;
+    }
+
+    char *tmp_path = NULL;
+    int fd = bc_file_open_temp(gz_path, &tmp_path, &err);
+    if (err != NULL) {
+        bc_error_print(err, "blogc-make");
+        bc_error_free(err);
+        free(content);
+        free(gz_path);
+        return 3;
+    }
+
+    int rv = 0;
+
+    char mode[4];
+    snprintf(mode, sizeof(mode), "wb%d", level);
+
+    // gzclose() closes the file descriptor, but we still need it.
+    errno = 0;
+    gzFile gz = gzdopen(dup(fd), mode);
+    if (gz == NULL) {
+        rv = 3;
+    }
+    else {
+        for (size_t off = 0; rv == 0 && off < len;) {
+            unsigned int chunk = len - off > 0x40000000 ? 0x40000000 : len - off;
+            int written = gzwrite(gz, content + off, chunk);
+            if (written <= 0)
+                rv = 3;
+            off += written;
+        }
+        if (Z_OK != gzclose(gz))
+            rv = 3;
+    }
+
+#ifdef HAVE_FUTIMENS
+    struct timespec times[2];
+    times[0].tv_sec = src.st_mtim_tv_sec;
+    times[0].tv_nsec = src.st_mtim_tv_nsec;
+    times[1] = times[0];
+    if (rv == 0)
+        futimens(fd, times);  // not critical, it will be compressed again
+#endif /* HAVE_FUTIMENS */
+
+    close(fd);
+    free(content);
+
+    if (rv == 0 && 0 != rename(tmp_path, gz_path))
+        rv = 3;
+
+    if (rv != 0) {
+        fprintf(stderr, "blogc-make: error: failed to compress file (%s): %s\n",
+            job->path, errno != 0 ? strerror(errno) : "zlib error");
+        unlink(tmp_path);
+    }
+
+    bm_trace_add(ctx->trace, "compress", job->short_path, start);
+
+    free(tmp_path);
+    free(gz_path);
+    return rv;
+}
+
+
+static void*
+compress_worker(void *arg)
+{
+    bm_compress_pool_t *pool = arg;
+    while (true) {
+        pthread_mutex_lock(&(pool->mutex));
+        size_t i = pool->next++;
+        bool failed = pool->rv != 0;
+        pthread_mutex_unlock(&(pool->mutex));
+        if (failed || i >= pool->jobs_len)
+            break;
+        int rv = compress_file(pool->ctx, &(pool->jobs[i]), pool->level,
+            pool->min_size);
+        if (rv != 0) {
+            pthread_mutex_lock(&(pool->mutex));
+            pool->rv = rv;
+            pthread_mutex_unlock(&(pool->mutex));
+        }
+    }
+    return NULL;
+}
+
+#endif /* HAVE_ZLIB */
+
+
+int
+bm_compress_flush(bm_ctx_t *ctx)
+{
+    if (ctx == NULL || ctx->compress_queue == NULL)
+        return 0;
+
+    bc_slist_t *queue = ctx->compress_queue;
+    ctx->compress_queue = NULL;
+
+    int level = get_level(ctx);
+    if (level < 0) {
+        fprintf(stderr, "blogc-make: error: invalid gzip_level: %s\n",
+            (char*) bc_trie_lookup(ctx->settings->settings, "gzip_level"));
+        bc_slist_free_full(queue, (bc_free_func_t) free_job);
+        return 3;
+    }
+
+#ifdef HAVE_ZLIB
+    const char *min_size_str = bc_trie_lookup(ctx->settings->settings,
+        "gzip_min_size");
+    char *endptr;
+    unsigned long min_size = min_size_str == NULL ? 0 :
+        strtoul(min_size_str, &endptr, 10);
+    if (min_size_str != NULL && (*min_size_str == '\0' || *endptr != '\0')) {
+        fprintf(stderr, "blogc-make: error: invalid gzip_min_size: %s\n",
+            min_size_str);
+        bc_slist_free_full(queue, (bc_free_func_t) free_job);
+        return 3;
+    }
+
+    double start = ctx->trace != NULL ? bm_trace_now() : 0;
+
+    bm_compress_pool_t pool = {
+        .ctx = ctx,
+        .jobs = NULL,
+        .jobs_len = 0,
+        .next = 0,
+        .level = level,
+        .min_size = min_size,
+        .rv = 0,
+    };
+
+    size_t jobs_cap = 0;
+    for (bc_slist_t *l = queue; l != NULL; l = l->next) {
+        if (pool.jobs_len == jobs_cap) {
+            jobs_cap = jobs_cap == 0 ? 64 : jobs_cap * 2;
+            pool.jobs = bc_realloc(pool.jobs,
+                jobs_cap * sizeof(bm_compress_job_t));
+        }
+        pool.jobs[pool.jobs_len++] = *((bm_compress_job_t*) l->data);
+    }
+
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads > BM_COMPRESS_MAX_THREADS)
+        num_threads = BM_COMPRESS_MAX_THREADS;
+    if (num_threads > (long) pool.jobs_len)
+        num_threads = pool.jobs_len;
+
+    pthread_t threads[BM_COMPRESS_MAX_THREADS];
+    if (0 == pthread_mutex_init(&(pool.mutex), NULL)) {
+        // the current thread is a worker too.
+        long started = 0;
+        for (; started < num_threads - 1; started++) {
+            if (0 != pthread_create(&(threads[started]), NULL, compress_worker,
+                    &pool))
+                break;
+        }
+        compress_worker(&pool);
+        for (long i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&(pool.mutex));
+    }
+    else {
+        for (size_t i = 0; pool.rv == 0 && i < pool.jobs_len; i++)
+            pool.rv = compress_file(ctx, &(pool.jobs[i]), level, min_size);
+    }
+
+    free(pool.jobs);
+    bc_slist_free_full(queue, (bc_free_func_t) free_job);
+
+    bm_trace_add(ctx->trace, "rule", "gzip", start);
+
+    return pool.rv;
+#else
+    static bool warned = false;
+    if (!warned) {
+        fprintf(stderr, "blogc-make: warning: blogc-make was built without "
+            "zlib support, ignoring gzip_level\n");
+        warned = true;
+    }
+    bc_slist_free_full(queue, (bc_free_func_t) free_job);
+    return 0;
+#endif /* HAVE_ZLIB */
+}
@@ -0,0 +1,17 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifndef _MAKE_COMPRESS_H
+#define _MAKE_COMPRESS_H
+
+#include "ctx.h"
+
+void bm_compress_queue(bm_ctx_t *ctx, bm_filectx_t *output);
+int bm_compress_flush(bm_ctx_t *ctx);
+
+#endif /* _MAKE_COMPRESS_H */
@@ -9,11 +9,15 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <time.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include "../blogc/template-parser.h"
 #include "../common/error.h"
 #include "../common/file.h"
 #include "../common/utils.h"
@@ -53,6 +57,240 @@ bm_filectx_new(bm_ctx_t *ctx, const char *filename)
 }
 
 
+static bm_filectx_t*
+filectx_new_from_stat(char *path, char *short_path, struct stat *buf)
+{
+    // takes ownership of path and short_path.
+    bm_filectx_t *rv = bc_malloc(sizeof(bm_filectx_t));
+    rv->path = path;
+    rv->short_path = short_path;
+    rv->tv_sec = buf->st_mtim_tv_sec;
+    rv->tv_nsec = buf->st_mtim_tv_nsec;
+    rv->readable = true;
+    return rv;
+}
+
+
+// the directory scanner appends to the tail of the lists directly, because
+// bc_slist_append() walks the whole list, and that is too slow for large
+// directory trees.
+
+typedef struct {
+    bc_slist_t *head;
+    bc_slist_t *tail;
+} bm_scan_list_t;
+
+typedef struct {
+    char *name;
+    unsigned char type;
+    bm_scan_list_t list;
+} bm_scan_job_t;
+
+typedef struct {
+    int dir_fd;
+    const char *path;
+    const char *short_path;
+    bm_scan_job_t *jobs;
+    size_t jobs_len;
+    size_t next;
+    pthread_mutex_t mutex;
+} bm_scan_pool_t;
+
+#define BM_SCAN_MAX_THREADS 8
+
+
+static void
+scan_append(bm_scan_list_t *l, void *data)
+{
+    bc_slist_t *node = bc_malloc(sizeof(bc_slist_t));
+    node->data = data;
+    node->next = NULL;
+    if (l->tail == NULL)
+        l->head = node;
+    else
+        l->tail->next = node;
+    l->tail = node;
+}
+
+
+static void
+scan_concat(bm_scan_list_t *l, bm_scan_list_t *other)
+{
+    if (other->head == NULL)
+        return;
+    if (l->tail == NULL)
+        l->head = other->head;
+    else
+        l->tail->next = other->head;
+    l->tail = other->tail;
+}
+
+
+static void scan_dir(bm_scan_list_t *l, int fd, const char *path,
+    const char *short_path);
+
+
+static void
+scan_entry(bm_scan_list_t *l, int dir_fd, const char *name, unsigned char type,
+    const char *path, const char *short_path)
+{
+    char *p = bc_strdup_printf("%s/%s", path, name);
+    char *sp = bc_strdup_printf("%s/%s", short_path, name);
+
+    // d_type saves a stat call for directories. files still need one, to
+    // get the modification time, and symlinks are followed like stat() does.
+    bool is_dir = false;
+    struct stat buf;
+#ifdef DT_DIR
+    is_dir = type == DT_DIR;
+#endif
+    if (!is_dir) {
+        if (0 != fstatat(dir_fd, name, &buf, 0))
+            goto cleanup;
+        is_dir = S_ISDIR(buf.st_mode);
+    }
+
+    if (is_dir) {
+        int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0)
+            scan_dir(l, fd, p, sp);
+        goto cleanup;
+    }
+
+    scan_append(l, filectx_new_from_stat(p, sp, &buf));
+    return;
+
+cleanup:
+    free(p);
+    free(sp);
+}
+
+
+static void
+scan_dir(bm_scan_list_t *l, int fd, const char *path, const char *short_path)
+{
+    // fd is owned by this function.
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        return;
+    }
+
+    struct dirent *e;
+    while (NULL != (e = readdir(dir))) {
+        if ((0 == strcmp(e->d_name, ".")) || (0 == strcmp(e->d_name, "..")))
+            continue;
+        unsigned char type = 0;
+#ifdef DT_DIR
+        type = e->d_type;
+#endif
+        scan_entry(l, dirfd(dir), e->d_name, type, path, short_path);
+    }
+
+    closedir(dir);
+}
+
+
+static void*
+scan_worker(void *arg)
+{
+    bm_scan_pool_t *pool = arg;
+    while (true) {
+        pthread_mutex_lock(&(pool->mutex));
+        size_t i = pool->next++;
+        pthread_mutex_unlock(&(pool->mutex));
+        if (i >= pool->jobs_len)
+            break;
+        bm_scan_job_t *job = &(pool->jobs[i]);
+        scan_entry(&(job->list), pool->dir_fd, job->name, job->type,
+            pool->path, pool->short_path);
+    }
+    return NULL;
+}
+
+
+static void
+scan_dir_parallel(bm_scan_list_t *l, int fd, const char *path,
+    const char *short_path)
+{
+    // the entries of the top-level directory are scanned by a few threads,
+    // each one with its own list. the lists are concatenated in readdir
+    // order in the end, so the result is the same of a sequential scan.
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        return;
+    }
+
+    bm_scan_pool_t pool = {
+        .dir_fd = dirfd(dir),
+        .path = path,
+        .short_path = short_path,
+        .jobs = NULL,
+        .jobs_len = 0,
+        .next = 0,
+    };
+    size_t jobs_cap = 0;
+    size_t num_dirs = 0;
+
+    struct dirent *e;
+    while (NULL != (e = readdir(dir))) {
+        if ((0 == strcmp(e->d_name, ".")) || (0 == strcmp(e->d_name, "..")))
+            continue;
+        if (pool.jobs_len == jobs_cap) {
+            jobs_cap = jobs_cap == 0 ? 64 : jobs_cap * 2;
+            pool.jobs = bc_realloc(pool.jobs, jobs_cap * sizeof(bm_scan_job_t));
+        }
+        bm_scan_job_t *job = &(pool.jobs[pool.jobs_len++]);
+        job->name = bc_strdup(e->d_name);
+        job->list.head = NULL;
+        job->list.tail = NULL;
+#ifdef DT_DIR
+        job->type = e->d_type;
+        if (job->type != DT_REG)
+            num_dirs++;
+#else
+        job->type = 0;
+        num_dirs++;
+#endif
+    }
+
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads > BM_SCAN_MAX_THREADS)
+        num_threads = BM_SCAN_MAX_THREADS;
+    if (num_threads > (long) num_dirs)
+        num_threads = num_dirs;
+
+    pthread_t threads[BM_SCAN_MAX_THREADS];
+    long started = 0;
+    if (num_threads > 1 && 0 == pthread_mutex_init(&(pool.mutex), NULL)) {
+        // the current thread is a worker too.
+        for (; started < num_threads - 1; started++) {
+            if (0 != pthread_create(&(threads[started]), NULL, scan_worker,
+                    &pool))
+                break;
+        }
+        scan_worker(&pool);
+        for (long i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&(pool.mutex));
+    }
+    else {
+        for (size_t i = 0; i < pool.jobs_len; i++)
+            scan_entry(&(pool.jobs[i].list), pool.dir_fd, pool.jobs[i].name,
+                pool.jobs[i].type, path, short_path);
+    }
+
+    for (size_t i = 0; i < pool.jobs_len; i++) {
+        scan_concat(l, &(pool.jobs[i].list));
+        free(pool.jobs[i].name);
+    }
+    free(pool.jobs);
+
+    closedir(dir);
+}
+
+
 bc_slist_t*
 bm_filectx_new_r(bc_slist_t *l, bm_ctx_t *ctx, const char *filename)
 {
@@ -68,30 +306,20 @@ bm_filectx_new_r(bc_slist_t *l, bm_ctx_t *ctx, const char *filename)
         return l;
     }
 
-    if (S_ISDIR(buf.st_mode)) {
-        DIR *dir = opendir(f);
-        if (dir == NULL) {
-            free(f);
-            return l;
-        }
+    bm_scan_list_t list = {.head = l, .tail = l};
+    while (list.tail != NULL && list.tail->next != NULL)
+        list.tail = list.tail->next;
 
-        struct dirent *e;
-        while (NULL != (e = readdir(dir))) {
-            if ((0 == strcmp(e->d_name, ".")) || (0 == strcmp(e->d_name, "..")))
-                continue;
-            char *tmp = bc_strdup_printf("%s/%s", filename, e->d_name);
-            l = bm_filectx_new_r(l, ctx, tmp);
-            free(tmp);
-        }
-
-        closedir(dir);
+    if (S_ISDIR(buf.st_mode)) {
+        int fd = open(f, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0)
+            scan_dir_parallel(&list, fd, f, filename);
         free(f);
-        return l;
+        return list.head;
     }
 
-    l = bc_slist_append(l, bm_filectx_new(ctx, filename));
-    free(f);
-    return l;
+    scan_append(&list, filectx_new_from_stat(f, bc_strdup(filename), &buf));
+    return list.head;
 }
 
 
@@ -126,21 +354,22 @@ bm_filectx_changed(bm_filectx_t *ctx, time_t *tv_sec, long *tv_nsec)
 }
 
 
-void
+bool
 bm_filectx_reload(bm_filectx_t *ctx)
 {
     if (ctx == NULL)
-        return;
+        return false;
 
     time_t tv_sec;
     long tv_nsec;
 
     if (!bm_filectx_changed(ctx, &tv_sec, &tv_nsec))
-        return;
+        return false;
 
     ctx->tv_sec = tv_sec;
     ctx->tv_nsec = tv_nsec;
     ctx->readable = true;
+    return true;
 }
 
 
@@ -175,11 +404,6 @@ bm_ctx_new(bm_ctx_t *base, const char *settings_file, const char *argv0,
     }
     free(content);
 
-    char *atom_template = bm_atom_deploy(settings, err);
-    if (*err != NULL) {
-        return NULL;
-    }
-
     bm_ctx_t *rv = NULL;
     if (base == NULL) {
         rv = bc_malloc(sizeof(bm_ctx_t));
@@ -188,6 +412,11 @@ bm_ctx_new(bm_ctx_t *base, const char *settings_file, const char *argv0,
             "BLOGC_RUNSERVER");
         rv->dev = false;
         rv->verbose = false;
+        rv->trace = NULL;
+        rv->state = NULL;
+        rv->compress_queue = NULL;
+        rv->rebuild_outputs = NULL;
+        rv->rebuild_tags = NULL;
     }
     else {
         bm_ctx_free_internal(base);
@@ -211,6 +440,10 @@ bm_ctx_new(bm_ctx_t *base, const char *settings_file, const char *argv0,
             rv->short_output_dir);
     }
 
+    // the state is kept when reloading, the output directory can't change.
+    if (rv->state == NULL)
+        rv->state = bm_state_load(rv->root_dir, rv->output_dir);
+
     // can't return null and set error after this!
 
     const char *template_dir = bc_trie_lookup(settings->settings,
@@ -221,8 +454,8 @@ bm_ctx_new(bm_ctx_t *base, const char *settings_file, const char *argv0,
     rv->main_template_fctx = bm_filectx_new(rv, main_template);
     free(main_template);
 
-    rv->atom_template_fctx = bm_filectx_new(rv, atom_template);
-    free(atom_template);
+    rv->atom_template = bm_atom_generate(settings);
+    rv->atom_template_stmts = NULL;
 
     const char *content_dir = bc_trie_lookup(settings->settings, "content_dir");
     const char *post_prefix = bc_trie_lookup(settings->settings, "post_prefix");
@@ -258,17 +491,55 @@ bm_ctx_new(bm_ctx_t *base, const char *settings_file, const char *argv0,
         }
     }
 
+    rv->sources_fctx = bc_trie_new(NULL);
+    if (rv->main_template_fctx != NULL)
+        bc_trie_insert(rv->sources_fctx, rv->main_template_fctx->path,
+            rv->main_template_fctx);
+    bc_slist_t *lists[] = {rv->posts_fctx, rv->pages_fctx, rv->copy_fctx};
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        for (bc_slist_t *tmp = lists[i]; tmp != NULL; tmp = tmp->next) {
+            bm_filectx_t *fctx = tmp->data;
+            bc_trie_insert(rv->sources_fctx, fctx->path, fctx);
+        }
+    }
+
     return rv;
 }
 
 
+static bool
+source_removed(bm_ctx_t *ctx, bc_slist_t *paths)
+{
+    for (bc_slist_t *l = paths; l != NULL; l = l->next) {
+        bm_filectx_t *fctx = bc_trie_lookup(ctx->sources_fctx, l->data);
+        struct stat buf;
+        if (fctx != NULL && fctx->readable && 0 != stat(fctx->path, &buf))
+            return true;
+    }
+    return false;
+}
+
+
 bool
-bm_ctx_reload(bm_ctx_t *ctx)
+bm_ctx_reload(bm_ctx_t *ctx, bool force, bc_slist_t *paths, bool *reloaded,
+    bc_slist_t **changed)
 {
+    // *reloaded is set if the whole context was recreated, otherwise
+    // *changed lists the file contexts that were modified (not owned by the
+    // list). if paths is not NULL, only the source files in it are checked.
     if (ctx == NULL || ctx->settings_fctx == NULL)
         return false;
 
-    if (bm_filectx_changed(ctx->settings_fctx, NULL, NULL)) {
+    if (reloaded != NULL)
+        *reloaded = false;
+    if (changed != NULL)
+        *changed = NULL;
+
+    // force is used when files were created or removed, so directories
+    // listed in the copy section must be scanned again.
+    if (force || bm_filectx_changed(ctx->settings_fctx, NULL, NULL) ||
+        source_removed(ctx, paths))
+    {
         // reload everything! we could just reload settings_fctx, as this
         // would force rebuilding everything, but we need to know new/deleted
         // files
@@ -283,20 +554,40 @@ bm_ctx_reload(bm_ctx_t *ctx)
             bc_error_free(err);
             return false;
         }
+        if (reloaded != NULL)
+            *reloaded = true;
         return true;
     }
 
-    bm_filectx_reload(ctx->main_template_fctx);
-    bm_filectx_reload(ctx->atom_template_fctx);
-
-    for (bc_slist_t *tmp = ctx->posts_fctx; tmp != NULL; tmp = tmp->next)
-        bm_filectx_reload((bm_filectx_t*) tmp->data);
+    bc_slist_t *rv = NULL;
 
-    for (bc_slist_t *tmp = ctx->pages_fctx; tmp != NULL; tmp = tmp->next)
-        bm_filectx_reload((bm_filectx_t*) tmp->data);
+    if (paths != NULL) {
+        // the same file may be listed more than once, but it is only
+        // reloaded the first time.
+        for (bc_slist_t *l = paths; l != NULL; l = l->next) {
+            bm_filectx_t *fctx = bc_trie_lookup(ctx->sources_fctx, l->data);
+            if (bm_filectx_reload(fctx))
+                rv = bc_slist_append(rv, fctx);
+        }
+    }
+    else {
+        if (bm_filectx_reload(ctx->main_template_fctx))
+            rv = bc_slist_append(rv, ctx->main_template_fctx);
+
+        bc_slist_t *lists[] = {ctx->posts_fctx, ctx->pages_fctx,
+            ctx->copy_fctx};
+        for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+            for (bc_slist_t *tmp = lists[i]; tmp != NULL; tmp = tmp->next) {
+                if (bm_filectx_reload(tmp->data))
+                    rv = bc_slist_append(rv, tmp->data);
+            }
+        }
+    }
 
-    for (bc_slist_t *tmp = ctx->copy_fctx; tmp != NULL; tmp = tmp->next)
-        bm_filectx_reload((bm_filectx_t*) tmp->data);
+    if (changed != NULL)
+        *changed = rv;
+    else
+        bc_slist_free(rv);
 
     return true;
 }
@@ -318,12 +609,12 @@ bm_ctx_free_internal(bm_ctx_t *ctx)
     free(ctx->output_dir);
     ctx->output_dir = NULL;
 
-    bm_atom_destroy(ctx->atom_template_fctx->path);
-
     bm_filectx_free(ctx->main_template_fctx);
     ctx->main_template_fctx = NULL;
-    bm_filectx_free(ctx->atom_template_fctx);
-    ctx->atom_template_fctx = NULL;
+    free(ctx->atom_template);
+    ctx->atom_template = NULL;
+    blogc_template_free_stmts(ctx->atom_template_stmts);
+    ctx->atom_template_stmts = NULL;
     bm_filectx_free(ctx->settings_fctx);
     ctx->settings_fctx = NULL;
 
@@ -333,6 +624,8 @@ bm_ctx_free_internal(bm_ctx_t *ctx)
     ctx->pages_fctx = NULL;
     bc_slist_free_full(ctx->copy_fctx, (bc_free_func_t) bm_filectx_free);
     ctx->copy_fctx = NULL;
+    bc_trie_free(ctx->sources_fctx);
+    ctx->sources_fctx = NULL;
 }
 
 
@@ -344,5 +637,7 @@ bm_ctx_free(bm_ctx_t *ctx)
     bm_ctx_free_internal(ctx);
     free(ctx->blogc);
     free(ctx->blogc_runserver);
+    bm_trace_free(ctx->trace);
+    bm_state_free(ctx->state);
     free(ctx);
 }
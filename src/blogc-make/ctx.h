@@ -12,6 +12,8 @@
 #include <stdbool.h>
 #include <time.h>
 #include "settings.h"
+#include "state.h"
+#include "trace.h"
 #include "../common/error.h"
 #include "../common/utils.h"
 
@@ -48,6 +50,9 @@ typedef struct {
     bool dev;
     bool verbose;
 
+    bm_trace_t *trace;
+    bm_state_t *state;
+
     bm_settings_t *settings;
 
     char *root_dir;
@@ -55,22 +60,39 @@ typedef struct {
     char *short_output_dir;
 
     bm_filectx_t *main_template_fctx;
-    bm_filectx_t *atom_template_fctx;
+
+    // built-in atom template, parsed on first use
+    char *atom_template;
+    bc_slist_t *atom_template_stmts;
+
     bm_filectx_t *settings_fctx;
 
     bc_slist_t *posts_fctx;
     bc_slist_t *pages_fctx;
     bc_slist_t *copy_fctx;
+
+    // path -> bm_filectx_t, for the main template and all the source files
+    // listed above. the file contexts are owned by the lists.
+    bc_trie_t *sources_fctx;
+
+    // outputs built by the current rule, waiting to be compressed
+    bc_slist_t *compress_queue;
+
+    // set while rebuilding only the outputs affected by some changed files:
+    // paths of the outputs built from them, and tags of the changed posts.
+    bc_trie_t *rebuild_outputs;
+    bc_trie_t *rebuild_tags;
 } bm_ctx_t;
 
 bm_filectx_t* bm_filectx_new(bm_ctx_t *ctx, const char *filename);
 bc_slist_t* bm_filectx_new_r(bc_slist_t *l, bm_ctx_t *ctx, const char *filename);
 bool bm_filectx_changed(bm_filectx_t *ctx, time_t *tv_sec, long *tv_nsec);
-void bm_filectx_reload(bm_filectx_t *ctx);
+bool bm_filectx_reload(bm_filectx_t *ctx);
 void bm_filectx_free(bm_filectx_t *fctx);
 bm_ctx_t* bm_ctx_new(bm_ctx_t *base, const char *settings_file,
     const char *argv0, bc_error_t **err);
-bool bm_ctx_reload(bm_ctx_t *ctx);
+bool bm_ctx_reload(bm_ctx_t *ctx, bool force, bc_slist_t *paths,
+    bool *reloaded, bc_slist_t **changed);
 void bm_ctx_free_internal(bm_ctx_t *ctx);
 void bm_ctx_free(bm_ctx_t *ctx);
 
@@ -6,16 +6,27 @@
  * See the file LICENSE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <errno.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif /* HAVE_LINUX_FS_H */
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif /* HAVE_SYS_SENDFILE_H */
 #include "../common/error.h"
 #include "../common/file.h"
 #include "../common/utils.h"
@@ -23,16 +34,10 @@
 #include "ctx.h"
 
 
-int
-bm_exec_native_cp(bm_filectx_t *source, bm_filectx_t *dest, bool verbose)
+void
+bm_exec_native_mkdir_parents(const char *path)
 {
-    if (verbose)
-        printf("Copying '%s' to '%s'\n", source->path, dest->path);
-    else
-        printf("  COPY     %s\n", dest->short_path);
-    fflush(stdout);
-
-    char *fname = bc_strdup(dest->path);
+    char *fname = bc_strdup(path);
     for (char *tmp = fname; *tmp != '\0'; tmp++) {
         if (*tmp != '/' && *tmp != '\\')
             continue;
@@ -50,39 +55,262 @@ bm_exec_native_cp(bm_filectx_t *source, bm_filectx_t *dest, bool verbose)
         *tmp = bkp;
     }
     free(fname);
+}
 
-    int fd_from = open(source->path, O_RDONLY);
-    if (fd_from < 0) {
-        fprintf(stderr, "blogc-make: error: failed to open source file to copy "
-            " (%s): %s\n", source->path, strerror(errno));
-        return 3;
+
+static int
+copy_data(int fd_from, int fd_to, off_t size)
+{
+    // returns 0 on success, -1 with errno set on errors. tries the
+    // fastest method available first: reflinks share the data blocks,
+    // copy_file_range() and sendfile() copy without going through
+    // userspace.
+    (void) size;
+
+#ifdef FICLONE
+    if (0 == ioctl(fd_to, FICLONE, fd_from))
+        return 0;
+#endif /* FICLONE */
+
+    off_t copied = 0;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    while (copied < size) {
+        ssize_t n = copy_file_range(fd_from, NULL, fd_to, NULL,
+            size - copied, 0);
+        if (n < 0) {
+            // not supported for these files, try something else.
+            if (copied == 0 && (errno == ENOSYS || errno == EXDEV ||
+                    errno == EINVAL || errno == EOPNOTSUPP))
+                break;
+            return -1;
+        }
+        if (n == 0)
+            return 0;  // file was truncated while copying
+        copied += n;
     }
+    if (copied > 0 && copied >= size)
+        return 0;
+#endif /* HAVE_COPY_FILE_RANGE */
 
-    int fd_to = open(dest->path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (fd_to < 0) {
-        fprintf(stderr, "blogc-make: error: failed to open destination file to "
-            "copy (%s): %s\n", dest->path, strerror(errno));
-        close(fd_from);
-        return 3;
+#ifdef HAVE_SYS_SENDFILE_H
+    while (copied < size) {
+        ssize_t n = sendfile(fd_to, fd_from, NULL, size - copied);
+        if (n < 0) {
+            if (copied == 0 && (errno == ENOSYS || errno == EINVAL))
+                break;
+            return -1;
+        }
+        if (n == 0)
+            return 0;
+        copied += n;
     }
+    if (copied > 0 && copied >= size)
+        return 0;
+#endif /* HAVE_SYS_SENDFILE_H */
 
+    // nothing copied by the kernel, the file offsets were not moved.
     ssize_t nread;
     char buffer[BC_FILE_CHUNK_SIZE];
     while (0 < (nread = read(fd_from, buffer, BC_FILE_CHUNK_SIZE))) {
         char *out_ptr = buffer;
         do {
             ssize_t nwritten = write(fd_to, out_ptr, nread);
-            if (nwritten == -1) {
-                fprintf(stderr, "blogc-make: error: failed to write to "
-                    "destination file (%s): %s\n", dest->path, strerror(errno));
-                close(fd_from);
-                close(fd_to);
-                return 3;
-            }
+            if (nwritten == -1)
+                return -1;
             nread -= nwritten;
             out_ptr += nwritten;
         } while (nread > 0);
     }
+    return nread < 0 ? -1 : 0;
+}
+
+
+static bool
+same_content(int fd_from, const char *path)
+{
+    // compares the source file with the destination file, both with the
+    // same size already. the source file offset is restored.
+    int fd_to = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd_to < 0)
+        return false;
+
+    bool rv = true;
+    char buf_from[BC_FILE_CHUNK_SIZE];
+    char buf_to[BC_FILE_CHUNK_SIZE];
+    while (rv) {
+        ssize_t n = read(fd_from, buf_from, sizeof(buf_from));
+        if (n <= 0) {
+            rv = n == 0;
+            break;
+        }
+        for (ssize_t got = 0; got < n;) {
+            ssize_t m = read(fd_to, buf_to + got, n - got);
+            if (m <= 0) {
+                rv = false;
+                break;
+            }
+            got += m;
+        }
+        if (rv && 0 != memcmp(buf_from, buf_to, n))
+            rv = false;
+    }
+
+    close(fd_to);
+    lseek(fd_from, 0, SEEK_SET);
+    return rv;
+}
+
+
+int
+bm_exec_native_cp(bm_filectx_t *source, bm_filectx_t *dest, bool verbose)
+{
+    int fd_from = open(source->path, O_RDONLY | O_CLOEXEC);
+    if (fd_from < 0) {
+        fprintf(stderr, "blogc-make: error: failed to open source file to copy "
+            " (%s): %s\n", source->path, strerror(errno));
+        return 3;
+    }
+
+    struct stat st_from;
+    if (0 != fstat(fd_from, &st_from)) {
+        fprintf(stderr, "blogc-make: error: failed to stat source file to copy "
+            " (%s): %s\n", source->path, strerror(errno));
+        close(fd_from);
+        return 3;
+    }
+
+    // destination files linked to the source by another copy_mode are
+    // always replaced.
+    struct stat st_to;
+    if (0 == lstat(dest->path, &st_to) && S_ISREG(st_to.st_mode) &&
+        !(st_to.st_dev == st_from.st_dev && st_to.st_ino == st_from.st_ino) &&
+        st_to.st_size == st_from.st_size)
+    {
+        // the modification time of the source is preserved when copying,
+        // then a destination file with the same size and time is a previous
+        // copy. otherwise compare the content, to leave unchanged files
+        // alone.
+        if ((st_to.st_mtim_tv_sec == st_from.st_mtim_tv_sec &&
+            st_to.st_mtim_tv_nsec == st_from.st_mtim_tv_nsec) ||
+            same_content(fd_from, dest->path))
+        {
+            close(fd_from);
+            return 0;
+        }
+    }
+
+    if (verbose)
+        printf("Copying '%s' to '%s'\n", source->path, dest->path);
+    else
+        printf("  COPY     %s\n", dest->short_path);
+    fflush(stdout);
+
+    // the file is copied to a temporary file, that is renamed to the
+    // destination, so readers never see partial files. try it before
+    // creating the parent directories, they usually exist already, or were
+    // created when copying the previous file.
+    char *tmp_path = NULL;
+    bc_error_t *err = NULL;
+    int fd_to = bc_file_open_temp(dest->path, &tmp_path, &err);
+    if (fd_to < 0) {
+        bc_error_free(err);
+        err = NULL;
+        bm_exec_native_mkdir_parents(dest->path);
+        fd_to = bc_file_open_temp(dest->path, &tmp_path, &err);
+    }
+    if (fd_to < 0) {
+        fprintf(stderr, "blogc-make: error: failed to open destination file to "
+            "copy (%s): %s\n", dest->path, err->msg);
+        bc_error_free(err);
+        close(fd_from);
+        return 3;
+    }
+
+    if (0 != copy_data(fd_from, fd_to, st_from.st_size)) {
+        fprintf(stderr, "blogc-make: error: failed to write to "
+            "destination file (%s): %s\n", dest->path, strerror(errno));
+        close(fd_from);
+        close(fd_to);
+        unlink(tmp_path);
+        free(tmp_path);
+        return 3;
+    }
+
+#ifdef HAVE_FUTIMENS
+    struct timespec times[2];
+    times[0].tv_sec = st_from.st_mtim_tv_sec;
+    times[0].tv_nsec = st_from.st_mtim_tv_nsec;
+    times[1] = times[0];
+    if (0 != futimens(fd_to, times)) {
+        // not critical, the file will be compared again next time.
+        fprintf(stderr, "blogc-make: warning: failed to set modification "
+            "time of destination file (%s): %s\n", dest->path,
+            strerror(errno));
+    }
+#endif /* HAVE_FUTIMENS */
+
+    close(fd_from);
+
+    if (0 != close(fd_to) || 0 != rename(tmp_path, dest->path)) {
+        fprintf(stderr, "blogc-make: error: failed to write to "
+            "destination file (%s): %s\n", dest->path, strerror(errno));
+        unlink(tmp_path);
+        free(tmp_path);
+        return 3;
+    }
+
+    free(tmp_path);
+    return 0;
+}
+
+
+int
+bm_exec_native_link(bm_filectx_t *source, bm_filectx_t *dest, bool symbolic,
+    bool verbose)
+{
+    struct stat st_from;
+    struct stat st_to;
+    if (0 == stat(source->path, &st_from) && 0 == lstat(dest->path, &st_to)) {
+        if (symbolic && S_ISLNK(st_to.st_mode) &&
+            0 == stat(dest->path, &st_to) && st_to.st_dev == st_from.st_dev &&
+            st_to.st_ino == st_from.st_ino)
+            return 0;
+        if (!symbolic && st_to.st_dev == st_from.st_dev &&
+            st_to.st_ino == st_from.st_ino)
+            return 0;
+    }
+
+    if (0 != unlink(dest->path) && errno != ENOENT) {
+        fprintf(stderr, "blogc-make: error: failed to remove destination file "
+            "(%s): %s\n", dest->path, strerror(errno));
+        return 3;
+    }
+
+    int rv = symbolic ? symlink(source->path, dest->path) :
+        link(source->path, dest->path);
+    if (rv != 0 && errno == ENOENT) {
+        bm_exec_native_mkdir_parents(dest->path);
+        rv = symbolic ? symlink(source->path, dest->path) :
+            link(source->path, dest->path);
+    }
+
+    if (rv != 0) {
+        // hardlinks can't cross filesystems, and some filesystems don't
+        // support links at all. copy the file in these cases.
+        if (errno == EXDEV || errno == EPERM || errno == EMLINK ||
+            errno == ENOTSUP || errno == EOPNOTSUPP)
+            return bm_exec_native_cp(source, dest, verbose);
+        fprintf(stderr, "blogc-make: error: failed to link destination file "
+            "(%s): %s\n", dest->path, strerror(errno));
+        return 3;
+    }
+
+    if (verbose)
+        printf("Linking '%s' to '%s'\n", source->path, dest->path);
+    else
+        printf("  LINK     %s\n", dest->short_path);
+    fflush(stdout);
 
     return 0;
 }
@@ -139,6 +367,13 @@ bm_exec_native_rm(const char *output_dir, bm_filectx_t *dest, bool verbose)
         return 3;
     }
 
+    // the compressed sibling, if any, goes away with the file. it may exist
+    // even if compression is disabled now.
+    char *gz_path = bc_strdup_printf("%s.gz", dest->path);
+    if (0 == unlink(gz_path) && verbose)
+        printf("Removing file '%s'\n", gz_path);
+    free(gz_path);
+
     int rv = 0;
 
     // blame freebsd's libc for all of those memory allocations around dirname
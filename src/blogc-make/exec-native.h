@@ -13,7 +13,10 @@
 #include "../common/error.h"
 #include "ctx.h"
 
+void bm_exec_native_mkdir_parents(const char *path);
 int bm_exec_native_cp(bm_filectx_t *source, bm_filectx_t *dest, bool verbose);
+int bm_exec_native_link(bm_filectx_t *source, bm_filectx_t *dest, bool symbolic,
+    bool verbose);
 bool bm_exec_native_is_empty_dir(const char *dir, bc_error_t **err);
 int bm_exec_native_rm(const char *output_dir, bm_filectx_t *dest, bool verbose);
 
@@ -20,6 +20,7 @@
 #include "ctx.h"
 #include "exec.h"
 #include "settings.h"
+#include "trace.h"
 
 
 char*
@@ -244,10 +245,16 @@ bm_exec_build_blogc_cmd(const char *blogc_bin, bm_settings_t *settings,
 
     if (output != NULL) {
         char *tmp = bc_shell_quote(output);
-        bc_string_append_printf(rv, " -o %s", tmp);
+        bc_string_append_printf(rv, " -o %s --skip-unchanged", tmp);
         free(tmp);
     }
 
+    if (settings != NULL) {
+        const char *minify = bc_trie_lookup(settings->settings, "html_minify");
+        if (minify != NULL && 0 == strcmp(minify, "true"))
+            bc_string_append(rv, " --minify");
+    }
+
     if (sources_stdin) {
         bc_string_append(rv, " -i");
     }
@@ -284,7 +291,9 @@ bm_exec_blogc(bm_ctx_t *ctx, bc_trie_t *variables, bool listing,
     char *err = NULL;
     bc_error_t *error = NULL;
 
+    double start = ctx->trace != NULL ? bm_trace_now() : 0;
     int rv = bm_exec_command(cmd, input->str, &out, &err, &error);
+    bm_trace_add(ctx->trace, "output", output->short_path, start);
 
     if (error != NULL) {
         bc_error_print(error, "blogc-make");
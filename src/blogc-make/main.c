@@ -14,10 +14,12 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../common/error.h"
 #include "../common/utils.h"
 #include "ctx.h"
 #include "rules.h"
+#include "trace.h"
 
 
 static void
@@ -25,7 +27,7 @@ print_help(void)
 {
     printf(
         "usage:\n"
-        "    blogc-make [-h] [-v] [-D] [-V] [-f FILE] [RULE ...]\n"
+        "    blogc-make [-h] [-v] [-D] [-V] [-f FILE] [-T FILE] [RULE ...]\n"
         "               - A simple build tool for blogc.\n"
         "\n"
         "positional arguments:\n"
@@ -38,7 +40,9 @@ print_help(void)
         "    -v            show version and exit\n"
         "    -D            build for development environment\n"
         "    -V            be verbose when executing commands\n"
-        "    -f FILE       read FILE as blogcfile\n");
+        "    -f FILE       read FILE as blogcfile\n"
+        "    -T FILE       write build timing trace to FILE, in chrome\n"
+        "                  trace-event format, and print slowest outputs\n");
     bm_rule_print_help();
 }
 
@@ -46,7 +50,8 @@ print_help(void)
 static void
 print_usage(void)
 {
-    printf("usage: blogc-make [-h] [-v] [-D] [-V] [-f FILE] [RULE ...]\n");
+    printf("usage: blogc-make [-h] [-v] [-D] [-V] [-f FILE] [-T FILE] "
+        "[RULE ...]\n");
 }
 
 
@@ -66,6 +71,7 @@ main(int argc, char **argv)
     bool verbose = false;
     bool dev = false;
     char *blogcfile = NULL;
+    char *tracefile = NULL;
     bm_ctx_t *ctx = NULL;
 
     for (unsigned int i = 1; i < argc; i++) {
@@ -89,6 +95,12 @@ main(int argc, char **argv)
                     else if (i + 1 < argc)
                         blogcfile = bc_strdup(argv[++i]);
                     break;
+                case 'T':
+                    if (argv[i][2] != '\0')
+                        tracefile = bc_strdup(argv[i] + 2);
+                    else if (i + 1 < argc)
+                        tracefile = bc_strdup(argv[++i]);
+                    break;
 #ifdef MAKE_EMBEDDED
                 case 'm':
                     // no-op, for embedding into blogc binary.
@@ -111,6 +123,21 @@ main(int argc, char **argv)
         rules = bc_slist_append(rules, bc_strdup("all"));
     }
 
+    // the trace is only written at exit, and the reloader would keep adding
+    // events to it for as long as the server runs.
+    if (tracefile != NULL) {
+        for (bc_slist_t *l = rules; l != NULL; l = l->next) {
+            const char *rule = l->data;
+            size_t len = strcspn(rule, ":");
+            if (len == 9 && 0 == strncmp(rule, "runserver", 9)) {
+                fprintf(stderr, "blogc-make: error: -T can't be used with "
+                    "the runserver rule\n");
+                rv = 3;
+                goto cleanup;
+            }
+        }
+    }
+
     ctx = bm_ctx_new(NULL, blogcfile ? blogcfile : "blogcfile",
         argc > 0 ? argv[0] : NULL, &err);
     if (err != NULL) {
@@ -120,13 +147,25 @@ main(int argc, char **argv)
     }
     ctx->dev = dev;
     ctx->verbose = verbose;
+    ctx->trace = bm_trace_new(tracefile);
 
     rv = bm_rule_executor(ctx, rules);
 
+    if (ctx->trace != NULL) {
+        bm_trace_print_summary(ctx->trace, BM_TRACE_SUMMARY_SIZE);
+        bm_trace_write(ctx->trace, &err);
+        if (err != NULL) {
+            bc_error_print(err, "blogc-make");
+            if (rv == 0)
+                rv = 3;
+        }
+    }
+
 cleanup:
 
     bc_slist_free_full(rules, free);
     free(blogcfile);
+    free(tracefile);
     bm_ctx_free(ctx);
     bc_error_free(err);
 
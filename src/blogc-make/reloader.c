@@ -6,11 +6,26 @@
  * See the file LICENSE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+
+#if defined(HAVE_SYS_INOTIFY_H) && defined(HAVE_POLL_H)
+#define USE_INOTIFY
+#include <dirent.h>
+#include <libgen.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#endif
+
 #include "../common/utils.h"
 #include "ctx.h"
 #include "rules.h"
@@ -19,26 +34,362 @@
 // we are not going to unit-test these functions, then printing errors
 // directly is not a big issue
 
+// time to wait for more events after the first one, before rebuilding. text
+// editors usually write files in several steps (truncate, write, rename).
+#define BM_RELOADER_DEBOUNCE_MS 50
+#define BM_RELOADER_DEBOUNCE_MAX_MS 1000
 
-static void*
-bm_reloader_thread(void *arg)
+
+static bool
+bm_reloader_rebuild(bm_reloader_t *reloader, bool force, bc_slist_t *paths)
+{
+    bool reloaded = false;
+    bc_slist_t *changed = NULL;
+    if (!bm_ctx_reload(reloader->ctx, force, paths, &reloaded, &changed)) {
+        fprintf(stderr, "blogc-make: error: failed to reload context. "
+            "reloader disabled!\n");
+        return false;
+    }
+    if (!reloaded && changed == NULL)
+        return true;
+
+    // when only some source files changed, rebuild just the outputs that
+    // depend on them. otherwise run the full rule, that also handles
+    // created and removed files.
+    int rv;
+    if (reloaded)
+        rv = reloader->rule_exec(reloader->ctx, reloader->outputs,
+            reloader->args);
+    else
+        rv = bm_rule_rebuild(reloader->ctx, changed);
+    bc_slist_free(changed);
+
+    if (rv != 0) {
+        fprintf(stderr, "blogc-make: error: failed to rebuild website. "
+            "reloader disabled!\n");
+        return false;
+    }
+    return true;
+}
+
+
+static void
+bm_reloader_poll(bm_reloader_t *reloader)
 {
-    bm_reloader_t *reloader = arg;
     while (reloader->running) {
-        if (!bm_ctx_reload(reloader->ctx)) {
-            fprintf(stderr, "blogc-make: error: failed to reload context. "
-                "reloader disabled!\n");
+        sleep(1);
+        if (!reloader->running)
+            break;
+        if (!bm_reloader_rebuild(reloader, false, NULL))
             break;
+    }
+}
+
+
+#ifdef USE_INOTIFY
+
+#define BM_RELOADER_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+    IN_CREATE | IN_DELETE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+
+static bool
+is_output(bm_ctx_t *ctx, const char *path)
+{
+    size_t len = strlen(ctx->output_dir);
+    return 0 == strncmp(path, ctx->output_dir, len) &&
+        (path[len] == '\0' || path[len] == '/');
+}
+
+
+static void
+add_watch(bm_reloader_t *reloader, const char *dir)
+{
+    if (is_output(reloader->ctx, dir))
+        return;
+
+    int wd = inotify_add_watch(reloader->inotify_fd, dir, BM_RELOADER_EVENTS |
+        IN_ONLYDIR);
+    if (wd < 0)
+        return;  // directory may not exist yet, its parent is watched
+
+    char *key = bc_strdup_printf("%d", wd);
+    bc_trie_insert(reloader->watches, key, bc_strdup(dir));
+    free(key);
+}
+
+
+static void
+add_watch_dirname(bm_reloader_t *reloader, bm_filectx_t *fctx)
+{
+    if (fctx == NULL)
+        return;
+
+    // dirname may modify its argument
+    char *tmp = bc_strdup(fctx->path);
+    add_watch(reloader, dirname(tmp));
+    free(tmp);
+}
+
+
+static void
+add_watch_r(bm_reloader_t *reloader, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return;
+
+    add_watch(reloader, dir);
+
+    struct dirent *e;
+    while (NULL != (e = readdir(d))) {
+        if ((0 == strcmp(e->d_name, ".")) || (0 == strcmp(e->d_name, "..")))
+            continue;
+        char *tmp = bc_strdup_printf("%s/%s", dir, e->d_name);
+        struct stat buf;
+        if (0 == stat(tmp, &buf) && S_ISDIR(buf.st_mode))
+            add_watch_r(reloader, tmp);
+        free(tmp);
+    }
+
+    closedir(d);
+}
+
+
+static void
+add_watches(bm_reloader_t *reloader)
+{
+    bm_ctx_t *ctx = reloader->ctx;
+
+    // new files created in the root directory may be referenced by the
+    // settings file later, and we need to know when missing directories
+    // are created.
+    add_watch(reloader, ctx->root_dir);
+    add_watch_dirname(reloader, ctx->settings_fctx);
+    add_watch_dirname(reloader, ctx->main_template_fctx);
+
+    for (bc_slist_t *tmp = ctx->posts_fctx; tmp != NULL; tmp = tmp->next)
+        add_watch_dirname(reloader, tmp->data);
+    for (bc_slist_t *tmp = ctx->pages_fctx; tmp != NULL; tmp = tmp->next)
+        add_watch_dirname(reloader, tmp->data);
+    for (bc_slist_t *tmp = ctx->copy_fctx; tmp != NULL; tmp = tmp->next)
+        add_watch_dirname(reloader, tmp->data);
+
+    // directories listed in the copy section are copied recursively, and
+    // files created anywhere inside them must be noticed.
+    if (ctx->settings != NULL && ctx->settings->copy != NULL) {
+        for (size_t i = 0; ctx->settings->copy[i] != NULL; i++) {
+            char *tmp = bc_strdup_printf("%s/%s", ctx->root_dir,
+                ctx->settings->copy[i]);
+            add_watch_r(reloader, tmp);
+            free(tmp);
         }
-        if (0 != reloader->rule_exec(reloader->ctx, reloader->outputs, reloader->args)) {
-            fprintf(stderr, "blogc-make: error: failed to rebuild website. "
-                "reloader disabled!\n");
+    }
+}
+
+
+static bool
+is_copy(bm_ctx_t *ctx, const char *path)
+{
+    // anything inside the directories listed in the copy section is copied,
+    // including files that don't exist yet.
+    if (ctx->settings == NULL || ctx->settings->copy == NULL)
+        return false;
+
+    size_t root_len = strlen(ctx->root_dir);
+    if (0 != strncmp(path, ctx->root_dir, root_len) || path[root_len] != '/')
+        return false;
+    const char *rel = path + root_len + 1;
+
+    for (size_t i = 0; ctx->settings->copy[i] != NULL; i++) {
+        const char *copy = ctx->settings->copy[i];
+        size_t len = strlen(copy);
+        while (len > 0 && copy[len - 1] == '/')
+            len--;
+        if (len > 0 && 0 == strncmp(rel, copy, len) &&
+            (rel[len] == '\0' || rel[len] == '/'))
+            return true;
+    }
+    return false;
+}
+
+
+static bool
+is_source_dir(bm_ctx_t *ctx, const char *path)
+{
+    // missing directories of source files may be created later.
+    size_t len = strlen(path);
+    bc_slist_t *lists[] = {ctx->posts_fctx, ctx->pages_fctx};
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        for (bc_slist_t *tmp = lists[i]; tmp != NULL; tmp = tmp->next) {
+            bm_filectx_t *fctx = tmp->data;
+            if (0 == strncmp(fctx->path, path, len) && fctx->path[len] == '/')
+                return true;
+        }
+    }
+    return ctx->main_template_fctx != NULL &&
+        0 == strncmp(ctx->main_template_fctx->path, path, len) &&
+        ctx->main_template_fctx->path[len] == '/';
+}
+
+
+// reads all the pending events, returns false if none of them is relevant.
+// only the settings file, the main template, the posts, the pages and the
+// files to be copied are relevant, temporary files created by text editors
+// are ignored. force is set when source files were created, or when
+// directories were removed or renamed. the paths of the source files that
+// changed are appended to paths, the ones removed are usually replaced right
+// away by text editors.
+static bool
+read_events(bm_reloader_t *reloader, bool *force, bc_slist_t **paths)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    bm_ctx_t *ctx = reloader->ctx;
+    bool rv = false;
+
+    while (true) {
+        ssize_t len = read(reloader->inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
             break;
+
+        const struct inotify_event *ev;
+        for (char *p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event*) p;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                *force = true;
+                rv = true;
+                continue;
+            }
+            if (ev->mask & IN_IGNORED)
+                continue;
+
+            char *key = bc_strdup_printf("%d", ev->wd);
+            const char *dir = bc_trie_lookup(reloader->watches, key);
+            free(key);
+            if (dir == NULL)
+                continue;
+
+            if (ev->len == 0) {
+                if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    *force = true;
+                    rv = true;
+                }
+                continue;
+            }
+
+            char *path = bc_strdup_printf("%s/%s", dir, ev->name);
+            if (is_output(ctx, path)) {
+                free(path);
+                continue;
+            }
+
+            bm_filectx_t *fctx = bc_trie_lookup(ctx->sources_fctx, path);
+            if (0 == strcmp(path, ctx->settings_fctx->path)) {
+                *force = true;
+                rv = true;
+            }
+            else if (fctx != NULL) {
+                // files renamed over a source file are just modifications.
+                if (!fctx->readable && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+                    *force = true;
+                *paths = bc_slist_append(*paths, bc_strdup(path));
+                rv = true;
+            }
+            else if (ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                    IN_MOVED_TO))
+            {
+                if (is_copy(ctx, path) ||
+                    ((ev->mask & IN_ISDIR) && is_source_dir(ctx, path)))
+                {
+                    *force = true;
+                    rv = true;
+                }
+            }
+            free(path);
         }
-        sleep(1);
     }
 
+    return rv;
+}
+
+
+static void
+bm_reloader_watch(bm_reloader_t *reloader)
+{
+    struct pollfd fds[2] = {
+        {.fd = reloader->inotify_fd, .events = POLLIN},
+        {.fd = reloader->stop_fd[0], .events = POLLIN},
+    };
+
+    while (reloader->running) {
+        // no timeout, we only wake up when something happens.
+        if (-1 == poll(fds, 2, -1)) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "blogc-make: error: failed to wait for file "
+                "changes: %s. reloader disabled!\n", strerror(errno));
+            break;
+        }
+        if (fds[1].revents != 0 || !reloader->running)
+            break;
+
+        bool force = false;
+        bc_slist_t *paths = NULL;
+        if (!read_events(reloader, &force, &paths))
+            continue;
+
+        // debounce: wait until no new events arrive for a short time.
+        for (int waited = 0; waited < BM_RELOADER_DEBOUNCE_MAX_MS;
+                waited += BM_RELOADER_DEBOUNCE_MS)
+        {
+            if (0 >= poll(fds, 1, BM_RELOADER_DEBOUNCE_MS))
+                break;
+            read_events(reloader, &force, &paths);
+        }
+
+        bool ok = bm_reloader_rebuild(reloader, force, paths);
+        bc_slist_free_full(paths, free);
+        if (!ok)
+            break;
+
+        // new directories may be available now.
+        if (force)
+            add_watches(reloader);
+    }
+}
+
+#endif /* USE_INOTIFY */
+
+
+static void
+bm_reloader_free(bm_reloader_t *reloader)
+{
+#ifdef USE_INOTIFY
+    if (reloader->inotify_fd >= 0)
+        close(reloader->inotify_fd);
+    close(reloader->stop_fd[0]);
+    close(reloader->stop_fd[1]);
+    bc_trie_free(reloader->watches);
+#endif /* USE_INOTIFY */
     free(reloader);
+}
+
+
+static void*
+bm_reloader_thread(void *arg)
+{
+    // the reloader is owned by bm_reloader_stop(), that frees it after
+    // joining the thread, even if the thread gave up on its own before.
+    bm_reloader_t *reloader = arg;
+
+#ifdef USE_INOTIFY
+    if (reloader->inotify_fd >= 0) {
+        bm_reloader_watch(reloader);
+        return NULL;
+    }
+#endif /* USE_INOTIFY */
+
+    bm_reloader_poll(reloader);
     return NULL;
 }
 
@@ -53,21 +404,6 @@ bm_reloader_new(bm_ctx_t *ctx, bm_rule_exec_func_t rule_exec,
 
     int err;
 
-    pthread_attr_t attr;
-    if (0 != (err = pthread_attr_init(&attr))) {
-        fprintf(stderr, "blogc-make: error: failed to initialize reloader "
-            "thread attributes: %s\n", strerror(err));
-        return NULL;
-    }
-
-    // we run the thread detached, because we don't want to wait it to join
-    // before exiting. the OS can clean it properly
-    if (0 != (err = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED))) {
-        fprintf(stderr, "blogc-make: error: failed to mark reloader thread as "
-            "detached: %s\n", strerror(err));
-        return NULL;
-    }
-
     bm_reloader_t *rv = bc_malloc(sizeof(bm_reloader_t));
     rv->ctx = ctx;
     rv->rule_exec = rule_exec;
@@ -75,11 +411,43 @@ bm_reloader_new(bm_ctx_t *ctx, bm_rule_exec_func_t rule_exec,
     rv->args = args;
     rv->running = true;
 
-    pthread_t thread;
-    if (0 != (err = pthread_create(&thread, &attr, bm_reloader_thread, rv))) {
+#ifdef USE_INOTIFY
+    rv->watches = bc_trie_new(free);
+    rv->inotify_fd = -1;
+    if (0 != pipe(rv->stop_fd)) {
+        fprintf(stderr, "blogc-make: error: failed to create reloader pipe: "
+            "%s\n", strerror(errno));
+        bc_trie_free(rv->watches);
+        free(rv);
+        return NULL;
+    }
+
+    // if inotify is not available for some reason (e.g. the limit of
+    // instances was reached), we fallback to polling.
+    rv->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (rv->inotify_fd < 0) {
+        fprintf(stderr, "blogc-make: warning: failed to initialize inotify, "
+            "falling back to polling: %s\n", strerror(errno));
+    }
+    else {
+        add_watches(rv);
+        if (bc_trie_size(rv->watches) == 0) {
+            fprintf(stderr, "blogc-make: warning: failed to watch source "
+                "directories, falling back to polling\n");
+            close(rv->inotify_fd);
+            rv->inotify_fd = -1;
+        }
+    }
+#endif /* USE_INOTIFY */
+
+    // the thread is joined by bm_reloader_stop(), so a rebuild in progress
+    // isn't interrupted when exiting.
+    if (0 != (err = pthread_create(&(rv->thread), NULL, bm_reloader_thread,
+            rv)))
+    {
         fprintf(stderr, "blogc-make: error: failed to create reloader "
             "thread: %s\n", strerror(err));
-        free(rv);
+        bm_reloader_free(rv);
         return NULL;
     }
 
@@ -93,4 +461,13 @@ bm_reloader_stop(bm_reloader_t *reloader)
     if (reloader == NULL)
         return;
     reloader->running = false;
+#ifdef USE_INOTIFY
+    // wake up the thread, if it is waiting for events. the pipe is still
+    // open, even if the thread already gave up.
+    if (-1 == write(reloader->stop_fd[1], "", 1)) {
+        // nothing we can do, the thread will notice when polling
+    }
+#endif /* USE_INOTIFY */
+    pthread_join(reloader->thread, NULL);
+    bm_reloader_free(reloader);
 }
@@ -9,6 +9,7 @@
 #ifndef _MAKE_RELOADER_H
 #define _MAKE_RELOADER_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include "ctx.h"
 #include "rules.h"
@@ -19,6 +20,12 @@ typedef struct {
     bc_slist_t *outputs;
     bc_trie_t *args;
     bool running;
+    pthread_t thread;
+
+    // used only when inotify is available
+    int inotify_fd;
+    int stop_fd[2];
+    bc_trie_t *watches;
 } bm_reloader_t;
 
 bm_reloader_t* bm_reloader_new(bm_ctx_t *ctx, bm_rule_exec_func_t rule_exec,
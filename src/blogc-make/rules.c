@@ -6,18 +6,26 @@
  * See the file LICENSE.
  */
 
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
+#include "../common/error.h"
+#include "../common/file.h"
 #include "../common/utils.h"
+#include "atom.h"
+#include "compress.h"
 #include "ctx.h"
 #include "exec.h"
 #include "exec-native.h"
 #include "reloader.h"
 #include "settings.h"
+#include "state.h"
+#include "trace.h"
 #include "rules.h"
 
 
@@ -35,6 +43,255 @@ posts_ordering(bm_ctx_t *ctx, bc_trie_t *variables, const char *variable)
 }
 
 
+static void
+append_variable(const char *key, void *data, void *user_data)
+{
+    bc_string_append_printf(user_data, "%s=%s\n", key, (char*) data);
+}
+
+
+static long
+filter_value(bc_trie_t *variables, const char *name, long def)
+{
+    // same parsing and defaults used by blogc's loader.
+    const char *value = bc_trie_lookup(variables, name);
+    if (value == NULL)
+        return def;
+    long rv = strtol(value, NULL, 10);
+    return rv > 0 ? rv : def;
+}
+
+
+static bc_slist_t*
+listing_sources(bm_ctx_t *ctx, bc_slist_t *sources, bc_trie_t *variables,
+    size_t *count)
+{
+    // returns the sources that will actually end up in a listing, applying
+    // the same filters applied by blogc. *count is the number of sources that
+    // matched the tag filter, because it changes the pagination variables.
+    // returns all the sources, unfiltered, if something goes wrong.
+    const char *filter_tag = bc_trie_lookup(variables, "FILTER_TAG");
+    bool paginate = NULL != bc_trie_lookup(variables, "FILTER_PAGE");
+    long page = filter_value(variables, "FILTER_PAGE", 1);
+    long per_page = filter_value(variables, "FILTER_PER_PAGE", 10);
+    size_t start = (page - 1) * per_page;
+    size_t end = start + per_page;
+
+    bc_slist_t *candidates = NULL;
+    for (bc_slist_t *l = sources; l != NULL; l = l->next) {
+        if (NULL != bc_trie_lookup(variables, "FILTER_REVERSE"))
+            candidates = bc_slist_prepend(candidates, l->data);
+        else
+            candidates = bc_slist_append(candidates, l->data);
+    }
+
+    bc_slist_t *rv = NULL;
+    *count = 0;
+
+    for (bc_slist_t *l = candidates; l != NULL; l = l->next) {
+        bm_filectx_t *fctx = l->data;
+        if (filter_tag != NULL) {
+            const char *tags_str = bm_state_get_file_tags(ctx->state,
+                fctx->path);
+            if (tags_str == NULL) {
+                bc_slist_free(candidates);
+                bc_slist_free(rv);
+                *count = 0;
+                return bc_slist_append(NULL, fctx);  // let blogc bail out
+            }
+            char **tags = bc_str_split(tags_str, ' ', 0);
+            bool found = false;
+            for (size_t i = 0; tags[i] != NULL; i++) {
+                if (0 == strcmp(tags[i], filter_tag))
+                    found = true;
+            }
+            bc_strv_free(tags);
+            if (!found)
+                continue;
+        }
+        if (!paginate || (*count >= start && *count < end))
+            rv = bc_slist_append(rv, fctx);
+        (*count)++;
+    }
+
+    bc_slist_free(candidates);
+    return rv;
+}
+
+
+// copied files pass NULL variables, they don't depend on settings.
+static bool
+need_rebuild(bm_ctx_t *ctx, bc_slist_t *sources, bm_filectx_t *template,
+    bm_filectx_t *output, bool only_first_source, bc_trie_t *variables,
+    bool listing)
+{
+    double start = ctx->trace != NULL ? bm_trace_now() : 0;
+
+    bool rv;
+    if (ctx->state == NULL) {
+        rv = bm_rule_need_rebuild(sources, ctx->settings_fctx, template,
+            output, only_first_source);
+    }
+    else {
+        // listings only depend on the sources that end up in them, e.g.
+        // fixing an old post won't rebuild the index.
+        size_t count = 0;
+        bc_slist_t *selected = NULL;
+        if (listing) {
+            selected = listing_sources(ctx, sources, variables, &count);
+            sources = selected;
+        }
+
+        bc_slist_t *inputs = NULL;
+        if (variables != NULL)
+            inputs = bc_slist_append(inputs, ctx->settings_fctx->path);
+        if (template != NULL)
+            inputs = bc_slist_append(inputs, template->path);
+        for (bc_slist_t *l = sources; l != NULL; l = l->next) {
+            inputs = bc_slist_append(inputs, ((bm_filectx_t*) l->data)->path);
+            if (only_first_source)
+                break;
+        }
+
+        bc_string_t *extra = bc_string_new();
+        if (variables != NULL) {
+            bc_string_append_printf(extra, "listing=%d\ndev=%d\ncount=%zu\n",
+                listing, ctx->dev, count);
+            bc_trie_foreach(variables, append_variable, extra);
+        }
+
+        rv = bm_state_need_rebuild(ctx->state, output->path, inputs,
+            extra->str);
+
+        // outputs built before the state file existed are trusted if they
+        // are up to date, by mtime.
+        if (rv && !bm_state_has_output(ctx->state, output->path) &&
+            !bm_rule_need_rebuild(sources,
+                variables != NULL ? ctx->settings_fctx : NULL, template,
+                output, only_first_source))
+        {
+            bm_state_set_built(ctx->state, output->path);
+            rv = false;
+        }
+
+        bc_string_free(extra, true);
+        bc_slist_free(inputs);
+        bc_slist_free(selected);
+    }
+
+    if (output != NULL)
+        bm_trace_add(ctx->trace, "check", output->short_path, start);
+    return rv;
+}
+
+
+static bm_filectx_t*
+output_new(bm_ctx_t *ctx, const char *filename, const char *tag)
+{
+    // outputs not affected by a targeted rebuild are replaced by NULL in the
+    // output lists, without being stat'ed. tag pages are affected if the tag
+    // was added to or removed from a changed post.
+    if (ctx->rebuild_outputs != NULL) {
+        char *path = filename[0] == '/' ? bc_strdup(filename) :
+            bc_strdup_printf("%s/%s", ctx->root_dir, filename);
+        bool affected = NULL != bc_trie_lookup(ctx->rebuild_outputs, path) ||
+            (tag != NULL && NULL != bc_trie_lookup(ctx->rebuild_tags, tag));
+        free(path);
+        if (!affected)
+            return NULL;
+    }
+    return bm_filectx_new(ctx, filename);
+}
+
+
+static void
+output_built(bm_ctx_t *ctx, bm_filectx_t *output)
+{
+    bm_state_set_built(ctx->state, output->path);
+    bm_compress_queue(ctx, output);
+}
+
+
+static bool
+is_fingerprinted(bm_ctx_t *ctx, bm_filectx_t *fctx)
+{
+    const char *exts = bc_trie_lookup(ctx->settings->settings,
+        "copy_fingerprint");
+    if (exts == NULL)
+        return false;
+
+    bool rv = false;
+    char **pieces = bc_str_split(exts, ' ', 0);
+    for (size_t i = 0; pieces[i] != NULL; i++) {
+        if (pieces[i][0] != '\0' &&
+            bc_str_ends_with(fctx->short_path, pieces[i]))
+        {
+            rv = true;
+            break;
+        }
+    }
+    bc_strv_free(pieces);
+    return rv;
+}
+
+
+static char*
+fingerprint_path(bm_ctx_t *ctx, bm_filectx_t *fctx)
+{
+    // path of the output of a copied file, with a hash of its content before
+    // the extension, e.g. css/style.0123abcd.css. the hash is cached by the
+    // build state, and only computed again if the file changed.
+    if (!is_fingerprinted(ctx, fctx))
+        return NULL;
+
+    uint64_t hash;
+    if (!bm_state_get_file_hash(ctx->state, fctx->path, &hash)) {
+        bc_error_t *err = NULL;
+        hash = bc_file_get_hash(fctx->path, &err);
+        if (err != NULL) {
+            // let the copy rule report it.
+            bc_error_free(err);
+            return NULL;
+        }
+    }
+
+    const char *base = strrchr(fctx->short_path, '/');
+    base = base == NULL ? fctx->short_path : base + 1;
+    const char *ext = strrchr(base, '.');
+    if (ext == NULL || ext == base)
+        ext = base + strlen(base);
+
+    return bc_strdup_printf("%.*s.%08" PRIx32 "%s",
+        (int) (ext - fctx->short_path), fctx->short_path,
+        (uint32_t) (hash ^ (hash >> 32)), ext);
+}
+
+
+static void
+asset_variables(bm_ctx_t *ctx, bc_trie_t *variables)
+{
+    // ASSET_CSS_STYLE_CSS=css/style.0123abcd.css, for each fingerprinted file.
+    for (bc_slist_t *l = ctx->copy_fctx; l != NULL; l = l->next) {
+        bm_filectx_t *fctx = l->data;
+        char *path = fingerprint_path(ctx, fctx);
+        if (path == NULL)
+            continue;
+        bc_string_t *key = bc_string_new();
+        bc_string_append(key, "ASSET_");
+        for (const char *c = fctx->short_path; *c != '\0'; c++) {
+            if ((*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9'))
+                bc_string_append_c(key, *c);
+            else if (*c >= 'a' && *c <= 'z')
+                bc_string_append_c(key, *c - 'a' + 'A');
+            else
+                bc_string_append_c(key, '_');
+        }
+        bc_trie_insert(variables, key->str, path);
+        bc_string_free(key, true);
+    }
+}
+
+
 // INDEX RULE
 
 static bc_slist_t*
@@ -52,7 +309,7 @@ index_outputlist(bm_ctx_t *ctx)
     char *f = bc_strdup_printf("%s%s%s%s", ctx->short_output_dir,
         is_index ? "" : "/", is_index ? "" : index_prefix,
         html_ext);
-    rv = bc_slist_append(rv, bm_filectx_new(ctx, f));
+    rv = bc_slist_append(rv, output_new(ctx, f, NULL));
     free(f);
     return rv;
 }
@@ -74,18 +331,20 @@ index_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bc_strdup(bc_trie_lookup(ctx->settings->settings, "date_format")));
     bc_trie_insert(variables, "MAKE_RULE", bc_strdup("index"));
     bc_trie_insert(variables, "MAKE_TYPE", bc_strdup("post"));
+    asset_variables(ctx, variables);
 
     for (bc_slist_t *l = outputs; l != NULL; l = l->next) {
         bm_filectx_t *fctx = l->data;
         if (fctx == NULL)
             continue;
-        if (bm_rule_need_rebuild(ctx->posts_fctx, ctx->settings_fctx,
-                ctx->main_template_fctx, fctx, false))
+        if (need_rebuild(ctx, ctx->posts_fctx, ctx->main_template_fctx, fctx,
+                false, variables, true))
         {
             rv = bm_exec_blogc(ctx, variables, true, ctx->main_template_fctx,
                 fctx, ctx->posts_fctx, false);
             if (rv != 0)
                 break;
+            output_built(ctx, fctx);
         }
     }
 
@@ -109,7 +368,7 @@ atom_outputlist(bm_ctx_t *ctx)
     const char *atom_ext = bc_trie_lookup(ctx->settings->settings, "atom_ext");
     char *f = bc_strdup_printf("%s/%s%s", ctx->short_output_dir,
         atom_prefix, atom_ext);
-    rv = bc_slist_append(rv, bm_filectx_new(ctx, f));
+    rv = bc_slist_append(rv, output_new(ctx, f, NULL));
     free(f);
     return rv;
 }
@@ -136,13 +395,13 @@ atom_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bm_filectx_t *fctx = l->data;
         if (fctx == NULL)
             continue;
-        if (bm_rule_need_rebuild(ctx->posts_fctx, ctx->settings_fctx, NULL,
-                fctx, false))
+        if (need_rebuild(ctx, ctx->posts_fctx, NULL, fctx, false, variables,
+                true))
         {
-            rv = bm_exec_blogc(ctx, variables, true, ctx->atom_template_fctx,
-                fctx, ctx->posts_fctx, false);
+            rv = bm_atom_render(ctx, variables, fctx, ctx->posts_fctx);
             if (rv != 0)
                 break;
+            output_built(ctx, fctx);
         }
     }
 
@@ -167,7 +426,7 @@ atom_tags_outputlist(bm_ctx_t *ctx)
     for (size_t i = 0; ctx->settings->tags[i] != NULL; i++) {
         char *f = bc_strdup_printf("%s/%s/%s%s", ctx->short_output_dir,
             atom_prefix, ctx->settings->tags[i], atom_ext);
-        rv = bc_slist_append(rv, bm_filectx_new(ctx, f));
+        rv = bc_slist_append(rv, output_new(ctx, f, ctx->settings->tags[i]));
         free(f);
     }
     return rv;
@@ -200,13 +459,13 @@ atom_tags_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bc_trie_insert(variables, "FILTER_TAG",
             bc_strdup(ctx->settings->tags[i]));
 
-        if (bm_rule_need_rebuild(ctx->posts_fctx, ctx->settings_fctx, NULL,
-                fctx, false))
+        if (need_rebuild(ctx, ctx->posts_fctx, NULL, fctx, false, variables,
+                true))
         {
-            rv = bm_exec_blogc(ctx, variables, true, ctx->atom_template_fctx,
-                fctx, ctx->posts_fctx, false);
+            rv = bm_atom_render(ctx, variables, fctx, ctx->posts_fctx);
             if (rv != 0)
                 break;
+            output_built(ctx, fctx);
         }
     }
 
@@ -239,7 +498,7 @@ pagination_outputlist(bm_ctx_t *ctx)
     for (size_t i = 0; i < pages; i++) {
         char *f = bc_strdup_printf("%s/%s/%d%s", ctx->short_output_dir,
             pagination_prefix, i + 1, html_ext);
-        rv = bc_slist_append(rv, bm_filectx_new(ctx, f));
+        rv = bc_slist_append(rv, output_new(ctx, f, NULL));
         free(f);
     }
     return rv;
@@ -262,19 +521,21 @@ pagination_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bc_strdup(bc_trie_lookup(ctx->settings->settings, "date_format")));
     bc_trie_insert(variables, "MAKE_RULE", bc_strdup("pagination"));
     bc_trie_insert(variables, "MAKE_TYPE", bc_strdup("post"));
+    asset_variables(ctx, variables);
 
     for (bc_slist_t *l = outputs; l != NULL; l = l->next, page++) {
         bm_filectx_t *fctx = l->data;
         if (fctx == NULL)
             continue;
         bc_trie_insert(variables, "FILTER_PAGE", bc_strdup_printf("%zu", page));
-        if (bm_rule_need_rebuild(ctx->posts_fctx, ctx->settings_fctx,
-                ctx->main_template_fctx, fctx, false))
+        if (need_rebuild(ctx, ctx->posts_fctx, ctx->main_template_fctx, fctx,
+                false, variables, true))
         {
             rv = bm_exec_blogc(ctx, variables, true, ctx->main_template_fctx,
                 fctx, ctx->posts_fctx, false);
             if (rv != 0)
                 break;
+            output_built(ctx, fctx);
         }
     }
 
@@ -301,7 +562,7 @@ posts_outputlist(bm_ctx_t *ctx)
     for (size_t i = 0; ctx->settings->posts[i] != NULL; i++) {
         char *f = bc_strdup_printf("%s/%s/%s%s", ctx->short_output_dir,
             post_prefix, ctx->settings->posts[i], html_ext);
-        rv = bc_slist_append(rv, bm_filectx_new(ctx, f));
+        rv = bc_slist_append(rv, output_new(ctx, f, NULL));
         free(f);
     }
     return rv;
@@ -322,6 +583,7 @@ posts_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
     posts_ordering(ctx, variables, "html_order");
     bc_trie_insert(variables, "MAKE_RULE", bc_strdup("posts"));
     bc_trie_insert(variables, "MAKE_TYPE", bc_strdup("post"));
+    asset_variables(ctx, variables);
 
     bc_slist_t *s, *o;
 
@@ -331,13 +593,14 @@ posts_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bm_filectx_t *o_fctx = o->data;
         if (o_fctx == NULL)
             continue;
-        if (bm_rule_need_rebuild(s, ctx->settings_fctx,
-                ctx->main_template_fctx, o_fctx, true))
+        if (need_rebuild(ctx, s, ctx->main_template_fctx, o_fctx, true,
+                variables, false))
         {
             rv = bm_exec_blogc(ctx, variables, false, ctx->main_template_fctx,
                 o_fctx, s, true);
             if (rv != 0)
                 break;
+            output_built(ctx, o_fctx);
         }
     }
 
@@ -362,7 +625,7 @@ tags_outputlist(bm_ctx_t *ctx)
     for (size_t i = 0; ctx->settings->tags[i] != NULL; i++) {
         char *f = bc_strdup_printf("%s/%s/%s%s", ctx->short_output_dir,
             tag_prefix, ctx->settings->tags[i], html_ext);
-        rv = bc_slist_append(rv, bm_filectx_new(ctx, f));
+        rv = bc_slist_append(rv, output_new(ctx, f, ctx->settings->tags[i]));
         free(f);
     }
     return rv;
@@ -387,6 +650,7 @@ tags_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bc_strdup(bc_trie_lookup(ctx->settings->settings, "date_format")));
     bc_trie_insert(variables, "MAKE_RULE", bc_strdup("tags"));
     bc_trie_insert(variables, "MAKE_TYPE", bc_strdup("post"));
+    asset_variables(ctx, variables);
 
     for (bc_slist_t *l = outputs; l != NULL; l = l->next, i++) {
         bm_filectx_t *fctx = l->data;
@@ -396,13 +660,14 @@ tags_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bc_trie_insert(variables, "FILTER_TAG",
             bc_strdup(ctx->settings->tags[i]));
 
-        if (bm_rule_need_rebuild(ctx->posts_fctx, ctx->settings_fctx,
-                ctx->main_template_fctx, fctx, false))
+        if (need_rebuild(ctx, ctx->posts_fctx, ctx->main_template_fctx, fctx,
+                false, variables, true))
         {
             rv = bm_exec_blogc(ctx, variables, true, ctx->main_template_fctx,
                 fctx, ctx->posts_fctx, false);
             if (rv != 0)
                 break;
+            output_built(ctx, fctx);
         }
     }
 
@@ -429,7 +694,7 @@ pages_outputlist(bm_ctx_t *ctx)
         char *f = bc_strdup_printf("%s%s%s%s", ctx->short_output_dir,
             is_index ? "" : "/", is_index ? "" : ctx->settings->pages[i],
             html_ext);
-        rv = bc_slist_append(rv, bm_filectx_new(ctx, f));
+        rv = bc_slist_append(rv, output_new(ctx, f, NULL));
         free(f);
     }
     return rv;
@@ -448,6 +713,7 @@ pages_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bc_strdup(bc_trie_lookup(ctx->settings->settings, "date_format")));
     bc_trie_insert(variables, "MAKE_RULE", bc_strdup("pages"));
     bc_trie_insert(variables, "MAKE_TYPE", bc_strdup("page"));
+    asset_variables(ctx, variables);
 
     bc_slist_t *s, *o;
 
@@ -457,13 +723,14 @@ pages_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         bm_filectx_t *o_fctx = o->data;
         if (o_fctx == NULL)
             continue;
-        if (bm_rule_need_rebuild(s, ctx->settings_fctx,
-                ctx->main_template_fctx, o_fctx, true))
+        if (need_rebuild(ctx, s, ctx->main_template_fctx, o_fctx, true,
+                variables, false))
         {
             rv = bm_exec_blogc(ctx, variables, false, ctx->main_template_fctx,
                 o_fctx, s, true);
             if (rv != 0)
                 break;
+            output_built(ctx, o_fctx);
         }
     }
 
@@ -482,12 +749,22 @@ copy_outputlist(bm_ctx_t *ctx)
         return NULL;
 
     bc_slist_t *rv = NULL;
+    bc_slist_t *last = NULL;
     // we iterate over ctx->copy_fctx list instead of ctx->settings->copy,
     // because bm_ctx_new() expands directories into its files, recursively.
+    // the list may be huge, then we append to its tail directly.
     for (bc_slist_t *s = ctx->copy_fctx; s != NULL; s = s->next) {
+        bm_filectx_t *fctx = s->data;
+        char *fp = fingerprint_path(ctx, fctx);
         char *f = bc_strdup_printf("%s/%s", ctx->short_output_dir,
-            ((bm_filectx_t*) s->data)->short_path);
-        rv = bc_slist_append(rv, bm_filectx_new(ctx, f));
+            fp != NULL ? fp : fctx->short_path);
+        free(fp);
+        bc_slist_t *node = bc_slist_append(NULL, output_new(ctx, f, NULL));
+        if (last == NULL)
+            rv = node;
+        else
+            last->next = node;
+        last = node;
         free(f);
     }
     return rv;
@@ -499,6 +776,21 @@ copy_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
     if (ctx == NULL || ctx->settings->copy == NULL)
         return 0;
 
+    const char *mode = bc_trie_lookup(ctx->settings->settings, "copy_mode");
+    bool use_link = false;
+    bool symbolic = false;
+    if (mode != NULL && 0 == strcmp(mode, "hardlink")) {
+        use_link = true;
+    }
+    else if (mode != NULL && 0 == strcmp(mode, "symlink")) {
+        use_link = true;
+        symbolic = true;
+    }
+    else if (mode != NULL && 0 != strcmp(mode, "copy")) {
+        fprintf(stderr, "blogc-make: error: invalid copy_mode: %s\n", mode);
+        return 3;
+    }
+
     int rv = 0;
 
     bc_slist_t *s, *o;
@@ -510,10 +802,17 @@ copy_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
         if (o_fctx == NULL)
             continue;
 
-        if (bm_rule_need_rebuild(s, ctx->settings_fctx, NULL, o_fctx, true)) {
-            rv = bm_exec_native_cp(s->data, o_fctx, ctx->verbose);
+        if (need_rebuild(ctx, s, NULL, o_fctx, true, NULL, false)) {
+            double start = ctx->trace != NULL ? bm_trace_now() : 0;
+            if (use_link)
+                rv = bm_exec_native_link(s->data, o_fctx, symbolic,
+                    ctx->verbose);
+            else
+                rv = bm_exec_native_cp(s->data, o_fctx, ctx->verbose);
+            bm_trace_add(ctx->trace, "output", o_fctx->short_path, start);
             if (rv != 0)
                 break;
+            output_built(ctx, o_fctx);
         }
     }
 
@@ -529,10 +828,20 @@ clean_outputlist(bm_ctx_t *ctx)
     return bm_rule_list_built_files(ctx);
 }
 
+static int prune_outputs(bm_ctx_t *ctx);
+
 static int
 clean_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
 {
-    int rv = 0;
+    // outputs built previously, whose names changed since then, are only
+    // known by the build state.
+    int rv = prune_outputs(ctx);
+    if (rv != 0)
+        return rv;
+
+    // the build state must go first, otherwise the output directory won't
+    // be empty and can't be removed.
+    bm_state_clear(ctx->state);
 
     for (bc_slist_t *l = outputs; l != NULL; l = l->next) {
         bm_filectx_t *fctx = l->data;
@@ -660,6 +969,53 @@ const bm_rule_t rules[] = {
 
 // ALL RULE
 
+static void
+save_state(bm_ctx_t *ctx)
+{
+    bc_error_t *err = NULL;
+    if (!bm_state_save(ctx->state, &err) && err != NULL) {
+        // not fatal, the next build will just do more work.
+        fprintf(stderr, "blogc-make: warning: %s\n", err->msg);
+        bc_error_free(err);
+    }
+}
+
+
+static int
+prune_outputs(bm_ctx_t *ctx)
+{
+    if (ctx->state == NULL)
+        return 0;
+
+    // remove outputs built previously, whose inputs are gone.
+    bc_slist_t *outputs = bm_rule_list_built_files(ctx);
+    bc_slist_t *paths = NULL;
+    for (bc_slist_t *l = outputs; l != NULL; l = l->next)
+        paths = bc_slist_prepend(paths, ((bm_filectx_t*) l->data)->path);
+
+    bc_slist_t *removed = bm_state_prune(ctx->state, paths);
+
+    bc_slist_free(paths);
+    bc_slist_free_full(outputs, (bc_free_func_t) bm_filectx_free);
+
+    int rv = 0;
+    for (bc_slist_t *l = removed; l != NULL; l = l->next) {
+        char *f = bc_strdup_printf("%s/%s", ctx->short_output_dir,
+            (char*) l->data);
+        bm_filectx_t *fctx = bm_filectx_new(ctx, f);
+        free(f);
+        if (fctx->readable)
+            rv = bm_exec_native_rm(ctx->output_dir, fctx, ctx->verbose);
+        bm_filectx_free(fctx);
+        if (rv != 0)
+            break;
+    }
+    bc_slist_free_full(removed, free);
+
+    return rv;
+}
+
+
 static int
 all_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
 {
@@ -670,10 +1026,14 @@ all_exec(bm_ctx_t *ctx, bc_slist_t *outputs, bc_trie_t *args)
 
         int rv = bm_rule_execute(ctx, &(rules[i]), NULL);
         if (rv != 0) {
+            save_state(ctx);
             return rv;
         }
     }
-    return 0;
+
+    int rv = prune_outputs(ctx);
+    save_state(ctx);
+    return rv;
 }
 
 
@@ -740,8 +1100,10 @@ bm_rule_executor(bm_ctx_t *ctx, bc_slist_t *rule_list)
             if (0 == strncmp(rule_str, rules[i].name, sep - rule_str)) {
                 rule = &(rules[i]);
                 rv = bm_rule_execute(ctx, rule, args);
-                if (rv != 0)
+                if (rv != 0) {
+                    save_state(ctx);
                     return rv;
+                }
             }
         }
         if (rule == NULL) {
@@ -751,6 +1113,8 @@ bm_rule_executor(bm_ctx_t *ctx, bc_slist_t *rule_list)
         }
     }
 
+    save_state(ctx);
+
     return rv;
 }
 
@@ -761,6 +1125,10 @@ bm_rule_execute(bm_ctx_t *ctx, const bm_rule_t *rule, bc_trie_t *args)
     if (ctx == NULL || rule == NULL)
         return 3;
 
+    double start = ctx->trace != NULL ? bm_trace_now() : 0;
+
+    bm_state_invalidate(ctx->state);
+
     bc_slist_t *outputs = NULL;
     if (rule->outputlist_func != NULL) {
         outputs = rule->outputlist_func(ctx);
@@ -768,12 +1136,147 @@ bm_rule_execute(bm_ctx_t *ctx, const bm_rule_t *rule, bc_trie_t *args)
 
     int rv = rule->exec_func(ctx, outputs, args);
 
+    bm_trace_add(ctx->trace, "rule", rule->name, start);
+
+    // outputs built before a failure are compressed anyway.
+    int compress_rv = bm_compress_flush(ctx);
+    if (rv == 0)
+        rv = compress_rv;
+
     bc_slist_free_full(outputs, (bc_free_func_t) bm_filectx_free);
 
     return rv;
 }
 
 
+// TARGETED REBUILDS
+
+static bool
+in_list(bc_slist_t *l, bm_filectx_t *fctx)
+{
+    for (bc_slist_t *tmp = l; tmp != NULL; tmp = tmp->next) {
+        if (tmp->data == fctx)
+            return true;
+    }
+    return false;
+}
+
+
+static void
+add_tags(bc_trie_t *trie, const char *tags_str)
+{
+    if (tags_str == NULL)
+        return;
+    char **tags = bc_str_split(tags_str, ' ', 0);
+    for (size_t i = 0; tags[i] != NULL; i++) {
+        if (tags[i][0] != '\0')
+            bc_trie_insert(trie, tags[i], bc_strdup("1"));
+    }
+    bc_strv_free(tags);
+}
+
+
+int
+bm_rule_rebuild(bm_ctx_t *ctx, bc_slist_t *changed)
+{
+    // rebuilds only the outputs that depend on the changed source files,
+    // found by the inputs recorded by the build state for each output. the
+    // outputs that are not affected are replaced by NULL in the output
+    // lists, that are skipped by the rules.
+    if (ctx == NULL)
+        return 3;
+
+    if (ctx->state == NULL)
+        return all_exec(ctx, NULL, NULL);
+
+    bc_trie_t *tags = bc_trie_new(free);
+    bc_slist_t *paths = NULL;
+    bool fingerprint = false;
+
+    // tags from the previous build must be collected before checking the
+    // files again, to rebuild the pages of tags removed from a post.
+    for (bc_slist_t *l = changed; l != NULL; l = l->next) {
+        bm_filectx_t *fctx = l->data;
+        paths = bc_slist_append(paths, fctx->path);
+        if (in_list(ctx->posts_fctx, fctx))
+            add_tags(tags, bm_state_get_cached_file_tags(ctx->state,
+                fctx->path));
+
+        // the name of a fingerprinted file changes with its content, and
+        // every page may reference it.
+        if (in_list(ctx->copy_fctx, fctx) && is_fingerprinted(ctx, fctx))
+            fingerprint = true;
+    }
+
+    int rv = fingerprint ? -1 : 0;
+
+    for (bc_slist_t *l = changed; rv == 0 && l != NULL; l = l->next) {
+        bm_filectx_t *fctx = l->data;
+        bm_state_invalidate_file(ctx->state, fctx->path);
+        if (!in_list(ctx->posts_fctx, fctx))
+            continue;
+        const char *t = bm_state_get_file_tags(ctx->state, fctx->path);
+        if (t == NULL) {
+            // something is wrong with the source file, let the full build
+            // report it.
+            rv = -1;
+            break;
+        }
+        add_tags(tags, t);
+    }
+
+    if (rv == 0) {
+        ctx->rebuild_outputs = bm_state_get_outputs(ctx->state, paths);
+        ctx->rebuild_tags = tags;
+
+        bool affected = bc_trie_size(ctx->rebuild_outputs) > 0 ||
+            bc_trie_size(tags) > 0;
+
+        for (size_t i = 0; affected && rules[i].name != NULL; i++) {
+            if (!rules[i].generate_files || rules[i].outputlist_func == NULL)
+                continue;
+
+            double start = ctx->trace != NULL ? bm_trace_now() : 0;
+
+            bc_slist_t *outputs = rules[i].outputlist_func(ctx);
+            bool any = false;
+            for (bc_slist_t *o = outputs; o != NULL; o = o->next) {
+                if (o->data != NULL) {
+                    any = true;
+                    break;
+                }
+            }
+
+            if (any) {
+                rv = rules[i].exec_func(ctx, outputs, NULL);
+                bm_trace_add(ctx->trace, "rule", rules[i].name, start);
+                int compress_rv = bm_compress_flush(ctx);
+                if (rv == 0)
+                    rv = compress_rv;
+            }
+
+            bc_slist_free_full(outputs, (bc_free_func_t) bm_filectx_free);
+
+            if (rv != 0)
+                break;
+        }
+
+        bc_trie_free(ctx->rebuild_outputs);
+        ctx->rebuild_outputs = NULL;
+        ctx->rebuild_tags = NULL;
+        save_state(ctx);
+    }
+
+    bc_slist_free(paths);
+    bc_trie_free(tags);
+
+    if (rv == -1)
+        return all_exec(ctx, NULL, NULL);
+
+    return rv;
+}
+
+
 bool
 bm_rule_need_rebuild(bc_slist_t *sources, bm_filectx_t *settings,
     bm_filectx_t *template, bm_filectx_t *output, bool only_first_source)
@@ -828,16 +1331,22 @@ bm_rule_list_built_files(bm_ctx_t *ctx)
         return NULL;
 
     bc_slist_t *rv = NULL;
+    bc_slist_t *last = NULL;
     for (size_t i = 0; rules[i].name != NULL; i++) {
         if (!rules[i].generate_files) {
             continue;
         }
 
+        // link the lists together, bc_slist_append() would walk the whole
+        // list for each file.
         bc_slist_t *o = rules[i].outputlist_func(ctx);
-        for (bc_slist_t *l = o; l != NULL; l = l->next) {
-            rv = bc_slist_append(rv, l->data);
-        }
-        bc_slist_free(o);
+        if (o == NULL)
+            continue;
+        if (last == NULL)
+            rv = o;
+        else
+            last->next = o;
+        for (last = o; last->next != NULL; last = last->next);
     }
     return rv;
 }
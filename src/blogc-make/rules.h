@@ -28,6 +28,7 @@ typedef struct {
 bc_trie_t* bm_rule_parse_args(const char *sep);
 int bm_rule_executor(bm_ctx_t *ctx, bc_slist_t *rule_list);
 int bm_rule_execute(bm_ctx_t *ctx, const bm_rule_t *rule, bc_trie_t *args);
+int bm_rule_rebuild(bm_ctx_t *ctx, bc_slist_t *changed);
 bool bm_rule_need_rebuild(bc_slist_t *sources, bm_filectx_t *settings,
     bm_filectx_t *template, bm_filectx_t *output, bool only_first_source);
 bc_slist_t* bm_rule_list_built_files(bm_ctx_t *ctx);
@@ -38,12 +38,21 @@ static const struct default_settings_map {
     {"post_prefix", "post"},
     {"tag_prefix", "tag"},
     {"html_order", "DESC"},
+    {"html_minify", "false"},
 
     // atom
     {"atom_prefix", "atom"},
     {"atom_ext", ".xml"},
     {"atom_order", "DESC"},
 
+    // copy
+    {"copy_fingerprint", NULL},
+    {"copy_mode", "copy"},
+
+    // compression
+    {"gzip_level", "0"},
+    {"gzip_min_size", "256"},
+
     // generic
     {"date_format", "%b %d, %Y, %I:%M %p GMT"},
     {"locale", NULL},
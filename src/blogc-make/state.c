@@ -0,0 +1,728 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../common/error.h"
+#include "../common/file.h"
+#include "../common/utils.h"
+#include "ctx.h"
+#include "state.h"
+
+// the build state file records the content hash of every input file and,
+// for every output, a key built from the paths and content hashes of its
+// inputs and from the blogc arguments used to build it. an output is
+// rebuilt only if its key changed, or if the output itself was changed by
+// someone else. mtimes are only used to avoid hashing unchanged files
+// again.
+//
+// the file is line based, with tab-separated fields:
+//
+//   blogc-make-state    VERSION    PACKAGE_VERSION
+//   F    HASH    SIZE    MTIME_SEC    MTIME_NSEC    INPUT
+//   T    TAGS    (TAGS from the header of the previous input, if a source)
+//   O    KEY     SIZE    MTIME_SEC    MTIME_NSEC    OUTPUT
+//   I    INPUT   (one line for each input of the previous output)
+//
+// inputs are relative to the root directory and outputs are relative to the
+// output directory, whenever possible. the state is discarded if the file
+// was written by another version of blogc-make.
+
+#define BM_STATE_VERSION "2"
+
+
+static void
+free_file(bm_state_file_t *f)
+{
+    if (f == NULL)
+        return;
+    free(f->tags);
+    free(f);
+}
+
+
+static void
+free_output(bm_state_output_t *o)
+{
+    if (o == NULL)
+        return;
+    bc_slist_free_full(o->inputs, free);
+    free(o);
+}
+
+
+static const char*
+relative_path(const char *dir, const char *path)
+{
+    if (dir == NULL || path == NULL)
+        return path;
+    size_t len = strlen(dir);
+    if (0 == strncmp(path, dir, len) && path[len] == '/')
+        return path + len + 1;
+    return path;
+}
+
+
+static void
+reset(bm_state_t *state)
+{
+    bc_trie_free(state->files);
+    state->files = bc_trie_new((bc_free_func_t) free_file);
+    bc_trie_free(state->outputs);
+    state->outputs = bc_trie_new((bc_free_func_t) free_output);
+    bc_trie_free(state->pending);
+    state->pending = bc_trie_new((bc_free_func_t) free_output);
+}
+
+
+bm_state_t*
+bm_state_new(const char *root_dir, const char *output_dir)
+{
+    if (root_dir == NULL || output_dir == NULL)
+        return NULL;
+
+    bm_state_t *rv = bc_malloc(sizeof(bm_state_t));
+    rv->root_dir = bc_strdup(root_dir);
+    rv->output_dir = bc_strdup(output_dir);
+    rv->filename = bc_strdup_printf("%s/%s", output_dir, BM_STATE_FILENAME);
+    rv->generation = 1;
+    rv->changed = false;
+    rv->files = NULL;
+    rv->outputs = NULL;
+    rv->pending = NULL;
+    reset(rv);
+    return rv;
+}
+
+
+static bool
+parse_record(char **pieces, uint64_t *hash, uint64_t *size, time_t *tv_sec,
+    long *tv_nsec)
+{
+    char *endptr;
+    errno = 0;
+    *hash = strtoull(pieces[1], &endptr, 16);
+    if (errno != 0 || *endptr != '\0')
+        return false;
+    *size = strtoull(pieces[2], &endptr, 10);
+    if (errno != 0 || *endptr != '\0')
+        return false;
+    *tv_sec = strtoll(pieces[3], &endptr, 10);
+    if (errno != 0 || *endptr != '\0')
+        return false;
+    *tv_nsec = strtol(pieces[4], &endptr, 10);
+    if (errno != 0 || *endptr != '\0')
+        return false;
+    return pieces[5][0] != '\0';
+}
+
+
+bool
+bm_state_parse(bm_state_t *state, const char *src, size_t src_len)
+{
+    if (state == NULL || src == NULL)
+        return false;
+
+    bool rv = true;
+    bool header = false;
+    bm_state_file_t *last_file = NULL;
+    bm_state_output_t *last = NULL;
+
+    const char *end = src + src_len;
+    for (const char *line = src; rv && line < end;) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (eol == NULL)
+            eol = end;
+
+        char *tmp = bc_strndup(line, eol - line);
+        line = eol + 1;
+
+        if (!header) {
+            rv = 0 == strcmp(tmp, "blogc-make-state\t" BM_STATE_VERSION "\t"
+                PACKAGE_VERSION);
+            header = true;
+            free(tmp);
+            continue;
+        }
+
+        if (tmp[0] == '\0') {
+            free(tmp);
+            continue;
+        }
+
+        char **pieces = bc_str_split(tmp, '\t', 6);
+        free(tmp);
+
+        size_t len = bc_strv_length(pieces);
+        uint64_t hash, size;
+        time_t tv_sec;
+        long tv_nsec;
+
+        if (len == 6 && 0 == strcmp(pieces[0], "F") &&
+            parse_record(pieces, &hash, &size, &tv_sec, &tv_nsec))
+        {
+            bm_state_file_t *f = bc_malloc(sizeof(bm_state_file_t));
+            f->hash = hash;
+            f->size = size;
+            f->tv_sec = tv_sec;
+            f->tv_nsec = tv_nsec;
+            f->generation = 0;
+            f->tags = NULL;
+            bc_trie_insert(state->files, pieces[5], f);
+            last_file = f;
+            last = NULL;
+        }
+        else if (len == 2 && 0 == strcmp(pieces[0], "T") && last_file != NULL &&
+            last_file->tags == NULL)
+        {
+            last_file->tags = bc_strdup(pieces[1]);
+        }
+        else if (len == 6 && 0 == strcmp(pieces[0], "O") &&
+            parse_record(pieces, &hash, &size, &tv_sec, &tv_nsec))
+        {
+            last = bc_malloc(sizeof(bm_state_output_t));
+            last->key = hash;
+            last->size = size;
+            last->tv_sec = tv_sec;
+            last->tv_nsec = tv_nsec;
+            last->inputs = NULL;
+            bc_trie_insert(state->outputs, pieces[5], last);
+            last_file = NULL;
+        }
+        else if (len == 2 && 0 == strcmp(pieces[0], "I") && last != NULL &&
+            pieces[1][0] != '\0')
+        {
+            last->inputs = bc_slist_append(last->inputs, bc_strdup(pieces[1]));
+        }
+        else {
+            rv = false;
+        }
+
+        bc_strv_free(pieces);
+    }
+
+    if (!rv || !header)
+        reset(state);
+
+    return rv && header;
+}
+
+
+bm_state_t*
+bm_state_load(const char *root_dir, const char *output_dir)
+{
+    bm_state_t *rv = bm_state_new(root_dir, output_dir);
+    if (rv == NULL)
+        return NULL;
+
+    if (0 != access(rv->filename, F_OK))
+        return rv;
+
+    // a broken state file just means that everything will be rebuilt.
+    bc_error_t *err = NULL;
+    size_t content_len;
+    char *content = bc_file_get_contents(rv->filename, false, &content_len,
+        &err);
+    if (err != NULL) {
+        bc_error_free(err);
+        return rv;
+    }
+    bm_state_parse(rv, content, content_len);
+    free(content);
+
+    return rv;
+}
+
+
+static bool
+valid_path(const char *path)
+{
+    return path[0] != '\0' && NULL == strpbrk(path, "\t\n");
+}
+
+
+static void
+dump_file(const char *key, void *data, void *user_data)
+{
+    bm_state_file_t *f = data;
+    if (f->generation == 0 || !valid_path(key))
+        return;  // not used by this build, or not representable
+    bc_string_append_printf(user_data, "F\t%016llx\t%llu\t%lld\t%ld\t%s\n",
+        (unsigned long long) f->hash, (unsigned long long) f->size,
+        (long long) f->tv_sec, f->tv_nsec, key);
+    if (f->tags != NULL && NULL == strpbrk(f->tags, "\t\n"))
+        bc_string_append_printf(user_data, "T\t%s\n", f->tags);
+}
+
+
+static void
+dump_output(const char *key, void *data, void *user_data)
+{
+    bm_state_output_t *o = data;
+    if (!valid_path(key))
+        return;
+    bc_string_append_printf(user_data, "O\t%016llx\t%llu\t%lld\t%ld\t%s\n",
+        (unsigned long long) o->key, (unsigned long long) o->size,
+        (long long) o->tv_sec, o->tv_nsec, key);
+    for (bc_slist_t *l = o->inputs; l != NULL; l = l->next) {
+        if (valid_path(l->data))
+            bc_string_append_printf(user_data, "I\t%s\n", (char*) l->data);
+    }
+}
+
+
+char*
+bm_state_dump(bm_state_t *state)
+{
+    if (state == NULL)
+        return NULL;
+
+    bc_string_t *rv = bc_string_new();
+    bc_string_append(rv, "blogc-make-state\t" BM_STATE_VERSION "\t"
+        PACKAGE_VERSION "\n");
+    bc_trie_foreach(state->files, dump_file, rv);
+    bc_trie_foreach(state->outputs, dump_output, rv);
+    return bc_string_free(rv, false);
+}
+
+
+bool
+bm_state_save(bm_state_t *state, bc_error_t **err)
+{
+    if (state == NULL || err == NULL || *err != NULL)
+        return false;
+
+    if (!state->changed)
+        return true;
+
+    // nothing was built yet
+    struct stat buf;
+    if (0 != stat(state->output_dir, &buf))
+        return true;
+
+    char *content = bm_state_dump(state);
+    char *tmp = bc_strdup_printf("%s.tmp", state->filename);
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        *err = bc_error_new_printf(BLOGC_MAKE_ERROR_STATE,
+            "Failed to open build state file (%s): %s", tmp, strerror(errno));
+        free(content);
+        free(tmp);
+        return false;
+    }
+
+    fputs(content, fp);
+    free(content);
+
+    if (0 != fclose(fp) || 0 != rename(tmp, state->filename)) {
+        *err = bc_error_new_printf(BLOGC_MAKE_ERROR_STATE,
+            "Failed to write build state file (%s): %s", state->filename,
+            strerror(errno));
+        unlink(tmp);
+        free(tmp);
+        return false;
+    }
+
+    free(tmp);
+    state->changed = false;
+    return true;
+}
+
+
+void
+bm_state_invalidate(bm_state_t *state)
+{
+    if (state == NULL)
+        return;
+
+    // files will be stat'ed again when used, but only hashed again if their
+    // size or mtime changed.
+    state->generation++;
+}
+
+
+void
+bm_state_invalidate_file(bm_state_t *state, const char *path)
+{
+    if (state == NULL || path == NULL)
+        return;
+
+    // only this file is stat'ed again, and hashed again if it changed. the
+    // other files are trusted to be up to date.
+    bm_state_file_t *f = bc_trie_lookup(state->files,
+        relative_path(state->root_dir, path));
+    if (f == NULL)
+        return;
+    f->generation = 0;
+    uint64_t hash;
+    bm_state_get_file_hash(state, path, &hash);
+}
+
+
+bool
+bm_state_get_file_hash(bm_state_t *state, const char *path, uint64_t *hash)
+{
+    if (state == NULL || path == NULL || hash == NULL)
+        return false;
+
+    const char *rel = relative_path(state->root_dir, path);
+
+    bm_state_file_t *f = bc_trie_lookup(state->files, rel);
+    if (f != NULL && f->generation == state->generation) {
+        *hash = f->hash;
+        return true;
+    }
+
+    char *abs = path[0] == '/' ? bc_strdup(path) :
+        bc_strdup_printf("%s/%s", state->root_dir, path);
+
+    struct stat buf;
+    if (0 != stat(abs, &buf)) {
+        free(abs);
+        return false;
+    }
+
+    if (f == NULL || f->size != (uint64_t) buf.st_size ||
+        f->tv_sec != buf.st_mtim_tv_sec || f->tv_nsec != buf.st_mtim_tv_nsec)
+    {
+        bc_error_t *err = NULL;
+        uint64_t h = bc_file_get_hash(abs, &err);
+        if (err != NULL) {
+            bc_error_free(err);
+            free(abs);
+            return false;
+        }
+        if (f == NULL) {
+            f = bc_malloc(sizeof(bm_state_file_t));
+            f->tags = NULL;
+            bc_trie_insert(state->files, rel, f);
+        }
+        free(f->tags);
+        f->tags = NULL;
+        f->hash = h;
+        f->size = buf.st_size;
+        f->tv_sec = buf.st_mtim_tv_sec;
+        f->tv_nsec = buf.st_mtim_tv_nsec;
+        state->changed = true;
+    }
+
+    free(abs);
+
+    f->generation = state->generation;
+    *hash = f->hash;
+    return true;
+}
+
+
+char*
+bm_state_parse_tags(const char *src, size_t src_len)
+{
+    if (src == NULL)
+        return NULL;
+
+    // this is a very simplified version of blogc's source parser, that just
+    // looks for the TAGS variable in the header of the source file. the last
+    // TAGS definition wins, like in blogc.
+    char *rv = NULL;
+    const char *end = src + src_len;
+    if (src_len >= 3 && 0 == memcmp(src, "\xEF\xBB\xBF", 3))
+        src += 3;
+
+    for (const char *line = src; line < end;) {
+        const char *eol = line;
+        while (eol < end && *eol != '\n' && *eol != '\r')
+            eol++;
+        while (line < eol && (*line == ' ' || *line == '\t'))
+            line++;
+        if (line < eol && *line == '-')
+            break;
+        if (eol - line >= 5 && 0 == strncmp(line, "TAGS:", 5)) {
+            char *tmp = bc_strndup(line + 5, eol - line - 5);
+            free(rv);
+            rv = bc_strdup(bc_str_strip(tmp));
+            free(tmp);
+        }
+        line = eol + 1;
+    }
+
+    return rv != NULL ? rv : bc_strdup("");
+}
+
+
+const char*
+bm_state_get_file_tags(bm_state_t *state, const char *path)
+{
+    uint64_t hash;
+    if (!bm_state_get_file_hash(state, path, &hash))
+        return NULL;
+
+    bm_state_file_t *f = bc_trie_lookup(state->files,
+        relative_path(state->root_dir, path));
+    if (f == NULL)
+        return NULL;
+
+    if (f->tags == NULL) {
+        char *abs = path[0] == '/' ? bc_strdup(path) :
+            bc_strdup_printf("%s/%s", state->root_dir, path);
+        bc_error_t *err = NULL;
+        size_t content_len;
+        char *content = bc_file_get_contents(abs, false, &content_len, &err);
+        free(abs);
+        if (err != NULL) {
+            bc_error_free(err);
+            return NULL;
+        }
+        f->tags = bm_state_parse_tags(content, content_len);
+        free(content);
+        state->changed = true;
+    }
+
+    return f->tags;
+}
+
+
+const char*
+bm_state_get_cached_file_tags(bm_state_t *state, const char *path)
+{
+    // tags recorded by the last build, without checking if the file changed.
+    if (state == NULL || path == NULL)
+        return NULL;
+    bm_state_file_t *f = bc_trie_lookup(state->files,
+        relative_path(state->root_dir, path));
+    return f != NULL ? f->tags : NULL;
+}
+
+
+bool
+bm_state_need_rebuild(bm_state_t *state, const char *output,
+    bc_slist_t *inputs, const char *extra)
+{
+    if (state == NULL || output == NULL)
+        return true;
+
+    uint64_t key = BC_HASH_INIT;
+    if (extra != NULL)
+        key = bc_hash(key, extra, strlen(extra) + 1);
+
+    bc_slist_t *rel_inputs = NULL;
+    for (bc_slist_t *l = inputs; l != NULL; l = l->next) {
+        uint64_t hash;
+        if (!bm_state_get_file_hash(state, l->data, &hash)) {
+            // this is unlikely to happen, but lets just say that we need
+            // a rebuild and let blogc bail out.
+            bc_slist_free_full(rel_inputs, free);
+            return true;
+        }
+        const char *rel = relative_path(state->root_dir, l->data);
+        key = bc_hash(key, rel, strlen(rel) + 1);
+        key = bc_hash(key, &hash, sizeof(uint64_t));
+        rel_inputs = bc_slist_append(rel_inputs, bc_strdup(rel));
+    }
+
+    const char *rel_output = relative_path(state->output_dir, output);
+
+    bm_state_output_t *o = bc_trie_lookup(state->outputs, rel_output);
+    if (o != NULL && o->key == key) {
+        struct stat buf;
+        if (0 == stat(output, &buf) && o->size == (uint64_t) buf.st_size &&
+            o->tv_sec == buf.st_mtim_tv_sec && o->tv_nsec == buf.st_mtim_tv_nsec)
+        {
+            bc_slist_free_full(rel_inputs, free);
+            return false;
+        }
+    }
+
+    // saved until the output is built successfully
+    bm_state_output_t *p = bc_malloc(sizeof(bm_state_output_t));
+    p->key = key;
+    p->size = 0;
+    p->tv_sec = 0;
+    p->tv_nsec = 0;
+    p->inputs = rel_inputs;
+    bc_trie_insert(state->pending, rel_output, p);
+
+    return true;
+}
+
+
+bool
+bm_state_has_output(bm_state_t *state, const char *output)
+{
+    if (state == NULL || output == NULL)
+        return false;
+    return NULL != bc_trie_lookup(state->outputs,
+        relative_path(state->output_dir, output));
+}
+
+
+void
+bm_state_set_built(bm_state_t *state, const char *output)
+{
+    if (state == NULL || output == NULL)
+        return;
+
+    const char *rel_output = relative_path(state->output_dir, output);
+
+    bm_state_output_t *p = bc_trie_lookup(state->pending, rel_output);
+    if (p == NULL)
+        return;
+
+    struct stat buf;
+    if (0 != stat(output, &buf))
+        return;
+
+    bm_state_output_t *o = bc_malloc(sizeof(bm_state_output_t));
+    o->key = p->key;
+    o->size = buf.st_size;
+    o->tv_sec = buf.st_mtim_tv_sec;
+    o->tv_nsec = buf.st_mtim_tv_nsec;
+    o->inputs = p->inputs;
+    p->inputs = NULL;
+    bc_trie_insert(state->outputs, rel_output, o);
+
+    state->changed = true;
+}
+
+
+typedef struct {
+    const char *output_dir;
+    bc_trie_t *inputs;
+    bc_trie_t *outputs;
+} get_outputs_ctx_t;
+
+
+static void
+get_output(const char *key, void *data, void *user_data)
+{
+    get_outputs_ctx_t *ctx = user_data;
+    bm_state_output_t *o = data;
+    for (bc_slist_t *l = o->inputs; l != NULL; l = l->next) {
+        if (NULL == bc_trie_lookup(ctx->inputs, l->data))
+            continue;
+        char *path = key[0] == '/' ? bc_strdup(key) :
+            bc_strdup_printf("%s/%s", ctx->output_dir, key);
+        bc_trie_insert(ctx->outputs, path, (void*) 1);
+        free(path);
+        return;
+    }
+}
+
+
+bc_trie_t*
+bm_state_get_outputs(bm_state_t *state, bc_slist_t *inputs)
+{
+    // returns the paths of the outputs built from any of the inputs, as the
+    // keys of a trie, without touching the filesystem.
+    if (state == NULL)
+        return NULL;
+
+    get_outputs_ctx_t ctx = {
+        .output_dir = state->output_dir,
+        .inputs = bc_trie_new(NULL),
+        .outputs = bc_trie_new(NULL),
+    };
+
+    for (bc_slist_t *l = inputs; l != NULL; l = l->next)
+        bc_trie_insert(ctx.inputs, relative_path(state->root_dir, l->data),
+            (void*) 1);
+
+    bc_trie_foreach(state->outputs, get_output, &ctx);
+
+    bc_trie_free(ctx.inputs);
+    return ctx.outputs;
+}
+
+
+typedef struct {
+    bc_trie_t *current;
+    bc_trie_t *kept;
+    bc_slist_t *removed;
+} prune_ctx_t;
+
+
+static void
+prune_output(const char *key, void *data, void *user_data)
+{
+    prune_ctx_t *ctx = user_data;
+    if (NULL != bc_trie_lookup(ctx->current, key)) {
+        bc_trie_insert(ctx->kept, key, data);
+        return;
+    }
+    ctx->removed = bc_slist_append(ctx->removed, bc_strdup(key));
+    free_output(data);
+}
+
+
+bc_slist_t*
+bm_state_prune(bm_state_t *state, bc_slist_t *outputs)
+{
+    if (state == NULL)
+        return NULL;
+
+    prune_ctx_t ctx = {
+        .current = bc_trie_new(NULL),
+        .kept = bc_trie_new((bc_free_func_t) free_output),
+        .removed = NULL,
+    };
+
+    for (bc_slist_t *l = outputs; l != NULL; l = l->next)
+        bc_trie_insert(ctx.current, relative_path(state->output_dir, l->data),
+            (void*) 1);
+
+    bc_trie_foreach(state->outputs, prune_output, &ctx);
+
+    // records were moved to the new trie or freed already
+    state->outputs->free_func = NULL;
+    bc_trie_free(state->outputs);
+    state->outputs = ctx.kept;
+
+    bc_trie_free(ctx.current);
+
+    if (ctx.removed != NULL)
+        state->changed = true;
+
+    return ctx.removed;
+}
+
+
+void
+bm_state_clear(bm_state_t *state)
+{
+    if (state == NULL)
+        return;
+
+    reset(state);
+    unlink(state->filename);
+    state->changed = false;
+}
+
+
+void
+bm_state_free(bm_state_t *state)
+{
+    if (state == NULL)
+        return;
+    free(state->root_dir);
+    free(state->output_dir);
+    free(state->filename);
+    bc_trie_free(state->files);
+    bc_trie_free(state->outputs);
+    bc_trie_free(state->pending);
+    free(state);
+}
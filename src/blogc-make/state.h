@@ -0,0 +1,77 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifndef _MAKE_STATE_H
+#define _MAKE_STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "../common/error.h"
+#include "../common/utils.h"
+
+#define BM_STATE_FILENAME ".blogc-make.state"
+
+typedef struct {
+    uint64_t hash;
+    uint64_t size;
+    time_t tv_sec;
+    long tv_nsec;
+    unsigned int generation;
+
+    // TAGS from the source file header, if parsed already. empty string if
+    // the source file has no tags.
+    char *tags;
+} bm_state_file_t;
+
+typedef struct {
+    uint64_t key;
+    uint64_t size;
+    time_t tv_sec;
+    long tv_nsec;
+    bc_slist_t *inputs;
+} bm_state_output_t;
+
+typedef struct {
+    char *root_dir;
+    char *output_dir;
+    char *filename;
+    unsigned int generation;
+    bool changed;
+
+    // input path (relative to root_dir) -> bm_state_file_t
+    bc_trie_t *files;
+
+    // output path (relative to output_dir) -> bm_state_output_t
+    bc_trie_t *outputs;
+    bc_trie_t *pending;
+} bm_state_t;
+
+bm_state_t* bm_state_new(const char *root_dir, const char *output_dir);
+bool bm_state_parse(bm_state_t *state, const char *src, size_t src_len);
+bm_state_t* bm_state_load(const char *root_dir, const char *output_dir);
+char* bm_state_dump(bm_state_t *state);
+bool bm_state_save(bm_state_t *state, bc_error_t **err);
+void bm_state_invalidate(bm_state_t *state);
+void bm_state_invalidate_file(bm_state_t *state, const char *path);
+bool bm_state_get_file_hash(bm_state_t *state, const char *path,
+    uint64_t *hash);
+char* bm_state_parse_tags(const char *src, size_t src_len);
+const char* bm_state_get_file_tags(bm_state_t *state, const char *path);
+const char* bm_state_get_cached_file_tags(bm_state_t *state,
+    const char *path);
+bool bm_state_need_rebuild(bm_state_t *state, const char *output,
+    bc_slist_t *inputs, const char *extra);
+bool bm_state_has_output(bm_state_t *state, const char *output);
+void bm_state_set_built(bm_state_t *state, const char *output);
+bc_trie_t* bm_state_get_outputs(bm_state_t *state, bc_slist_t *inputs);
+bc_slist_t* bm_state_prune(bm_state_t *state, bc_slist_t *outputs);
+void bm_state_clear(bm_state_t *state);
+void bm_state_free(bm_state_t *state);
+
+#endif /* _MAKE_STATE_H */
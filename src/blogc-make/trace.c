@@ -0,0 +1,227 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../common/error.h"
+#include "../common/utils.h"
+#include "trace.h"
+
+// the trace file uses the chrome trace-event format, that can be loaded by
+// about:tracing or perfetto. only complete events ("ph": "X") are emitted,
+// with timestamps and durations in microseconds since the trace started.
+
+
+bm_trace_t*
+bm_trace_new(const char *filename)
+{
+    if (filename == NULL)
+        return NULL;
+    bm_trace_t *rv = bc_malloc(sizeof(bm_trace_t));
+    rv->filename = bc_strdup(filename);
+    rv->start = bm_trace_now();
+    rv->events = NULL;
+    rv->thread = pthread_self();
+    pthread_mutex_init(&(rv->mutex), NULL);
+    return rv;
+}
+
+
+double
+bm_trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+void
+bm_trace_add(bm_trace_t *trace, const char *category, const char *name,
+    double start)
+{
+    if (trace == NULL || category == NULL || name == NULL)
+        return;
+
+    bm_trace_event_t *ev = bc_malloc(sizeof(bm_trace_event_t));
+    ev->name = bc_strdup(name);
+    ev->category = category;
+    ev->start = start - trace->start;
+    ev->duration = bm_trace_now() - start;
+
+    // the reloader runs rules from its own thread.
+    ev->tid = pthread_equal(pthread_self(), trace->thread) ? 1 : 2;
+
+    pthread_mutex_lock(&(trace->mutex));
+    trace->events = bc_slist_prepend(trace->events, ev);
+    pthread_mutex_unlock(&(trace->mutex));
+}
+
+
+static void
+append_json_string(bc_string_t *str, const char *s)
+{
+    bc_string_append_c(str, '"');
+    for (size_t i = 0; s[i] != '\0'; i++) {
+        switch (s[i]) {
+            case '"':
+                bc_string_append(str, "\\\"");
+                break;
+            case '\\':
+                bc_string_append(str, "\\\\");
+                break;
+            default:
+                if (((unsigned char) s[i]) < 0x20)
+                    bc_string_append_printf(str, "\\u%04x", (unsigned char) s[i]);
+                else
+                    bc_string_append_c(str, s[i]);
+        }
+    }
+    bc_string_append_c(str, '"');
+}
+
+
+char*
+bm_trace_to_json(bm_trace_t *trace)
+{
+    if (trace == NULL)
+        return NULL;
+
+    bc_string_t *rv = bc_string_new();
+    bc_string_append(rv, "{\"traceEvents\": [");
+
+    pthread_mutex_lock(&(trace->mutex));
+
+    // events are prepended, list them in chronological order.
+    bc_slist_t *events = NULL;
+    for (bc_slist_t *l = trace->events; l != NULL; l = l->next)
+        events = bc_slist_prepend(events, l->data);
+
+    for (bc_slist_t *l = events; l != NULL; l = l->next) {
+        bm_trace_event_t *ev = l->data;
+        bc_string_append(rv, l == events ? "\n  {\"name\": " : ",\n  {\"name\": ");
+        append_json_string(rv, ev->name);
+        bc_string_append(rv, ", \"cat\": ");
+        append_json_string(rv, ev->category);
+        bc_string_append_printf(rv, ", \"ph\": \"X\", \"ts\": %.3f, "
+            "\"dur\": %.3f, \"pid\": 1, \"tid\": %u}", ev->start, ev->duration,
+            ev->tid);
+    }
+
+    pthread_mutex_unlock(&(trace->mutex));
+
+    bc_slist_free(events);
+
+    bc_string_append(rv, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    return bc_string_free(rv, false);
+}
+
+
+void
+bm_trace_write(bm_trace_t *trace, bc_error_t **err)
+{
+    if (trace == NULL || err == NULL || *err != NULL)
+        return;
+
+    FILE *fp = fopen(trace->filename, "w");
+    if (fp == NULL) {
+        *err = bc_error_new_printf(BLOGC_MAKE_ERROR_TRACE,
+            "Failed to open trace file (%s): %s", trace->filename,
+            strerror(errno));
+        return;
+    }
+
+    char *json = bm_trace_to_json(trace);
+    fputs(json, fp);
+    free(json);
+
+    if (0 != fclose(fp)) {
+        *err = bc_error_new_printf(BLOGC_MAKE_ERROR_TRACE,
+            "Failed to write trace file (%s): %s", trace->filename,
+            strerror(errno));
+    }
+}
+
+
+static int
+compare_duration(const void *a, const void *b)
+{
+    const bm_trace_event_t *ea = *((const bm_trace_event_t**) a);
+    const bm_trace_event_t *eb = *((const bm_trace_event_t**) b);
+    if (ea->duration > eb->duration)
+        return -1;
+    if (ea->duration < eb->duration)
+        return 1;
+    return 0;
+}
+
+
+void
+bm_trace_print_summary(bm_trace_t *trace, size_t n)
+{
+    if (trace == NULL || n == 0)
+        return;
+
+    pthread_mutex_lock(&(trace->mutex));
+
+    size_t count = 0;
+    for (bc_slist_t *l = trace->events; l != NULL; l = l->next) {
+        if (0 == strcmp(((bm_trace_event_t*) l->data)->category, "output"))
+            count++;
+    }
+
+    if (count == 0) {
+        pthread_mutex_unlock(&(trace->mutex));
+        return;
+    }
+
+    bm_trace_event_t **outputs = bc_malloc(count * sizeof(bm_trace_event_t*));
+    size_t i = 0;
+    for (bc_slist_t *l = trace->events; l != NULL; l = l->next) {
+        if (0 == strcmp(((bm_trace_event_t*) l->data)->category, "output"))
+            outputs[i++] = l->data;
+    }
+
+    qsort(outputs, count, sizeof(bm_trace_event_t*), compare_duration);
+
+    printf("\nslowest outputs:\n");
+    for (i = 0; i < count && i < n; i++)
+        printf("  %10.3f ms  %s\n", outputs[i]->duration / 1000.0,
+            outputs[i]->name);
+    fflush(stdout);
+
+    free(outputs);
+
+    pthread_mutex_unlock(&(trace->mutex));
+}
+
+
+static void
+bm_trace_event_free(bm_trace_event_t *ev)
+{
+    if (ev == NULL)
+        return;
+    free(ev->name);
+    free(ev);
+}
+
+
+void
+bm_trace_free(bm_trace_t *trace)
+{
+    if (trace == NULL)
+        return;
+    bc_slist_free_full(trace->events, (bc_free_func_t) bm_trace_event_free);
+    pthread_mutex_destroy(&(trace->mutex));
+    free(trace->filename);
+    free(trace);
+}
@@ -0,0 +1,44 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifndef _MAKE_TRACE_H
+#define _MAKE_TRACE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include "../common/error.h"
+#include "../common/utils.h"
+
+#define BM_TRACE_SUMMARY_SIZE 10
+
+typedef struct {
+    char *name;
+    const char *category;
+    double start;
+    double duration;
+    unsigned int tid;
+} bm_trace_event_t;
+
+typedef struct {
+    char *filename;
+    double start;
+    bc_slist_t *events;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+} bm_trace_t;
+
+bm_trace_t* bm_trace_new(const char *filename);
+double bm_trace_now(void);
+void bm_trace_add(bm_trace_t *trace, const char *category, const char *name,
+    double start);
+char* bm_trace_to_json(bm_trace_t *trace);
+void bm_trace_write(bm_trace_t *trace, bc_error_t **err);
+void bm_trace_print_summary(bm_trace_t *trace, size_t n);
+void bm_trace_free(bm_trace_t *trace);
+
+#endif /* _MAKE_TRACE_H */
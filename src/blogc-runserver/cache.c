@@ -0,0 +1,558 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif /* HAVE_ZLIB */
+#include "../common/utils.h"
+#include "cache.h"
+#include "mime.h"
+
+#define CACHE_BUCKETS 1024
+#define CACHE_MAX_ENTRIES 512
+#define CACHE_GZIP_MIN_SIZE 256
+#define CACHE_GZIP_MAX_SIZE (1024 * 1024)
+#define CACHE_GZIP_MEMORY (16 * 1024 * 1024)
+
+struct br_cache {
+    char *docroot;
+    br_cache_entry_t *buckets[CACHE_BUCKETS];
+    size_t len;
+
+    // file descriptors kept open by cached entries, and how many of them
+    // are allowed.
+    size_t fds;
+    size_t max_fds;
+
+    // least recently used entries first, evicted when the cache is full.
+    br_cache_entry_t *lru_head;
+    br_cache_entry_t *lru_tail;
+
+    // memory used by files compressed on the fly.
+    size_t gzip_memory;
+
+    pthread_mutex_t mutex;
+};
+
+
+br_cache_t*
+br_cache_new(const char *docroot)
+{
+    br_cache_t *rv = bc_malloc(sizeof(br_cache_t));
+    rv->docroot = bc_strdup(docroot);
+    for (size_t i = 0; i < CACHE_BUCKETS; i++)
+        rv->buckets[i] = NULL;
+    rv->len = 0;
+
+    // each entry keeps up to 3 files open (the file and its compressed
+    // siblings). half of the descriptors allowed for the process are left
+    // for connections.
+    rv->fds = 0;
+    rv->max_fds = CACHE_MAX_ENTRIES * 3;
+    struct rlimit rl;
+    if (0 == getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur / 2 < rv->max_fds)
+        rv->max_fds = rl.rlim_cur / 2;
+
+    rv->lru_head = NULL;
+    rv->lru_tail = NULL;
+    rv->gzip_memory = 0;
+    pthread_mutex_init(&(rv->mutex), NULL);
+    return rv;
+}
+
+
+static void
+entry_free(br_cache_entry_t *entry)
+{
+    // must be called with the cache locked.
+    close(entry->file.fd);
+    if (entry->gzip.fd >= 0)
+        close(entry->gzip.fd);
+    if (entry->brotli.fd >= 0)
+        close(entry->brotli.fd);
+    entry->cache->gzip_memory -= entry->gzip_len;
+    free(entry->gzip_data);
+    free(entry->path);
+    free(entry->real_path);
+    free(entry->dir_path);
+    free(entry);
+}
+
+
+static size_t
+entry_fds(br_cache_entry_t *entry)
+{
+    return 1 + (entry->gzip.fd >= 0 ? 1 : 0) + (entry->brotli.fd >= 0 ? 1 : 0);
+}
+
+
+static void
+entry_unref(br_cache_entry_t *entry)
+{
+    // must be called with the cache locked.
+    if (--entry->refs == 0)
+        entry_free(entry);
+}
+
+
+static void
+lru_remove(br_cache_t *cache, br_cache_entry_t *entry)
+{
+    if (entry->lru_prev == NULL)
+        cache->lru_head = entry->lru_next;
+    else
+        entry->lru_prev->lru_next = entry->lru_next;
+    if (entry->lru_next == NULL)
+        cache->lru_tail = entry->lru_prev;
+    else
+        entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+
+static void
+lru_append(br_cache_t *cache, br_cache_entry_t *entry)
+{
+    entry->lru_next = NULL;
+    entry->lru_prev = cache->lru_tail;
+    if (cache->lru_tail == NULL)
+        cache->lru_head = entry;
+    else
+        cache->lru_tail->lru_next = entry;
+    cache->lru_tail = entry;
+}
+
+
+static void
+cache_remove(br_cache_t *cache, br_cache_entry_t *entry)
+{
+    // must be called with the cache locked. connections still sending the
+    // file keep the entry alive until they release it.
+    if (!entry->cached)
+        return;
+    br_cache_entry_t **e = &(cache->buckets[entry->hash % CACHE_BUCKETS]);
+    while (*e != entry)
+        e = &((*e)->next);
+    *e = entry->next;
+    lru_remove(cache, entry);
+    entry->cached = false;
+    cache->len--;
+    cache->fds -= entry_fds(entry);
+    entry_unref(entry);
+}
+
+
+static br_cache_entry_t*
+cache_lookup(br_cache_t *cache, const char *path, uint64_t hash)
+{
+    for (br_cache_entry_t *e = cache->buckets[hash % CACHE_BUCKETS];
+        e != NULL; e = e->next)
+    {
+        if (e->hash == hash && 0 == strcmp(e->path, path))
+            return e;
+    }
+    return NULL;
+}
+
+
+void
+br_cache_free(br_cache_t *cache)
+{
+    if (cache == NULL)
+        return;
+    pthread_mutex_lock(&(cache->mutex));
+    while (cache->lru_head != NULL)
+        cache_remove(cache, cache->lru_head);
+    pthread_mutex_unlock(&(cache->mutex));
+    pthread_mutex_destroy(&(cache->mutex));
+    free(cache->docroot);
+    free(cache);
+}
+
+
+static int
+cache_open(br_cache_t *cache, const char *path)
+{
+    // when the process runs out of file descriptors, the least recently used
+    // entries are evicted to make room, instead of failing the request.
+    // entries still referenced by connections only close their files once
+    // released, so several entries may be evicted.
+    int fd;
+    while (0 > (fd = open(path, O_RDONLY | O_CLOEXEC)) &&
+        (errno == EMFILE || errno == ENFILE))
+    {
+        pthread_mutex_lock(&(cache->mutex));
+        br_cache_entry_t *entry = cache->lru_head;
+        if (entry != NULL)
+            cache_remove(cache, entry);
+        pthread_mutex_unlock(&(cache->mutex));
+        if (entry == NULL)
+            break;
+    }
+    return fd;
+}
+
+
+static bool
+timespec_equal(struct timespec a, struct timespec b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+
+static bool
+entry_valid(br_cache_entry_t *entry)
+{
+    // rebuilt files are either rewritten in place or replaced by a rename,
+    // both change the inode, size or mtime.
+    struct stat st;
+    if (0 > stat(entry->real_path, &st) ||
+        st.st_dev != entry->file.st.st_dev ||
+        st.st_ino != entry->file.st.st_ino ||
+        st.st_size != entry->file.st.st_size ||
+        !timespec_equal(st.st_mtim, entry->file.st.st_mtim))
+        return false;
+
+    // creating or removing files in the directory changes its mtime. this
+    // catches new index files with higher priority and new or removed
+    // compressed siblings.
+    if (0 > stat(entry->dir_path, &st) ||
+        !timespec_equal(st.st_mtim, entry->dir_mtime))
+        return false;
+
+    return true;
+}
+
+
+static void
+file_init(br_cache_file_t *file, int fd, const struct stat *st)
+{
+    // the etag changes whenever entry_valid() would fail.
+    file->fd = fd;
+    file->st = *st;
+    snprintf(file->etag, sizeof(file->etag), "\"%llx-%llx-%llx.%lx\"",
+        (unsigned long long) st->st_ino, (unsigned long long) st->st_size,
+        (unsigned long long) st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+}
+
+
+static void
+sibling_init(br_cache_t *cache, br_cache_file_t *file, const char *real_path,
+    const char *ext, const struct stat *orig)
+{
+    // a sibling older than the file is left over from a previous build.
+    char *path = bc_strdup_printf("%s%s", real_path, ext);
+    int fd = cache_open(cache, path);
+    free(path);
+    struct stat st;
+    if (fd >= 0 && 0 == fstat(fd, &st) && S_ISREG(st.st_mode) &&
+        (st.st_mtim.tv_sec > orig->st_mtim.tv_sec ||
+            (st.st_mtim.tv_sec == orig->st_mtim.tv_sec &&
+                st.st_mtim.tv_nsec >= orig->st_mtim.tv_nsec)))
+    {
+        file_init(file, fd, &st);
+        return;
+    }
+    if (fd >= 0)
+        close(fd);
+    file->fd = -1;
+    file->etag[0] = '\0';
+}
+
+
+static bool
+compressible(const char *content_type, off_t size)
+{
+#ifdef HAVE_ZLIB
+    return size >= CACHE_GZIP_MIN_SIZE && size <= CACHE_GZIP_MAX_SIZE &&
+        (bc_str_starts_with(content_type, "text/") ||
+         bc_str_ends_with(content_type, "+xml") ||
+         0 == strcmp(content_type, "application/javascript") ||
+         0 == strcmp(content_type, "application/json") ||
+         0 == strcmp(content_type, "application/xml"));
+#else
+    return false;
+#endif /* HAVE_ZLIB */
+}
+
+
+static br_cache_entry_t*
+entry_new(br_cache_t *cache, const char *path, uint64_t hash,
+    unsigned short *status)
+{
+    br_cache_entry_t *rv = NULL;
+
+    char *abs_path = bc_strdup_printf("%s/%s", cache->docroot, path);
+    char *real_path = realpath(abs_path, NULL);
+    free(abs_path);
+
+    if (real_path == NULL) {
+        *status = 404;
+        return NULL;
+    }
+
+    char *dir_path = NULL;
+    struct timespec dir_mtime = {0, 0};
+
+    char *real_root = realpath(cache->docroot, NULL);
+    if (real_root == NULL) {
+        *status = 500;
+        goto cleanup;
+    }
+
+    if (0 != strncmp(real_root, real_path, strlen(real_root))) {
+        *status = 404;
+        goto cleanup;
+    }
+
+    struct stat st;
+    if (0 > stat(real_path, &st)) {
+        *status = 404;
+        goto cleanup;
+    }
+
+    bool add_slash = false;
+
+    if (S_ISDIR(st.st_mode)) {
+        char *found = br_mime_guess_index(real_path);
+
+        if (found == NULL) {
+            *status = 403;
+            goto cleanup;
+        }
+
+        size_t path_len = strlen(path);
+        if (path_len > 0 && path[path_len - 1] != '/')
+            add_slash = true;
+
+        dir_path = real_path;
+        dir_mtime = st.st_mtim;
+        real_path = found;
+    }
+    else {
+        char *slash = strrchr(real_path, '/');
+        dir_path = slash == real_path ? bc_strdup("/") :
+            bc_strndup(real_path, slash - real_path);
+        struct stat dir_st;
+        if (0 > stat(dir_path, &dir_st)) {
+            *status = 500;
+            goto cleanup;
+        }
+        dir_mtime = dir_st.st_mtim;
+    }
+
+    int fd = cache_open(cache, real_path);
+    if (fd < 0) {
+        // nothing left to evict, the request may succeed later.
+        *status = (errno == EMFILE || errno == ENFILE) ? 503 : 500;
+        goto cleanup;
+    }
+    if (0 > fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        *status = 500;
+        goto cleanup;
+    }
+
+    rv = bc_malloc(sizeof(br_cache_entry_t));
+    rv->path = bc_strdup(path);
+    rv->hash = hash;
+    rv->real_path = real_path;
+    rv->dir_path = dir_path;
+    rv->dir_mtime = dir_mtime;
+    rv->add_slash = add_slash;
+    rv->content_type = br_mime_guess_content_type(real_path);
+    struct tm tm;
+    strftime(rv->last_modified, sizeof(rv->last_modified),
+        "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&(st.st_mtime), &tm));
+    file_init(&(rv->file), fd, &st);
+    sibling_init(cache, &(rv->gzip), real_path, ".gz", &st);
+    sibling_init(cache, &(rv->brotli), real_path, ".br", &st);
+    rv->compressible = rv->gzip.fd < 0 &&
+        compressible(rv->content_type, st.st_size);
+    rv->gzip_data = NULL;
+    rv->gzip_len = 0;
+    rv->cache = cache;
+    rv->refs = 1;
+    rv->cached = false;
+    rv->next = NULL;
+    rv->lru_prev = NULL;
+    rv->lru_next = NULL;
+    real_path = NULL;
+    dir_path = NULL;
+
+cleanup:
+    free(real_root);
+    free(dir_path);
+    free(real_path);
+    return rv;
+}
+
+
+br_cache_entry_t*
+br_cache_get(br_cache_t *cache, const char *path, unsigned short *status)
+{
+    // returns an entry referenced by the caller, that must be released with
+    // br_cache_release(), or NULL with the http status code set.
+    uint64_t hash = bc_hash(BC_HASH_INIT, path, strlen(path));
+
+    pthread_mutex_lock(&(cache->mutex));
+    br_cache_entry_t *entry = cache_lookup(cache, path, hash);
+    if (entry != NULL) {
+        entry->refs++;
+        lru_remove(cache, entry);
+        lru_append(cache, entry);
+    }
+    pthread_mutex_unlock(&(cache->mutex));
+
+    // validation happens without the lock, other threads can keep serving
+    // cached files meanwhile.
+    if (entry != NULL) {
+        if (entry_valid(entry))
+            return entry;
+        pthread_mutex_lock(&(cache->mutex));
+        cache_remove(cache, entry);
+        entry_unref(entry);
+        pthread_mutex_unlock(&(cache->mutex));
+    }
+
+    entry = entry_new(cache, path, hash, status);
+    if (entry == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&(cache->mutex));
+    br_cache_entry_t *old = cache_lookup(cache, path, hash);
+    if (old != NULL)
+        cache_remove(cache, old);
+    size_t bucket = hash % CACHE_BUCKETS;
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_append(cache, entry);
+    entry->cached = true;
+    entry->refs++;
+    cache->len++;
+    cache->fds += entry_fds(entry);
+    while (cache->len > CACHE_MAX_ENTRIES || cache->fds > cache->max_fds)
+        cache_remove(cache, cache->lru_head);
+    pthread_mutex_unlock(&(cache->mutex));
+
+    return entry;
+}
+
+
+void
+br_cache_release(br_cache_entry_t *entry)
+{
+    if (entry == NULL)
+        return;
+    br_cache_t *cache = entry->cache;
+    pthread_mutex_lock(&(cache->mutex));
+    entry_unref(entry);
+    pthread_mutex_unlock(&(cache->mutex));
+}
+
+
+#ifdef HAVE_ZLIB
+
+static char*
+gzip_compress(int fd, off_t size, size_t *len)
+{
+    char *in = bc_malloc(size);
+    char *rv = NULL;
+    if (size != pread(fd, in, size, 0))
+        goto cleanup;
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(z_stream));
+
+    // 15 + 16 bits of window for a gzip header instead of a zlib one.
+    if (Z_OK != deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+            8, Z_DEFAULT_STRATEGY))
+        goto cleanup;
+
+    size_t bound = deflateBound(&strm, size);
+    rv = bc_malloc(bound);
+    strm.next_in = (Bytef*) in;
+    strm.avail_in = size;
+    strm.next_out = (Bytef*) rv;
+    strm.avail_out = bound;
+    if (Z_STREAM_END != deflate(&strm, Z_FINISH)) {
+        free(rv);
+        rv = NULL;
+    }
+    else {
+        *len = strm.total_out;
+    }
+    deflateEnd(&strm);
+
+cleanup:
+    free(in);
+    return rv;
+}
+
+#endif /* HAVE_ZLIB */
+
+
+bc_string_t*
+br_cache_get_gzip(br_cache_entry_t *entry)
+{
+    // returns the file compressed with gzip, or NULL if it isn't
+    // compressible. the data is kept in the entry while there is room for
+    // it, so hot text files are compressed only once.
+#ifdef HAVE_ZLIB
+    if (!entry->compressible)
+        return NULL;
+
+    br_cache_t *cache = entry->cache;
+    bc_string_t *rv = NULL;
+
+    pthread_mutex_lock(&(cache->mutex));
+    if (entry->gzip_data != NULL)
+        rv = bc_string_append_len(bc_string_new(), entry->gzip_data,
+            entry->gzip_len);
+    pthread_mutex_unlock(&(cache->mutex));
+    if (rv != NULL)
+        return rv;
+
+    size_t len;
+    char *data = gzip_compress(entry->file.fd, entry->file.st.st_size, &len);
+    if (data == NULL)
+        return NULL;
+    rv = bc_string_append_len(bc_string_new(), data, len);
+
+    pthread_mutex_lock(&(cache->mutex));
+    if (entry->gzip_data == NULL &&
+        cache->gzip_memory + len <= CACHE_GZIP_MEMORY)
+    {
+        entry->gzip_data = data;
+        entry->gzip_len = len;
+        cache->gzip_memory += len;
+        data = NULL;
+    }
+    pthread_mutex_unlock(&(cache->mutex));
+
+    free(data);
+    return rv;
+#else
+    return NULL;
+#endif /* HAVE_ZLIB */
+}
@@ -0,0 +1,64 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "../common/utils.h"
+
+typedef struct br_cache br_cache_t;
+
+typedef struct {
+    int fd;
+    struct stat st;
+    char etag[64];
+} br_cache_file_t;
+
+typedef struct br_cache_entry {
+    char *path;
+    uint64_t hash;
+    char *real_path;
+    char *dir_path;
+    struct timespec dir_mtime;
+    bool add_slash;
+    const char *content_type;
+    char last_modified[32];
+    br_cache_file_t file;
+
+    // precompressed siblings (".gz" and ".br"), fd is -1 if missing or
+    // older than the file.
+    br_cache_file_t gzip;
+    br_cache_file_t brotli;
+
+    // whether the file can be compressed on the fly, and the compressed
+    // data once it was requested.
+    bool compressible;
+    char *gzip_data;
+    size_t gzip_len;
+
+    // private fields, owned by the cache.
+    br_cache_t *cache;
+    size_t refs;
+    bool cached;
+    struct br_cache_entry *next;
+    struct br_cache_entry *lru_prev;
+    struct br_cache_entry *lru_next;
+} br_cache_entry_t;
+
+br_cache_t* br_cache_new(const char *docroot);
+void br_cache_free(br_cache_t *cache);
+br_cache_entry_t* br_cache_get(br_cache_t *cache, const char *path,
+    unsigned short *status);
+void br_cache_release(br_cache_entry_t *entry);
+bc_string_t* br_cache_get_gzip(br_cache_entry_t *entry);
+
+#endif /* _CACHE_H */
@@ -6,42 +6,14 @@
  * See the file LICENSE.
  */
 
+#include <limits.h>
 #include <stdbool.h>
 #include <string.h>
-#include <unistd.h>
+#include <strings.h>
 #include "../common/utils.h"
 #include "httpd-utils.h"
 
 
-char*
-br_readline(int socket)
-{
-    bc_string_t *rv = bc_string_new();
-    char buffer[READLINE_BUFFER_SIZE];
-    ssize_t len;
-    bool end = false;
-
-    while ((len = read(socket, buffer, READLINE_BUFFER_SIZE)) > 0) {
-        if (!end) {
-            for (ssize_t i = 0; i < len; i++) {
-                if (buffer[i] == '\r' || buffer[i] == '\n' || buffer[i] == '\0') {
-                    // we finished "recording", but still need to exhaust
-                    // request data.
-                    end = true;
-                    break;
-                }
-                bc_string_append_c(rv, buffer[i]);
-            }
-        }
-        if (len < READLINE_BUFFER_SIZE) {
-            break;
-        }
-    }
-
-    return bc_string_free(rv, false);
-}
-
-
 int
 br_hextoi(const char c)
 {
@@ -58,48 +30,176 @@ br_hextoi(const char c)
 char*
 br_urldecode(const char *str)
 {
-    bc_string_t *rv = bc_string_new();
+    // decoded strings are never longer than the encoded ones.
+    size_t len = strlen(str);
+    char *rv = bc_malloc(len + 1);
+    size_t j = 0;
 
-    for (size_t i = 0; i < strlen(str); i++) {
+    for (size_t i = 0; i < len; i++) {
         switch (str[i]) {
             case '%':
-                if (i + 2 < strlen(str)) {
+                if (i + 2 < len) {
                     int p1 = br_hextoi(str[i + 1]) * 16;
                     int p2 = br_hextoi(str[i + 2]);
                     if (p1 >= 0 && p2 >= 0) {
-                        bc_string_append_c(rv, p1 + p2);
+                        rv[j++] = p1 + p2;
                         i += 2;
                         continue;
                     }
                 }
-                bc_string_append_c(rv, '%');
+                rv[j++] = '%';
                 break;
             case '+':
-                bc_string_append_c(rv, ' ');
+                rv[j++] = ' ';
                 break;
             default:
-                bc_string_append_c(rv, str[i]);
+                rv[j++] = str[i];
         }
     }
 
-    return bc_string_free(rv, false);
+    rv[j] = '\0';
+    return rv;
 }
 
 
 const char*
 br_get_extension(const char *filename)
 {
-    const char *ext = NULL;
-    unsigned int i;
-    for (i = strlen(filename); i > 0; i--) {
-        if (filename[i] == '.') {
-            ext = filename + i + 1;
+    // the last dot of the file name, if it isn't the first character.
+    const char *dot = strrchr(filename, '.');
+    if (dot == NULL || dot == filename || NULL != strpbrk(dot, "/\\"))
+        return NULL;
+    return dot + 1;
+}
+
+
+static bool
+parse_offset(const char *value, size_t len, size_t *i, unsigned long long *rv)
+{
+    // offsets too big for any file saturate instead of overflowing.
+    size_t start = *i;
+    unsigned long long v = 0;
+    while (*i < len && value[*i] >= '0' && value[*i] <= '9') {
+        unsigned long long d = value[*i] - '0';
+        v = (v > (ULLONG_MAX - d) / 10) ? ULLONG_MAX : v * 10 + d;
+        (*i)++;
+    }
+    *rv = v;
+    return *i > start;
+}
+
+
+int
+br_parse_range(const char *value, size_t len, off_t size, br_range_t *ranges,
+    size_t max_ranges)
+{
+    // parses a "Range" header value for a file with the given size. returns
+    // the number of satisfiable ranges, 0 if none is satisfiable (416), or -1
+    // if the header is invalid or asks for too many ranges, and should be
+    // ignored. ranges are clamped to the file size, end is exclusive.
+    if (len < 6 || 0 != strncasecmp(value, "bytes=", 6))
+        return -1;
+
+    unsigned long long fsize = size;
+    size_t n = 0;
+    bool found = false;
+    size_t i = 6;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t'))
+            i++;
+        if (i < len && value[i] == ',') {
+            i++;
+            continue;
+        }
+        if (i >= len)
             break;
+
+        unsigned long long first = 0;
+        unsigned long long last = 0;
+        bool has_first = value[i] != '-';
+        if (has_first && !parse_offset(value, len, &i, &first))
+            return -1;
+        if (i >= len || value[i] != '-')
+            return -1;
+        i++;
+        bool has_last = parse_offset(value, len, &i, &last);
+        while (i < len && (value[i] == ' ' || value[i] == '\t'))
+            i++;
+        if ((i < len && value[i] != ',') || (!has_first && !has_last))
+            return -1;
+
+        found = true;
+        unsigned long long start;
+        unsigned long long end;
+        if (!has_first) {
+            // suffix range: the last bytes of the file.
+            if (last == 0)
+                continue;
+            start = last < fsize ? fsize - last : 0;
+            end = fsize;
+        }
+        else {
+            if (has_last && last < first)
+                return -1;
+            start = first;
+            end = (has_last && last < fsize) ? last + 1 : fsize;
         }
-        if ((filename[i] == '/') || (filename[i] == '\\'))
-            return NULL;
+        if (start >= fsize)
+            continue;
+
+        if (n == max_ranges)
+            return -1;
+        ranges[n].start = start;
+        ranges[n].end = end;
+        n++;
     }
-    if (i == 0)
-        return NULL;
-    return ext;
+
+    return found ? n : -1;
+}
+
+
+bool
+br_accept_encoding(const char *value, size_t len, const char *coding)
+{
+    // checks if an "Accept-Encoding" header value allows the given content
+    // coding, either by name or with "*". codings with "q=0" are refused.
+    size_t coding_len = strlen(coding);
+    int named = -1;
+    int wildcard = -1;
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' ||
+                value[i] == ','))
+            i++;
+        size_t start = i;
+        while (i < len && value[i] != ',' && value[i] != ';' &&
+                value[i] != ' ' && value[i] != '\t')
+            i++;
+        size_t token_len = i - start;
+
+        bool accepted = true;
+        while (i < len && value[i] != ',') {
+            if (value[i] == 'q' && i + 1 < len && value[i + 1] == '=') {
+                // any digit other than zero makes the weight positive.
+                accepted = false;
+                for (i += 2; i < len && value[i] != ',' && value[i] != ';';
+                    i++)
+                {
+                    if (value[i] >= '1' && value[i] <= '9')
+                        accepted = true;
+                }
+                continue;
+            }
+            i++;
+        }
+
+        if (token_len == coding_len &&
+            0 == strncasecmp(value + start, coding, coding_len))
+            named = accepted;
+        else if (token_len == 1 && value[start] == '*')
+            wildcard = accepted;
+    }
+    if (named >= 0)
+        return named;
+    return wildcard > 0;
 }
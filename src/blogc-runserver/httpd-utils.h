@@ -9,11 +9,20 @@
 #ifndef _HTTPD_UTILS_H
 #define _HTTPD_UTILS_H
 
-#define READLINE_BUFFER_SIZE 2048
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct {
+    off_t start;
+    off_t end;
+} br_range_t;
 
-char* br_readline(int socket);
 int br_hextoi(const char c);
 char* br_urldecode(const char *str);
 const char* br_get_extension(const char *filename);
+int br_parse_range(const char *value, size_t len, off_t size,
+    br_range_t *ranges, size_t max_ranges);
+bool br_accept_encoding(const char *value, size_t len, const char *coding);
 
 #endif /* _HTTPD_UTILS_H */
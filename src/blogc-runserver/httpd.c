@@ -6,12 +6,21 @@
  * See the file LICENSE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -19,202 +28,985 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
 #include "../common/error.h"
-#include "../common/file.h"
 #include "../common/utils.h"
-#include "mime.h"
+#include "cache.h"
 #include "httpd-utils.h"
+#include "request.h"
 
 #define LISTEN_BACKLOG 100
+#define MAX_EVENTS 64
+#define READ_BUFFER_SIZE 2048
+#define QUEUE_SIZE_PER_THREAD 4
+#define KEEPALIVE_TIMEOUT 10
+#define KEEPALIVE_MAX_REQUESTS 100
+#define RANGES_MAX 16
+#define ACCEPT_RETRY_MS 1000
 
-typedef struct {
-    pthread_t thread;
-    bool initialized;
-} thread_data_t;
+typedef enum {
+    CONN_READING = 1,
+    CONN_DISPATCHED,
+    CONN_WRITING,
+} br_conn_state_t;
 
 typedef struct {
-    size_t thread_id;
+    // data sent from memory, followed by a range of the response file.
+    char *data;
+    size_t data_len;
+    size_t data_sent;
+    off_t file_offset;
+    off_t file_end;
+} br_part_t;
+
+typedef struct br_conn {
     int socket;
     char *ip;
-    const char *docroot;
-} request_data_t;
+    br_conn_state_t state;
+    bc_string_t *request;
+    bool request_eof;
+    size_t request_len;
+    br_request_t parser;
+    bool bad_request;
+    bool head_request;
+    size_t requests;
+    bool keep_alive;
+    br_part_t *parts;
+    size_t parts_len;
+    size_t part;
+
+    // file the response parts are sent from, straight with sendfile().
+    br_cache_entry_t *file;
+    int file_fd;
+
+    struct br_conn *next;
+
+    // connections owned by the event loop, oldest activity first.
+    bool idle;
+    uint64_t deadline;
+    struct br_conn *idle_prev;
+    struct br_conn *idle_next;
+} br_conn_t;
+
+typedef struct {
+    br_conn_t **items;
+    size_t size;
+    size_t head;
+    size_t len;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+} br_queue_t;
+
+typedef struct {
+    int epoll_fd;
+    int server_socket;
+    int wake_fd;
+    br_cache_t *cache;
+    bool accepting;
+
+    // when out of file descriptors, accepting is paused until a connection
+    // is closed or this deadline is reached.
+    uint64_t accept_retry;
+
+    // requests waiting for a worker thread.
+    br_queue_t queue;
+
+    // requests that didn't fit in the queue, waiting in the event loop.
+    br_conn_t *pending_head;
+    br_conn_t *pending_tail;
+
+    // responses ready to be written by the event loop.
+    br_conn_t *done;
+    pthread_mutex_t done_mutex;
+
+    // connections closed if nothing happens before their deadline.
+    br_conn_t *idle_head;
+    br_conn_t *idle_tail;
+} br_server_t;
+
+typedef struct {
+    br_server_t *server;
+    size_t id;
+    pthread_t thread;
+} br_worker_t;
 
 
 static void
-error(int socket, int status_code, const char *error)
+add_part(br_conn_t *conn, bc_string_t *data, off_t file_offset,
+    off_t file_end)
 {
-    char *str = bc_strdup_printf(
-        "HTTP/1.0 %d %s\r\n"
+    conn->parts = bc_realloc(conn->parts,
+        (conn->parts_len + 1) * sizeof(br_part_t));
+    br_part_t *p = &(conn->parts[conn->parts_len++]);
+    p->data_len = data->len;
+    p->data_sent = 0;
+    p->data = bc_string_free(data, false);
+    p->file_offset = file_offset;
+    p->file_end = file_end;
+}
+
+
+static void
+set_response(br_conn_t *conn, bc_string_t *response)
+{
+    add_part(conn, response, 0, 0);
+}
+
+
+static void
+parts_free(br_conn_t *conn)
+{
+    for (size_t i = 0; i < conn->parts_len; i++)
+        free(conn->parts[i].data);
+    free(conn->parts);
+    conn->parts = NULL;
+    conn->parts_len = 0;
+    conn->part = 0;
+}
+
+
+static const char*
+connection_header(br_conn_t *conn)
+{
+    return conn->keep_alive ? "keep-alive" : "close";
+}
+
+
+static void
+error(br_conn_t *conn, int status_code, const char *error)
+{
+    // 405 responses must list the methods supported (RFC 7231, 6.5.5).
+    bc_string_t *str = bc_string_new();
+    bc_string_append_printf(str,
+        "HTTP/1.1 %d %s\r\n"
+        "%s"
         "Content-Type: text/html\r\n"
         "Content-Length: %zu\r\n"
-        "Connection: close\r\n"
-        "\r\n"
-        "<h1>%s</h1>\n", status_code, error, strlen(error) + 10, error);
-    size_t str_len = strlen(str);
-    if (str_len != write(socket, str, str_len)) {
-        fprintf(stderr, "warning: Failed to write full response header!\n");
+        "Connection: %s\r\n"
+        "\r\n", status_code, error,
+        status_code == 405 ? "Allow: GET, HEAD\r\n" : "",
+        strlen(error) + 10, connection_header(conn));
+    if (!conn->head_request)
+        bc_string_append_printf(str, "<h1>%s</h1>\n", error);
+    set_response(conn, str);
+}
+
+
+static bool
+header_has_token(const char *value, size_t len, const char *token)
+{
+    // matches a token from a comma-separated header value.
+    size_t token_len = strlen(token);
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' ||
+                value[i] == ','))
+            i++;
+        size_t start = i;
+        while (i < len && value[i] != ',')
+            i++;
+        size_t end = i;
+        while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\t'))
+            end--;
+        if (end - start == token_len &&
+            0 == strncasecmp(value + start, token, token_len))
+            return true;
     }
-    free(str);
+    return false;
 }
 
 
-static void*
-handle_request(void *arg)
+static const char*
+request_header(br_conn_t *conn, const char *name, size_t *value_len)
 {
-    request_data_t *req = arg;
-    size_t thread_id = req->thread_id;
-    int client_socket = req->socket;
-    char *ip = req->ip;
-    const char *docroot = req->docroot;
-    free(arg);
+    // only valid for requests already framed by request_frame().
+    return br_request_header(&(conn->parser), conn->request->str, name,
+        value_len);
+}
 
-    char *conn_line = br_readline(client_socket);
-    if (conn_line == NULL || conn_line[0] == '\0')
-        goto point0;
 
+static int
+request_frame(br_conn_t *conn)
+{
+    // parses the data read since the previous call, and reads the headers
+    // that matter for the connection once the request is complete. returns 1
+    // if a full request is available, 0 if more data is needed and -1 if the
+    // request is invalid.
+    const char *str = conn->request->str;
+    br_request_t *req = &(conn->parser);
+    int rv = br_request_parse(req, str, conn->request->len);
+    if (rv <= 0)
+        return rv;
+    conn->request_len = req->len;
+
+    conn->keep_alive = br_request_slice_equal(&(req->version), str,
+        "HTTP/1.1");
+    size_t len;
+    const char *value = request_header(conn, "Connection", &len);
+    if (value != NULL) {
+        if (header_has_token(value, len, "close"))
+            conn->keep_alive = false;
+        else if (header_has_token(value, len, "keep-alive"))
+            conn->keep_alive = true;
+    }
+
+    if (++conn->requests >= KEEPALIVE_MAX_REQUESTS)
+        conn->keep_alive = false;
+    return 1;
+}
+
+
+static void
+request_consume(br_conn_t *conn)
+{
+    // drops the current request from the buffer, keeping any pipelined
+    // requests that follow it.
+    bc_string_t *req = conn->request;
+    size_t len = conn->request_len < req->len ? conn->request_len : req->len;
+    memmove(req->str, req->str + len, req->len - len + 1);
+    req->len -= len;
+    conn->request_len = 0;
+    br_request_init(&(conn->parser));
+}
+
+
+static bool
+etag_match(const char *value, size_t len, const char *etag)
+{
+    // weak comparison, as required for If-None-Match.
+    size_t etag_len = strlen(etag);
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' ||
+                value[i] == ','))
+            i++;
+        if (i + 2 <= len && 0 == strncmp(value + i, "W/", 2))
+            i += 2;
+        size_t start = i;
+        while (i < len && value[i] != ',' && value[i] != ' ' &&
+                value[i] != '\t')
+            i++;
+        if (i - start == 1 && value[start] == '*')
+            return true;
+        if (i - start == etag_len &&
+            0 == strncmp(value + start, etag, etag_len))
+            return true;
+    }
+    return false;
+}
+
+
+static bool
+not_modified(br_conn_t *conn, br_cache_entry_t *entry, const char *etag)
+{
+    size_t len;
+    const char *value = request_header(conn, "If-None-Match", &len);
+    if (value != NULL)
+        return etag_match(value, len, etag);
+
+    value = request_header(conn, "If-Modified-Since", &len);
+    if (value == NULL)
+        return false;
+    struct tm tm;
+    memset(&tm, 0, sizeof(struct tm));
+    char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL || end != value + len)
+        return false;
+    return entry->file.st.st_mtime <= timegm(&tm);
+}
+
+
+static bool
+range_allowed(br_conn_t *conn, br_cache_entry_t *entry, const char *etag)
+{
+    // with If-Range, ranges only apply if the client has the current file.
+    size_t len;
+    const char *value = request_header(conn, "If-Range", &len);
+    if (value == NULL)
+        return true;
+    return (len == strlen(etag) && 0 == strncmp(value, etag, len)) ||
+        (len == strlen(entry->last_modified) &&
+            0 == strncmp(value, entry->last_modified, len));
+}
+
+
+static void
+append_file_headers(bc_string_t *out, br_conn_t *conn,
+    br_cache_entry_t *entry, const char *etag, const char *encoding)
+{
+    bc_string_append_printf(out,
+        "ETag: %s\r\n"
+        "Last-Modified: %s\r\n"
+        "Cache-Control: no-cache\r\n", etag, entry->last_modified);
+    if (encoding != NULL)
+        bc_string_append_printf(out, "Content-Encoding: %s\r\n", encoding);
+
+    // caches must not hand a compressed file to clients that can't read it.
+    if (entry->gzip.fd >= 0 || entry->brotli.fd >= 0 || entry->compressible)
+        bc_string_append(out, "Vary: Accept-Encoding\r\n");
+
+    bc_string_append_printf(out,
+        "Connection: %s\r\n"
+        "\r\n", connection_header(conn));
+}
+
+
+static void
+handle_request(br_conn_t *conn, br_cache_t *cache, size_t thread_id)
+{
+    const char *str = conn->request->str;
+    br_request_t *req = &(conn->parser);
+    char *conn_line = req->line.len > 0 ?
+        bc_strndup(str + req->line.start, req->line.len) :
+        bc_strndup(str, strcspn(str, "\r\n"));
     unsigned short status_code = 200;
+    conn->head_request = false;
 
-    char **pieces = bc_str_split(conn_line, ' ', 3);
-    if (bc_strv_length(pieces) != 3) {
+    if (conn->bad_request) {
         status_code = 400;
-        error(client_socket, 400, "Bad Request");
-        goto point1;
+        error(conn, 400, "Bad Request");
+        goto point0;
     }
 
-    if (strcmp(pieces[0], "GET") != 0) {
+    conn->head_request = br_request_slice_equal(&(req->method), str, "HEAD");
+    if (!conn->head_request &&
+        !br_request_slice_equal(&(req->method), str, "GET"))
+    {
         status_code = 405;
-        error(client_socket, 405, "Method Not Allowed");
-        goto point1;
+        error(conn, 405, "Method Not Allowed");
+        goto point0;
     }
 
-    char **pieces2 = bc_str_split(pieces[1], '?', 2);
-    char *path = br_urldecode(pieces2[0]);
-    bc_strv_free(pieces2);
+    const char *target = str + req->target.start;
+    const char *query = memchr(target, '?', req->target.len);
+    char *tmp = bc_strndup(target,
+        query != NULL ? (size_t) (query - target) : req->target.len);
+    char *path = br_urldecode(tmp);
+    free(tmp);
 
     if (path == NULL) {
         status_code = 400;
-        error(client_socket, 400, "Bad Request");
-        goto point2;
+        error(conn, 400, "Bad Request");
+        goto point1;
     }
 
-    char *abs_path = bc_strdup_printf("%s/%s", docroot, path);
-    char *real_path = realpath(abs_path, NULL);
-    free(abs_path);
+    br_cache_entry_t *entry = br_cache_get(cache, path, &status_code);
+    if (entry == NULL) {
+        switch (status_code) {
+            case 403:
+                error(conn, 403, "Forbidden");
+                break;
+            case 404:
+                error(conn, 404, "Not Found");
+                break;
+            case 503:
+                error(conn, 503, "Service Unavailable");
+                break;
+            default:
+                error(conn, 500, "Internal Server Error");
+        }
+        goto point1;
+    }
 
-    if (real_path == NULL) {
-        status_code = 404;
-        error(client_socket, 404, "Not Found");
-        goto point2;
+    if (entry->add_slash) {
+        // production webservers usually returns 301 in such cases, but 302 is
+        // better for development/testing.
+        bc_string_t *tmp = bc_string_new();
+        bc_string_append_printf(tmp,
+            "HTTP/1.1 302 Found\r\n"
+            "Location: %s/\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: %s\r\n"
+            "\r\n", path, connection_header(conn));
+        status_code = 302;
+        set_response(conn, tmp);
+        br_cache_release(entry);
+        goto point1;
     }
 
-    char *real_root = realpath(docroot, NULL);
-    if (real_root == NULL) {
-        status_code = 500;
-        error(client_socket, 500, "Internal Server Error");
-        goto point3;
+    // compressed files are sent to clients that accept them, with the
+    // content type of the original file.
+    br_cache_file_t *file = &(entry->file);
+    const char *encoding = NULL;
+    bc_string_t *gzip_data = NULL;
+    size_t len;
+    const char *accept = request_header(conn, "Accept-Encoding", &len);
+    if (accept != NULL && entry->brotli.fd >= 0 &&
+        br_accept_encoding(accept, len, "br"))
+    {
+        file = &(entry->brotli);
+        encoding = "br";
+    }
+    else if (accept != NULL && br_accept_encoding(accept, len, "gzip")) {
+        if (entry->gzip.fd >= 0) {
+            file = &(entry->gzip);
+            encoding = "gzip";
+        }
+        else if (NULL != (gzip_data = br_cache_get_gzip(entry))) {
+            encoding = "gzip";
+        }
     }
 
-    if (0 != strncmp(real_root, real_path, strlen(real_root))) {
-        status_code = 404;
-        error(client_socket, 404, "Not Found");
-        goto point4;
+    off_t size = file->st.st_size;
+    char etag[sizeof(file->etag) + 3];
+    if (gzip_data != NULL) {
+        size = gzip_data->len;
+        snprintf(etag, sizeof(etag), "%.*s-gz\"",
+            (int) strlen(file->etag) - 1, file->etag);
+    }
+    else {
+        snprintf(etag, sizeof(etag), "%s", file->etag);
+    }
+
+    // browsers must revalidate, otherwise they would keep showing stale
+    // assets after a rebuild. unchanged files cost a 304 only.
+    if (not_modified(conn, entry, etag)) {
+        bc_string_t *tmp = bc_string_new();
+        bc_string_append(tmp, "HTTP/1.1 304 Not Modified\r\n");
+        append_file_headers(tmp, conn, entry, etag, encoding);
+        status_code = 304;
+        set_response(conn, tmp);
+        bc_string_free(gzip_data, true);
+        br_cache_release(entry);
+        goto point1;
     }
 
-    struct stat st;
-    if (0 > stat(real_path, &st)) {
-        status_code = 404;
-        error(client_socket, 404, "Not Found");
-        goto point4;
+    // ranges of files compressed on the fly are not supported, they are
+    // small anyway.
+    br_range_t ranges[RANGES_MAX];
+    int n_ranges = -1;
+    if (!conn->head_request && gzip_data == NULL &&
+        range_allowed(conn, entry, etag))
+    {
+        const char *range = request_header(conn, "Range", &len);
+        if (range != NULL)
+            n_ranges = br_parse_range(range, len, size, ranges, RANGES_MAX);
     }
 
-    bool add_slash = false;
+    if (n_ranges == 0) {
+        bc_string_t *tmp = bc_string_new();
+        bc_string_append_printf(tmp,
+            "HTTP/1.1 416 Range Not Satisfiable\r\n"
+            "Content-Range: bytes */%lld\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: %s\r\n"
+            "\r\n", (long long) size, connection_header(conn));
+        status_code = 416;
+        set_response(conn, tmp);
+        br_cache_release(entry);
+        goto point1;
+    }
+
+    bc_string_t *out = bc_string_new();
+    bc_string_t *headers[RANGES_MAX];
+    bc_string_t *end = NULL;
+    if (n_ranges < 0) {
+        bc_string_append_printf(out,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %lld\r\n", entry->content_type,
+            (long long) size);
+    }
+    else if (n_ranges == 1) {
+        status_code = 206;
+        bc_string_append_printf(out,
+            "HTTP/1.1 206 Partial Content\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %lld\r\n"
+            "Content-Range: bytes %lld-%lld/%lld\r\n", entry->content_type,
+            (long long) (ranges[0].end - ranges[0].start),
+            (long long) ranges[0].start, (long long) ranges[0].end - 1,
+            (long long) size);
+    }
+    else {
+        status_code = 206;
 
-    if (S_ISDIR(st.st_mode)) {
-        char *found = br_mime_guess_index(real_path);
+        // the boundary only has to be absent from the parts, a hash is
+        // unlikely to show up in a file.
+        char boundary[17];
+        snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long)
+            bc_hash(BC_HASH_INIT, etag, strlen(etag)));
 
-        if (found == NULL) {
-            status_code = 403;
-            error(client_socket, 403, "Forbidden");
-            goto point4;
+        long long content_length = 0;
+        for (int i = 0; i < n_ranges; i++) {
+            headers[i] = bc_string_new();
+            bc_string_append_printf(headers[i],
+                "\r\n"
+                "--%s\r\n"
+                "Content-Type: %s\r\n"
+                "Content-Range: bytes %lld-%lld/%lld\r\n"
+                "\r\n", boundary, entry->content_type,
+                (long long) ranges[i].start, (long long) ranges[i].end - 1,
+                (long long) size);
+            content_length += headers[i]->len + ranges[i].end -
+                ranges[i].start;
         }
+        end = bc_string_new();
+        bc_string_append_printf(end, "\r\n--%s--\r\n", boundary);
+        content_length += end->len;
 
-        size_t path_len = strlen(path);
-        if (path_len > 0 && path[path_len - 1] != '/')
-            add_slash = true;
+        bc_string_append_printf(out,
+            "HTTP/1.1 206 Partial Content\r\n"
+            "Content-Type: multipart/byteranges; boundary=%s\r\n"
+            "Content-Length: %lld\r\n", boundary, content_length);
+    }
+    if (gzip_data == NULL)
+        bc_string_append(out, "Accept-Ranges: bytes\r\n");
+    append_file_headers(out, conn, entry, etag, encoding);
 
-        free(real_path);
-        real_path = found;
+    if (conn->head_request) {
+        set_response(conn, out);
+        bc_string_free(gzip_data, true);
+        br_cache_release(entry);
+        goto point1;
     }
 
-    if (0 != access(real_path, F_OK)) {
-        status_code = 500;
-        error(client_socket, 500, "Internal Server Error");
-        goto point4;
+    if (gzip_data != NULL) {
+        add_part(conn, out, 0, 0);
+        add_part(conn, gzip_data, 0, 0);
+        br_cache_release(entry);
+        goto point1;
     }
 
-    if (add_slash) {
-        // production webservers usually returns 301 in such cases, but 302 is
-        // better for development/testing.
-        char *tmp = bc_strdup_printf(
-            "HTTP/1.0 302 Found\r\n"
-            "Location: %s/\r\n"
-            "Content-Length: 0\r\n"
-            "Connection: close\r\n"
-            "\r\n", path);
-        status_code = 302;
-        size_t tmp_len = strlen(tmp);
-        if (tmp_len != write(client_socket, tmp, tmp_len)) {
-            fprintf(stderr, "warning: Failed to write full response header!\n");
+    if (n_ranges < 0) {
+        add_part(conn, out, 0, size);
+    }
+    else if (n_ranges == 1) {
+        add_part(conn, out, ranges[0].start, ranges[0].end);
+    }
+    else {
+        add_part(conn, out, 0, 0);
+        for (int i = 0; i < n_ranges; i++)
+            add_part(conn, headers[i], ranges[i].start, ranges[i].end);
+        add_part(conn, end, 0, 0);
+    }
+
+    // the cache entry is shared, sendfile() reads from an explicit offset
+    // and doesn't move the file position.
+    conn->file = entry;
+    conn->file_fd = file->fd;
+
+point1:
+    free(path);
+point0:
+    fprintf(stderr, "[Thread-%zu] %s - - \"%s\" %d\n", thread_id, conn->ip,
+        conn_line, status_code);
+    free(conn_line);
+}
+
+
+static void
+conn_free(br_conn_t *conn)
+{
+    if (conn == NULL)
+        return;
+    // closing the socket also removes it from the epoll instance.
+    close(conn->socket);
+    br_cache_release(conn->file);
+    free(conn->ip);
+    bc_string_free(conn->request, true);
+    parts_free(conn);
+    free(conn);
+}
+
+
+static bool
+conn_read(br_conn_t *conn)
+{
+    // reads everything available without blocking. returns false if the
+    // connection failed.
+    char buffer[READ_BUFFER_SIZE];
+    while (conn->request->len <= REQUEST_MAX_SIZE) {
+        ssize_t len = read(conn->socket, buffer, READ_BUFFER_SIZE);
+        if (len > 0) {
+            bc_string_append_len(conn->request, buffer, len);
+            continue;
         }
-        free(tmp);
-        goto point4;
+        if (len == 0) {
+            conn->request_eof = true;
+            return true;
+        }
+        if (errno == EINTR)
+            continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
     }
+    return true;
+}
 
-    size_t len;
-    bc_error_t *err = NULL;
-    char* contents = bc_file_get_contents(real_path, false, &len, &err);
-    if (err != NULL) {
-        status_code = 500;
-        error(client_socket, 500, "Internal Server Error");
-        bc_error_free(err);
-        goto point4;
-    }
-
-    char *out = bc_strdup_printf(
-        "HTTP/1.0 200 OK\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %zu\r\n"
-        "Connection: close\r\n"
-        "\r\n", br_mime_guess_content_type(real_path), len);
-    size_t out_len = strlen(out);
-    if (out_len != write(client_socket, out, out_len)) {
-        fprintf(stderr, "warning: Failed to write full response header!\n");
+
+static int
+conn_write(br_conn_t *conn)
+{
+    // writes as much as possible without blocking. returns 0 when the
+    // response was fully written, 1 if the socket is not writable anymore
+    // and -1 on errors.
+    while (conn->part < conn->parts_len) {
+        br_part_t *p = &(conn->parts[conn->part]);
+        while (p->data_sent < p->data_len) {
+            // data followed by more of the response is held back, to go out
+            // in the same segments as what follows it.
+            int flags = 0;
+            if (p->file_offset < p->file_end ||
+                conn->part + 1 < conn->parts_len)
+                flags |= MSG_MORE;
+            ssize_t len = send(conn->socket, p->data + p->data_sent,
+                p->data_len - p->data_sent, flags);
+            if (len > 0) {
+                p->data_sent += len;
+                continue;
+            }
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 1;
+            return -1;
+        }
+        while (p->file_offset < p->file_end) {
+            ssize_t len = sendfile(conn->socket, conn->file_fd,
+                &(p->file_offset), p->file_end - p->file_offset);
+            if (len > 0)
+                continue;
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 1;
+
+            // the file was truncated while being sent, the response can't
+            // be completed anymore.
+            return -1;
+        }
+        conn->part++;
     }
-    free(out);
+    return 0;
+}
+
 
-    if (len != write(client_socket, contents, len)) {
-        fprintf(stderr, "warning: Failed to write full response body!\n");
+static bool
+queue_push(br_queue_t *queue, br_conn_t *conn)
+{
+    pthread_mutex_lock(&(queue->mutex));
+    bool rv = queue->len < queue->size;
+    if (rv) {
+        queue->items[(queue->head + queue->len++) % queue->size] = conn;
+        pthread_cond_signal(&(queue->not_empty));
+    }
+    pthread_mutex_unlock(&(queue->mutex));
+    return rv;
+}
+
+
+static br_conn_t*
+queue_pop(br_queue_t *queue)
+{
+    pthread_mutex_lock(&(queue->mutex));
+    while (queue->len == 0)
+        pthread_cond_wait(&(queue->not_empty), &(queue->mutex));
+    br_conn_t *rv = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->size;
+    queue->len--;
+    pthread_mutex_unlock(&(queue->mutex));
+    return rv;
+}
+
+
+static void*
+worker_run(void *arg)
+{
+    br_worker_t *worker = arg;
+    br_server_t *server = worker->server;
+
+    while (1) {
+        br_conn_t *conn = queue_pop(&(server->queue));
+        handle_request(conn, server->cache, worker->id);
+
+        // the event loop writes the response, so a slow client doesn't hold
+        // a worker thread.
+        pthread_mutex_lock(&(server->done_mutex));
+        conn->next = server->done;
+        server->done = conn;
+        pthread_mutex_unlock(&(server->done_mutex));
+
+        uint64_t value = 1;
+        if (sizeof(value) != write(server->wake_fd, &value, sizeof(value)))
+            fprintf(stderr, "warning: Failed to wake up event loop!\n");
     }
-    free(contents);
 
-point4:
-    free(real_root);
-point3:
-    free(real_path);
-point2:
-    free(path);
-point1:
-    fprintf(stderr, "[Thread-%zu] %s - - \"%s\" %d\n", thread_id + 1,
-        ip, conn_line, status_code);
-    free(conn_line);
-    bc_strv_free(pieces);
-point0:
-    free(ip);
-    close(client_socket);
     return NULL;
 }
 
 
+static uint64_t
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static void
+idle_remove(br_server_t *server, br_conn_t *conn)
+{
+    if (!conn->idle)
+        return;
+    if (conn->idle_prev == NULL)
+        server->idle_head = conn->idle_next;
+    else
+        conn->idle_prev->idle_next = conn->idle_next;
+    if (conn->idle_next == NULL)
+        server->idle_tail = conn->idle_prev;
+    else
+        conn->idle_next->idle_prev = conn->idle_prev;
+    conn->idle = false;
+}
+
+
+static void
+idle_touch(br_server_t *server, br_conn_t *conn)
+{
+    // every deadline uses the same timeout, so appending keeps the list
+    // sorted.
+    idle_remove(server, conn);
+    conn->deadline = now_ms() + KEEPALIVE_TIMEOUT * 1000;
+    conn->idle = true;
+    conn->idle_next = NULL;
+    conn->idle_prev = server->idle_tail;
+    if (server->idle_tail == NULL)
+        server->idle_head = conn;
+    else
+        server->idle_tail->idle_next = conn;
+    server->idle_tail = conn;
+}
+
+
+static bool
+watch(br_server_t *server, int fd, uint32_t events, void *ptr)
+{
+    struct epoll_event ev = {.events = events, .data.ptr = ptr};
+    return 0 == epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+
+static void
+set_accepting(br_server_t *server, bool accepting)
+{
+    // when the queue is full, new connections wait in the kernel backlog.
+    if (server->accepting == accepting)
+        return;
+    if (watch(server, server->server_socket, accepting ? EPOLLIN : 0,
+            &(server->server_socket)))
+        server->accepting = accepting;
+}
+
+
+static void
+accept_resume(br_server_t *server)
+{
+    server->accept_retry = 0;
+    if (server->pending_head == NULL)
+        set_accepting(server, true);
+}
+
+
+static void
+conn_close(br_server_t *server, br_conn_t *conn)
+{
+    idle_remove(server, conn);
+    conn_free(conn);
+    if (server->accept_retry != 0)
+        accept_resume(server);
+}
+
+
+static int
+idle_timeout(br_server_t *server)
+{
+    // closes expired connections and resumes accepting when it's time to
+    // retry, and returns how long epoll can wait for the next deadline.
+    uint64_t now = now_ms();
+    while (server->idle_head != NULL && server->idle_head->deadline <= now)
+        conn_close(server, server->idle_head);
+    if (server->accept_retry != 0 && server->accept_retry <= now)
+        accept_resume(server);
+
+    uint64_t deadline = server->accept_retry;
+    if (server->idle_head != NULL &&
+        (deadline == 0 || server->idle_head->deadline < deadline))
+        deadline = server->idle_head->deadline;
+    if (deadline == 0)
+        return -1;
+    return deadline - now;
+}
+
+
+static void
+dispatch(br_server_t *server, br_conn_t *conn)
+{
+    // no events or timeouts for the connection while a worker handles it.
+    // epoll always reports errors and hangups, even with no events
+    // requested, so the socket is removed from it. the connection must not
+    // be freed by the event loop until the worker is done with it.
+    idle_remove(server, conn);
+    if (0 != epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->socket, NULL)) {
+        conn_free(conn);
+        return;
+    }
+    conn->state = CONN_DISPATCHED;
+
+    if (server->pending_head == NULL && queue_push(&(server->queue), conn))
+        return;
+
+    conn->next = NULL;
+    if (server->pending_tail == NULL)
+        server->pending_head = conn;
+    else
+        server->pending_tail->next = conn;
+    server->pending_tail = conn;
+    set_accepting(server, false);
+}
+
+
+static void
+handle_read(br_server_t *server, br_conn_t *conn)
+{
+    int rv = request_frame(conn);
+    if (rv < 0) {
+        // the rest of the buffer can't be trusted, answer and close.
+        conn->bad_request = true;
+        conn->keep_alive = false;
+        conn->request_len = conn->request->len;
+    }
+    if (rv != 0) {
+        dispatch(server, conn);
+        return;
+    }
+
+    // the client gave up before finishing the request.
+    if (conn->request_eof) {
+        conn_close(server, conn);
+        return;
+    }
+    idle_touch(server, conn);
+}
+
+
+static void
+finish_response(br_server_t *server, br_conn_t *conn)
+{
+    if (!conn->keep_alive) {
+        conn_close(server, conn);
+        return;
+    }
+
+    request_consume(conn);
+    parts_free(conn);
+    br_cache_release(conn->file);
+    conn->file = NULL;
+    conn->file_fd = -1;
+    conn->state = CONN_READING;
+
+    if (!watch(server, conn->socket, EPOLLIN, conn)) {
+        conn_close(server, conn);
+        return;
+    }
+
+    // pipelined requests may be waiting in the buffer already.
+    handle_read(server, conn);
+}
+
+
+static void
+start_write(br_server_t *server, br_conn_t *conn)
+{
+    conn->state = CONN_WRITING;
+    struct epoll_event ev = {.events = 0, .data.ptr = conn};
+    if (0 != epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, conn->socket, &ev)) {
+        conn_close(server, conn);
+        return;
+    }
+
+    // most responses fit in the socket buffer, try to write right away.
+    int rv = conn_write(conn);
+    if (rv == 0) {
+        finish_response(server, conn);
+        return;
+    }
+    if (rv == 1 && watch(server, conn->socket, EPOLLOUT, conn)) {
+        idle_touch(server, conn);
+        return;
+    }
+    fprintf(stderr, "warning: Failed to write full response!\n");
+    conn_close(server, conn);
+}
+
+
+static void
+handle_done(br_server_t *server)
+{
+    uint64_t value;
+    if (sizeof(value) != read(server->wake_fd, &value, sizeof(value)))
+        return;
+
+    pthread_mutex_lock(&(server->done_mutex));
+    br_conn_t *done = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&(server->done_mutex));
+
+    while (done != NULL) {
+        br_conn_t *conn = done;
+        done = done->next;
+        start_write(server, conn);
+    }
+
+    // workers are free again, move waiting requests to the queue.
+    while (server->pending_head != NULL &&
+        queue_push(&(server->queue), server->pending_head))
+    {
+        server->pending_head = server->pending_head->next;
+        if (server->pending_head == NULL)
+            server->pending_tail = NULL;
+    }
+    if (server->pending_head == NULL && server->accept_retry == 0)
+        set_accepting(server, true);
+}
+
+
+static void
+handle_event(br_server_t *server, br_conn_t *conn, uint32_t events)
+{
+    // owned by a worker thread or waiting for one.
+    if (conn->state == CONN_DISPATCHED)
+        return;
+
+    if (conn->state == CONN_READING) {
+        if (!conn_read(conn)) {
+            conn_close(server, conn);
+            return;
+        }
+        handle_read(server, conn);
+        return;
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        fprintf(stderr, "warning: Failed to write full response!\n");
+        conn_close(server, conn);
+        return;
+    }
+
+    int rv = conn_write(conn);
+    if (rv == 0) {
+        finish_response(server, conn);
+        return;
+    }
+    if (rv == 1) {
+        idle_touch(server, conn);
+        return;
+    }
+    fprintf(stderr, "warning: Failed to write full response!\n");
+    conn_close(server, conn);
+}
+
+
 static char*
 br_httpd_get_ip(int af, const struct sockaddr *addr)
 {
@@ -247,6 +1039,70 @@ br_httpd_get_port(int af, const struct sockaddr *addr)
 }
 
 
+static void
+accept_connections(br_server_t *server)
+{
+    while (1) {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+
+        int client_socket = accept4(server->server_socket,
+            (struct sockaddr*) &addr,
+            &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket == -1) {
+            if (errno == EINTR)
+                continue;
+
+            // the listening socket stays readable, stop watching it instead
+            // of failing to accept in a loop.
+            if (errno == EMFILE || errno == ENFILE) {
+                if (server->accept_retry == 0)
+                    fprintf(stderr, "Failed to accept connection: %s\n",
+                        strerror(errno));
+                server->accept_retry = now_ms() + ACCEPT_RETRY_MS;
+                set_accepting(server, false);
+                return;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "Failed to accept connection: %s\n",
+                    strerror(errno));
+            return;
+        }
+
+        br_conn_t *conn = bc_malloc(sizeof(br_conn_t));
+        conn->socket = client_socket;
+        conn->ip = br_httpd_get_ip(addr.ss_family, (struct sockaddr*) &addr);
+        conn->state = CONN_READING;
+        conn->request = bc_string_new();
+        conn->request_eof = false;
+        conn->request_len = 0;
+        br_request_init(&(conn->parser));
+        conn->bad_request = false;
+        conn->head_request = false;
+        conn->requests = 0;
+        conn->keep_alive = false;
+        conn->parts = NULL;
+        conn->parts_len = 0;
+        conn->part = 0;
+        conn->file = NULL;
+        conn->file_fd = -1;
+        conn->next = NULL;
+        conn->idle = false;
+
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+        if (0 > epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_socket,
+                &ev))
+        {
+            fprintf(stderr, "Failed to watch connection: %s\n",
+                strerror(errno));
+            conn_free(conn);
+            continue;
+        }
+        idle_touch(server, conn);
+    }
+}
+
+
 int
 br_httpd_run(const char *host, const char *port, const char *docroot,
     size_t max_threads)
@@ -268,10 +1124,6 @@ br_httpd_run(const char *host, const char *port, const char *docroot,
         return 3;
     }
 
-    thread_data_t threads[max_threads];
-    for (size_t i = 0; i < max_threads; i++)
-        threads[i].initialized = false;
-
     int rv = 0;
 
     struct addrinfo *rp;
@@ -335,65 +1187,108 @@ br_httpd_run(const char *host, const char *port, const char *docroot,
         fprintf(stderr, "%s", final_host);
     if (final_port != 80)
         fprintf(stderr, ":%d", final_port);
-    fprintf(stderr, "/ (max threads: %zu)\n"
+    fprintf(stderr, "/ (worker threads: %zu)\n"
         "\n"
         "WARNING!!! This is a development server, DO NOT RUN IT IN PRODUCTION!\n"
         "\n", max_threads);
     free(final_host);
 
-    size_t current_thread = 0;
-
-    while (1) {
-        struct sockaddr_in6 addr6;
-        struct sockaddr_in addr;
-
-        socklen_t addrlen;
-        struct sockaddr *client_addr = NULL;
+    int flags = fcntl(server_socket, F_GETFL);
+    if (flags < 0 || 0 > fcntl(server_socket, F_SETFL, flags | O_NONBLOCK)) {
+        fprintf(stderr, "Failed to set server socket as non-blocking: %s\n",
+            strerror(errno));
+        rv = 3;
+        goto cleanup;
+    }
 
-        if (rp->ai_family == AF_INET6) {
-            addrlen = sizeof(addr6);
-            client_addr = (struct sockaddr*) &addr6;
-        }
-        else {
-            addrlen = sizeof(addr);
-            client_addr = (struct sockaddr*) &addr;
-        }
+    br_server_t server = {
+        .epoll_fd = epoll_create1(EPOLL_CLOEXEC),
+        .server_socket = server_socket,
+        .wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+        .cache = br_cache_new(docroot),
+        .accepting = true,
+        .accept_retry = 0,
+        .queue = {
+            .items = bc_malloc(max_threads * QUEUE_SIZE_PER_THREAD *
+                sizeof(br_conn_t*)),
+            .size = max_threads * QUEUE_SIZE_PER_THREAD,
+            .head = 0,
+            .len = 0,
+        },
+        .pending_head = NULL,
+        .pending_tail = NULL,
+        .done = NULL,
+        .idle_head = NULL,
+        .idle_tail = NULL,
+    };
+    pthread_mutex_init(&(server.queue.mutex), NULL);
+    pthread_cond_init(&(server.queue.not_empty), NULL);
+    pthread_mutex_init(&(server.done_mutex), NULL);
 
-        int client_socket = accept(server_socket, client_addr, &addrlen);
-        if (client_socket == -1) {
-            fprintf(stderr, "Failed to accept connection: %s\n", strerror(errno));
-            rv = 3;
-            goto cleanup;
-        }
+    br_worker_t *workers = bc_malloc(max_threads * sizeof(br_worker_t));
 
-        request_data_t *arg = malloc(sizeof(request_data_t));
-        arg->thread_id = current_thread;
-        arg->socket = client_socket;
-        arg->ip = br_httpd_get_ip(rp->ai_family, client_addr);
-        arg->docroot = docroot;
+    if (server.epoll_fd < 0 || server.wake_fd < 0) {
+        fprintf(stderr, "Failed to create event loop: %s\n", strerror(errno));
+        rv = 3;
+        goto cleanup1;
+    }
 
-        if (threads[current_thread].initialized) {
-            if (pthread_join(threads[current_thread].thread, NULL) != 0) {
-                fprintf(stderr, "Failed to join thread\n");
-                rv = 3;
-                goto cleanup;
-            }
-        }
+    // the server socket and the wake up file descriptor are told apart from
+    // the connections by their data pointers.
+    struct epoll_event ev = {.events = EPOLLIN,
+        .data.ptr = &(server.server_socket)};
+    struct epoll_event ev2 = {.events = EPOLLIN, .data.ptr = &(server.wake_fd)};
+    if (0 > epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server_socket, &ev) ||
+        0 > epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd, &ev2))
+    {
+        fprintf(stderr, "Failed to watch server socket: %s\n",
+            strerror(errno));
+        rv = 3;
+        goto cleanup1;
+    }
 
-        if (pthread_create(&(threads[current_thread].thread), NULL,
-            handle_request, arg) != 0)
+    for (size_t i = 0; i < max_threads; i++) {
+        workers[i].server = &server;
+        workers[i].id = i + 1;
+        if (0 != pthread_create(&(workers[i].thread), NULL, worker_run,
+                &(workers[i])))
         {
             fprintf(stderr, "Failed to create thread\n");
             rv = 3;
-            goto cleanup;
+            goto cleanup1;
         }
+    }
 
-        threads[current_thread++].initialized = true;
-
-        if (current_thread >= max_threads)
-            current_thread = 0;
+    while (1) {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(server.epoll_fd, events, MAX_EVENTS,
+            idle_timeout(&server));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Failed to wait for events: %s\n",
+                strerror(errno));
+            rv = 3;
+            goto cleanup1;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &(server.server_socket))
+                accept_connections(&server);
+            else if (events[i].data.ptr == &(server.wake_fd))
+                handle_done(&server);
+            else
+                handle_event(&server, events[i].data.ptr, events[i].events);
+        }
     }
 
+cleanup1:
+    // worker threads block forever waiting for requests, and are gone with
+    // the process.
+    if (server.epoll_fd >= 0)
+        close(server.epoll_fd);
+    if (server.wake_fd >= 0)
+        close(server.wake_fd);
+
 cleanup:
     close(server_socket);
 
@@ -13,8 +13,10 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "../common/error.h"
 #include "../common/utils.h"
 #include "httpd.h"
+#include "mime.h"
 
 
 static void
@@ -22,7 +24,8 @@ print_help(const char *default_host, const char *default_port)
 {
     printf(
         "usage:\n"
-        "    blogc-runserver [-h] [-v] [-t HOST] [-p PORT] [-m THREADS] DOCROOT\n"
+        "    blogc-runserver [-h] [-v] [-t HOST] [-p PORT] [-m THREADS]\n"
+        "                    [-M MIMETYPES] DOCROOT\n"
         "                    - A simple HTTP server to test blogc websites.\n"
         "\n"
         "positional arguments:\n"
@@ -33,7 +36,8 @@ print_help(const char *default_host, const char *default_port)
         "    -v            show version and exit\n"
         "    -t HOST       set server listen address (default: %s)\n"
         "    -p PORT       set server listen port (default: %s)\n"
-        "    -m THREADS    set maximum number of threads to spawn (default: 20)\n",
+        "    -m THREADS    set number of worker threads (default: 20)\n"
+        "    -M MIMETYPES  load additional MIME types from a mime.types file\n",
         default_host, default_port);
 }
 
@@ -41,7 +45,8 @@ print_help(const char *default_host, const char *default_port)
 static void
 print_usage(void)
 {
-    printf("usage: blogc-runserver [-h] [-v] [-t HOST] [-p PORT] [-m THREADS] DOCROOT\n");
+    printf("usage: blogc-runserver [-h] [-v] [-t HOST] [-p PORT] [-m THREADS]\n"
+        "                       [-M MIMETYPES] DOCROOT\n");
 }
 
 
@@ -61,6 +66,7 @@ main(int argc, char **argv)
     char *host = NULL;
     char *port = NULL;
     char *docroot = NULL;
+    char *mimetypes = NULL;
     size_t max_threads = 20;
     char *ptr;
     char *endptr;
@@ -103,6 +109,12 @@ main(int argc, char **argv)
                         fprintf(stderr, "blogc-runserver: warning: invalid value "
                             "for -m argument: %s. using %zu instead\n", ptr, max_threads);
                     break;
+                case 'M':
+                    if (argv[i][2] != '\0')
+                        mimetypes = bc_strdup(argv[i] + 2);
+                    else
+                        mimetypes = bc_strdup(argv[++i]);
+                    break;
                 default:
                     print_usage();
                     fprintf(stderr, "blogc-runserver: error: invalid "
@@ -140,6 +152,16 @@ main(int argc, char **argv)
         goto cleanup;
     }
 
+    if (mimetypes != NULL) {
+        bc_error_t *err = NULL;
+        if (!br_mime_load(mimetypes, &err)) {
+            bc_error_print(err, "blogc-runserver");
+            bc_error_free(err);
+            rv = 3;
+            goto cleanup;
+        }
+    }
+
     rv = br_httpd_run(
         host != NULL ? host : default_host,
         port != NULL ? port : default_port,
@@ -151,6 +173,7 @@ cleanup:
     free(host);
     free(port);
     free(docroot);
+    free(mimetypes);
 
     return rv;
 }
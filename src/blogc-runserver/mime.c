@@ -6,130 +6,252 @@
  * See the file LICENSE.
  */
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include "../common/error.h"
+#include "../common/file.h"
 #include "../common/utils.h"
 #include "httpd-utils.h"
+#include "mime.h"
 
 
-// mime types with index should be in the begin of the list. first NULL
-// index aborts the lookup, for optimization
-static const struct content_type_map {
+// index files, in lookup order.
+static const char *index_files[] = {
+    "index.html",
+    "index.htm",
+    "index.shtml",
+    "index.xml",
+    "index.txt",
+    "index.xhtml",
+    NULL,
+};
+
+typedef struct {
     const char *mimetype;
     const char *extension;
-    const char *index;
-} content_types[] = {
-
-    // with index
-    {"text/html", "html", "index.html"},
-    {"text/html", "htm", "index.htm"},
-    {"text/html", "shtml", "index.shtml"},
-    {"text/xml", "xml", "index.xml"},
-    {"text/plain", "txt", "index.txt"},
-    {"application/xhtml+xml", "xhtml", "index.xhtml"},
-
-    // without index
-    {"text/css", "css", NULL},
-    {"image/gif", "gif", NULL},
-    {"image/jpeg", "jpeg", NULL},
-    {"image/jpeg", "jpg", NULL},
-    {"application/javascript", "js", NULL},
-    {"application/atom+xml", "atom", NULL},
-    {"application/rss+xml", "rss", NULL},
-    {"text/mathml", "mml", NULL},
-    {"text/vnd.sun.j2me.app-descriptor", "jad", NULL},
-    {"text/vnd.wap.wml", "wml", NULL},
-    {"text/x-component", "htc", NULL},
-    {"image/png", "png", NULL},
-    {"image/tiff", "tif", NULL},
-    {"image/tiff", "tiff", NULL},
-    {"image/vnd.wap.wbmp", "wbmp", NULL},
-    {"image/x-icon", "ico", NULL},
-    {"image/x-jng", "jng", NULL},
-    {"image/x-ms-bmp", "bmp", NULL},
-    {"image/svg+xml", "svg", NULL},
-    {"image/svg+xml", "svgz", NULL},
-    {"image/webp", "webp", NULL},
-    {"application/font-woff", "woff", NULL},
-    {"application/java-archive", "jar", NULL},
-    {"application/java-archive", "war", NULL},
-    {"application/java-archive", "ear", NULL},
-    {"application/json", "json", NULL},
-    {"application/mac-binhex40", "hqx", NULL},
-    {"application/msword", "doc", NULL},
-    {"application/pdf", "pdf", NULL},
-    {"application/postscript", "ps", NULL},
-    {"application/postscript", "eps", NULL},
-    {"application/postscript", "ai", NULL},
-    {"application/rtf", "rtf", NULL},
-    {"application/vnd.apple.mpegurl", "m3u8", NULL},
-    {"application/vnd.ms-excel", "xls", NULL},
-    {"application/vnd.ms-fontobject", "eot", NULL},
-    {"application/vnd.ms-powerpoint", "ppt", NULL},
-    {"application/vnd.wap.wmlc", "wmlc", NULL},
-    {"application/vnd.google-earth.kml+xml", "kml", NULL},
-    {"application/vnd.google-earth.kmz", "kmz", NULL},
-    {"application/x-7z-compressed", "7z", NULL},
-    {"application/x-cocoa", "cco", NULL},
-    {"application/x-java-archive-diff", "jardiff", NULL},
-    {"application/x-java-jnlp-file", "jnlp", NULL},
-    {"application/x-makeself", "run", NULL},
-    {"application/x-perl", "pl", NULL},
-    {"application/x-perl", "pm", NULL},
-    {"application/x-pilot", "prc", NULL},
-    {"application/x-pilot", "pdb", NULL},
-    {"application/x-rar-compressed", "rar", NULL},
-    {"application/x-redhat-package-manager", "rpm", NULL},
-    {"application/x-sea", "sea", NULL},
-    {"application/x-shockwave-flash", "swf", NULL},
-    {"application/x-stuffit", "sit", NULL},
-    {"application/x-tcl", "tcl", NULL},
-    {"application/x-tcl", "tk", NULL},
-    {"application/x-x509-ca-cert", "der", NULL},
-    {"application/x-x509-ca-cert", "pem", NULL},
-    {"application/x-x509-ca-cert", "crt", NULL},
-    {"application/x-xpinstall", "xpi", NULL},
-    {"application/xspf+xml", "xspf", NULL},
-    {"application/zip", "zip", NULL},
-    {"application/octet-stream", "bin", NULL},
-    {"application/octet-stream", "exe", NULL},
-    {"application/octet-stream", "dll", NULL},
-    {"application/octet-stream", "deb", NULL},
-    {"application/octet-stream", "dmg", NULL},
-    {"application/octet-stream", "iso", NULL},
-    {"application/octet-stream", "img", NULL},
-    {"application/octet-stream", "msi", NULL},
-    {"application/octet-stream", "msp", NULL},
-    {"application/octet-stream", "msm", NULL},
-    {"application/vnd.openxmlformats-officedocument.wordprocessingml.document", "docx", NULL},
-    {"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet", "xlsx", NULL},
-    {"application/vnd.openxmlformats-officedocument.presentationml.presentation", "pptx", NULL},
-    {"audio/midi", "mid", NULL},
-    {"audio/midi", "midi", NULL},
-    {"audio/midi", "kar", NULL},
-    {"audio/mpeg", "mp3", NULL},
-    {"audio/ogg", "ogg", NULL},
-    {"audio/x-m4a", "m4a", NULL},
-    {"audio/x-realaudio", "ra", NULL},
-    {"video/3gpp", "3gpp", NULL},
-    {"video/3gpp", "3gp", NULL},
-    {"video/mp2t", "ts", NULL},
-    {"video/mp4", "mp4", NULL},
-    {"video/mpeg", "mpeg", NULL},
-    {"video/mpeg", "mpg", NULL},
-    {"video/quicktime", "mov", NULL},
-    {"video/webm", "webm", NULL},
-    {"video/x-flv", "flv", NULL},
-    {"video/x-m4v", "m4v", NULL},
-    {"video/x-mng", "mng", NULL},
-    {"video/x-ms-asf", "asx", NULL},
-    {"video/x-ms-asf", "asf", NULL},
-    {"video/x-ms-wmv", "wmv", NULL},
-    {"video/x-msvideo", "avi", NULL},
-    {NULL, NULL, NULL}
+} br_content_type_t;
+
+// sorted by extension for binary search. extensions must be lowercase.
+static const br_content_type_t content_types[] = {
+    {"video/3gpp", "3gp"},
+    {"video/3gpp", "3gpp"},
+    {"application/x-7z-compressed", "7z"},
+    {"application/postscript", "ai"},
+    {"video/x-ms-asf", "asf"},
+    {"video/x-ms-asf", "asx"},
+    {"application/atom+xml", "atom"},
+    {"video/x-msvideo", "avi"},
+    {"application/octet-stream", "bin"},
+    {"image/x-ms-bmp", "bmp"},
+    {"application/x-cocoa", "cco"},
+    {"application/x-x509-ca-cert", "crt"},
+    {"text/css", "css"},
+    {"application/octet-stream", "deb"},
+    {"application/x-x509-ca-cert", "der"},
+    {"application/octet-stream", "dll"},
+    {"application/octet-stream", "dmg"},
+    {"application/msword", "doc"},
+    {"application/vnd.openxmlformats-officedocument.wordprocessingml.document", "docx"},
+    {"application/java-archive", "ear"},
+    {"application/vnd.ms-fontobject", "eot"},
+    {"application/postscript", "eps"},
+    {"application/octet-stream", "exe"},
+    {"video/x-flv", "flv"},
+    {"image/gif", "gif"},
+    {"application/mac-binhex40", "hqx"},
+    {"text/x-component", "htc"},
+    {"text/html", "htm"},
+    {"text/html", "html"},
+    {"image/x-icon", "ico"},
+    {"application/octet-stream", "img"},
+    {"application/octet-stream", "iso"},
+    {"text/vnd.sun.j2me.app-descriptor", "jad"},
+    {"application/java-archive", "jar"},
+    {"application/x-java-archive-diff", "jardiff"},
+    {"image/x-jng", "jng"},
+    {"application/x-java-jnlp-file", "jnlp"},
+    {"image/jpeg", "jpeg"},
+    {"image/jpeg", "jpg"},
+    {"application/javascript", "js"},
+    {"application/json", "json"},
+    {"audio/midi", "kar"},
+    {"application/vnd.google-earth.kml+xml", "kml"},
+    {"application/vnd.google-earth.kmz", "kmz"},
+    {"application/vnd.apple.mpegurl", "m3u8"},
+    {"audio/x-m4a", "m4a"},
+    {"video/x-m4v", "m4v"},
+    {"audio/midi", "mid"},
+    {"audio/midi", "midi"},
+    {"text/mathml", "mml"},
+    {"video/x-mng", "mng"},
+    {"video/quicktime", "mov"},
+    {"audio/mpeg", "mp3"},
+    {"video/mp4", "mp4"},
+    {"video/mpeg", "mpeg"},
+    {"video/mpeg", "mpg"},
+    {"application/octet-stream", "msi"},
+    {"application/octet-stream", "msm"},
+    {"application/octet-stream", "msp"},
+    {"audio/ogg", "ogg"},
+    {"application/x-pilot", "pdb"},
+    {"application/pdf", "pdf"},
+    {"application/x-x509-ca-cert", "pem"},
+    {"application/x-perl", "pl"},
+    {"application/x-perl", "pm"},
+    {"image/png", "png"},
+    {"application/vnd.ms-powerpoint", "ppt"},
+    {"application/vnd.openxmlformats-officedocument.presentationml.presentation", "pptx"},
+    {"application/x-pilot", "prc"},
+    {"application/postscript", "ps"},
+    {"audio/x-realaudio", "ra"},
+    {"application/x-rar-compressed", "rar"},
+    {"application/x-redhat-package-manager", "rpm"},
+    {"application/rss+xml", "rss"},
+    {"application/rtf", "rtf"},
+    {"application/x-makeself", "run"},
+    {"application/x-sea", "sea"},
+    {"text/html", "shtml"},
+    {"application/x-stuffit", "sit"},
+    {"image/svg+xml", "svg"},
+    {"image/svg+xml", "svgz"},
+    {"application/x-shockwave-flash", "swf"},
+    {"application/x-tcl", "tcl"},
+    {"image/tiff", "tif"},
+    {"image/tiff", "tiff"},
+    {"application/x-tcl", "tk"},
+    {"video/mp2t", "ts"},
+    {"text/plain", "txt"},
+    {"application/java-archive", "war"},
+    {"image/vnd.wap.wbmp", "wbmp"},
+    {"video/webm", "webm"},
+    {"image/webp", "webp"},
+    {"text/vnd.wap.wml", "wml"},
+    {"application/vnd.wap.wmlc", "wmlc"},
+    {"video/x-ms-wmv", "wmv"},
+    {"application/font-woff", "woff"},
+    {"application/xhtml+xml", "xhtml"},
+    {"application/vnd.ms-excel", "xls"},
+    {"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet", "xlsx"},
+    {"text/xml", "xml"},
+    {"application/x-xpinstall", "xpi"},
+    {"application/xspf+xml", "xspf"},
+    {"application/zip", "zip"},
 };
 
+typedef struct {
+    br_content_type_t type;
+    size_t order;
+} br_extra_type_t;
+
+// loaded by br_mime_load() before the server starts, read-only afterwards.
+static br_extra_type_t *extra_types = NULL;
+static size_t extra_types_len = 0;
+
+
+static int
+compare_extension(const void *key, const void *member)
+{
+    // members of both tables start with a br_content_type_t.
+    return strcasecmp(key, ((const br_content_type_t*) member)->extension);
+}
+
+
+static int
+compare_extra_types(const void *a, const void *b)
+{
+    const br_extra_type_t *ta = a;
+    const br_extra_type_t *tb = b;
+    int rv = strcmp(ta->type.extension, tb->type.extension);
+    if (rv != 0)
+        return rv;
+    return ta->order < tb->order ? -1 : ta->order > tb->order;
+}
+
+
+static void
+free_extra_types(void)
+{
+    for (size_t i = 0; i < extra_types_len; i++) {
+        free((char*) extra_types[i].type.mimetype);
+        free((char*) extra_types[i].type.extension);
+    }
+    free(extra_types);
+    extra_types = NULL;
+    extra_types_len = 0;
+}
+
+
+bool
+br_mime_load(const char *filename, bc_error_t **err)
+{
+    // loads a mime.types file, whose types take precedence over the
+    // built-in ones. each line is a type followed by its extensions.
+    if (err == NULL || *err != NULL)
+        return false;
+
+    size_t len;
+    char *content = bc_file_get_contents(filename, false, &len, err);
+    if (content == NULL)
+        return false;
+
+    free_extra_types();
+    size_t allocated = 0;
+
+    char *saveptr1;
+    for (char *line = strtok_r(content, "\n", &saveptr1); line != NULL;
+        line = strtok_r(NULL, "\n", &saveptr1))
+    {
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        char *mimetype = NULL;
+        char *saveptr2;
+        for (char *tok = strtok_r(line, " \t\r", &saveptr2); tok != NULL;
+            tok = strtok_r(NULL, " \t\r", &saveptr2))
+        {
+            if (mimetype == NULL) {
+                mimetype = tok;
+                continue;
+            }
+            if (extra_types_len == allocated) {
+                allocated = allocated == 0 ? 64 : allocated * 2;
+                extra_types = bc_realloc(extra_types,
+                    allocated * sizeof(br_extra_type_t));
+            }
+            for (char *c = tok; *c != '\0'; c++)
+                *c = tolower((unsigned char) *c);
+            br_extra_type_t *t = &(extra_types[extra_types_len]);
+            t->type.mimetype = bc_strdup(mimetype);
+            t->type.extension = bc_strdup(tok);
+            t->order = extra_types_len++;
+        }
+    }
+    free(content);
+
+    // sort, then keep only the last definition of each extension.
+    qsort(extra_types, extra_types_len, sizeof(br_extra_type_t),
+        compare_extra_types);
+    size_t n = 0;
+    for (size_t i = 0; i < extra_types_len; i++) {
+        if (i + 1 < extra_types_len && 0 == strcmp(
+                extra_types[i].type.extension,
+                extra_types[i + 1].type.extension))
+        {
+            free((char*) extra_types[i].type.mimetype);
+            free((char*) extra_types[i].type.extension);
+            continue;
+        }
+        extra_types[n++] = extra_types[i];
+    }
+    extra_types_len = n;
+
+    return true;
+}
+
 
 const char*
 br_mime_guess_content_type(const char *filename)
@@ -137,11 +259,17 @@ br_mime_guess_content_type(const char *filename)
     const char *extension = br_get_extension(filename);
     if (extension == NULL)
         goto default_type;
-    for (size_t i = 0; content_types[i].extension != NULL; i++) {
-        if (0 == strcmp(content_types[i].extension, extension)) {
-            return content_types[i].mimetype;
-        }
-    }
+
+    const br_content_type_t *found = NULL;
+    if (extra_types != NULL)
+        found = bsearch(extension, extra_types, extra_types_len,
+            sizeof(br_extra_type_t), compare_extension);
+    if (found == NULL)
+        found = bsearch(extension, content_types,
+            sizeof(content_types) / sizeof(content_types[0]),
+            sizeof(br_content_type_t), compare_extension);
+    if (found != NULL)
+        return found->mimetype;
 
 default_type:
     return "application/octet-stream";
@@ -152,8 +280,8 @@ char*
 br_mime_guess_index(const char *path)
 {
     char *found = NULL;
-    for (size_t i = 0; content_types[i].index != NULL; i++) {
-        char *f = bc_strdup_printf("%s/%s", path, content_types[i].index);
+    for (size_t i = 0; index_files[i] != NULL; i++) {
+        char *f = bc_strdup_printf("%s/%s", path, index_files[i]);
         if (0 == access(f, F_OK)) {
             found = f;
             break;
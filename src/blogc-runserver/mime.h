@@ -9,7 +9,11 @@
 #ifndef _MIME_H
 #define _MIME_H
 
+#include <stdbool.h>
+#include "../common/error.h"
+
 const char* br_mime_guess_content_type(const char *filename);
 char* br_mime_guess_index(const char *path);
+bool br_mime_load(const char *filename, bc_error_t **err);
 
 #endif /* _MIME_H */
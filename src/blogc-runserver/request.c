@@ -0,0 +1,223 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include "request.h"
+
+
+void
+br_request_init(br_request_t *req)
+{
+    memset(req, 0, sizeof(br_request_t));
+    req->state = BR_REQUEST_LINE;
+}
+
+
+static bool
+is_tchar(char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9'))
+        return true;
+    return c != '\0' && NULL != strchr("!#$%&'*+-.^_`|~", c);
+}
+
+
+static bool
+name_equal(const br_slice_t *slice, const char *buf, const char *name)
+{
+    // header names are case-insensitive.
+    size_t len = strlen(name);
+    return slice->len == len && 0 == strncasecmp(buf + slice->start, name, len);
+}
+
+
+static bool
+parse_line(br_request_t *req, const char *buf, size_t start, size_t end)
+{
+    // method SP request-target SP HTTP-version
+    size_t i = start;
+    while (i < end && is_tchar(buf[i]))
+        i++;
+    if (i == start || i == end || buf[i] != ' ')
+        return false;
+    req->method.start = start;
+    req->method.len = i - start;
+
+    size_t target = ++i;
+    while (i < end && buf[i] != ' ' && buf[i] > 0x20 && buf[i] != 0x7f)
+        i++;
+    if (i == target || i == end || buf[i] != ' ')
+        return false;
+    req->target.start = target;
+    req->target.len = i - target;
+
+    size_t version = ++i;
+    if (end - version != 8 || 0 != strncmp(buf + version, "HTTP/", 5) ||
+        buf[version + 5] < '0' || buf[version + 5] > '9' ||
+        buf[version + 6] != '.' ||
+        buf[version + 7] < '0' || buf[version + 7] > '9')
+        return false;
+    req->version.start = version;
+    req->version.len = 8;
+
+    req->line.start = start;
+    req->line.len = end - start;
+    return true;
+}
+
+
+static bool
+parse_content_length(br_request_t *req, const char *buf, size_t start,
+    size_t len)
+{
+    const char *value = buf + start;
+    if (len == 0)
+        return false;
+    size_t content_length = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9')
+            return false;
+        content_length = content_length * 10 + (value[i] - '0');
+        if (content_length > REQUEST_MAX_SIZE)
+            return false;
+    }
+
+    // repeated headers must agree, or the request can't be framed.
+    for (size_t i = 0; i + 1 < req->headers_len; i++)
+        if (name_equal(&(req->headers[i].name), buf, "Content-Length"))
+            return req->content_length == content_length;
+    req->content_length = content_length;
+    return true;
+}
+
+
+static bool
+parse_header(br_request_t *req, const char *buf, size_t start, size_t end)
+{
+    // header lines folded into the previous one are obsolete, and a space
+    // before the colon is forbidden, both are rejected (RFC 7230, 3.2.4).
+    size_t i = start;
+    while (i < end && is_tchar(buf[i]))
+        i++;
+    if (i == start || i == end || buf[i] != ':')
+        return false;
+    if (req->headers_len >= REQUEST_MAX_HEADERS)
+        return false;
+
+    br_header_t *h = &(req->headers[req->headers_len++]);
+    h->name.start = start;
+    h->name.len = i - start;
+
+    i++;
+    while (i < end && (buf[i] == ' ' || buf[i] == '\t'))
+        i++;
+    while (end > i && (buf[end - 1] == ' ' || buf[end - 1] == '\t'))
+        end--;
+    h->value.start = i;
+    h->value.len = end - i;
+
+    if (name_equal(&(h->name), buf, "Content-Length"))
+        return parse_content_length(req, buf, i, end - i);
+
+    // request bodies are never used, and chunked ones can't be skipped
+    // without decoding them.
+    if (name_equal(&(h->name), buf, "Transfer-Encoding"))
+        return false;
+
+    return true;
+}
+
+
+int
+br_request_parse(br_request_t *req, const char *buf, size_t len)
+{
+    // parses the data appended to the buffer since the previous call, so
+    // requests split across several reads are scanned only once. returns 1
+    // once the request is complete, 0 if more data is needed and -1 if the
+    // request is invalid. req->len is the size of the request, body included.
+    while (req->state == BR_REQUEST_LINE || req->state == BR_REQUEST_HEADERS) {
+        const char *nl = memchr(buf + req->pos, '\n', len - req->pos);
+        if (nl == NULL) {
+            if (len > REQUEST_MAX_SIZE)
+                goto error;
+            return 0;
+        }
+
+        size_t start = req->pos;
+        size_t end = nl - buf;
+        req->pos = end + 1;
+        if (req->pos > REQUEST_MAX_SIZE)
+            goto error;
+        if (end > start && buf[end - 1] == '\r')
+            end--;
+        if (NULL != memchr(buf + start, '\0', end - start))
+            goto error;
+
+        if (req->state == BR_REQUEST_LINE) {
+            // empty lines before the request line are ignored
+            // (RFC 7230, 3.5).
+            if (end == start)
+                continue;
+            if (!parse_line(req, buf, start, end))
+                goto error;
+            req->state = BR_REQUEST_HEADERS;
+            continue;
+        }
+
+        if (end == start) {
+            if (req->content_length > REQUEST_MAX_SIZE - req->pos)
+                goto error;
+            req->len = req->pos + req->content_length;
+            req->state = BR_REQUEST_BODY;
+            break;
+        }
+        if (!parse_header(req, buf, start, end))
+            goto error;
+    }
+
+    if (req->state == BR_REQUEST_ERROR)
+        return -1;
+    if (req->state == BR_REQUEST_BODY) {
+        if (len < req->len)
+            return 0;
+        req->state = BR_REQUEST_DONE;
+    }
+    return 1;
+
+error:
+    req->state = BR_REQUEST_ERROR;
+    return -1;
+}
+
+
+const char*
+br_request_header(const br_request_t *req, const char *buf, const char *name,
+    size_t *len)
+{
+    for (size_t i = 0; i < req->headers_len; i++) {
+        const br_header_t *h = &(req->headers[i]);
+        if (name_equal(&(h->name), buf, name)) {
+            *len = h->value.len;
+            return buf + h->value.start;
+        }
+    }
+    return NULL;
+}
+
+
+bool
+br_request_slice_equal(const br_slice_t *slice, const char *buf,
+    const char *str)
+{
+    size_t len = strlen(str);
+    return slice->len == len && 0 == strncmp(buf + slice->start, str, len);
+}
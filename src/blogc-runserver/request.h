@@ -0,0 +1,58 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifndef _REQUEST_H
+#define _REQUEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define REQUEST_MAX_SIZE 8192
+#define REQUEST_MAX_HEADERS 64
+
+typedef enum {
+    BR_REQUEST_LINE = 1,
+    BR_REQUEST_HEADERS,
+    BR_REQUEST_BODY,
+    BR_REQUEST_DONE,
+    BR_REQUEST_ERROR,
+} br_request_state_t;
+
+// parts of the request are offsets into the buffer being parsed, that may be
+// reallocated between calls.
+typedef struct {
+    size_t start;
+    size_t len;
+} br_slice_t;
+
+typedef struct {
+    br_slice_t name;
+    br_slice_t value;
+} br_header_t;
+
+typedef struct {
+    br_request_state_t state;
+    size_t pos;
+    br_slice_t line;
+    br_slice_t method;
+    br_slice_t target;
+    br_slice_t version;
+    br_header_t headers[REQUEST_MAX_HEADERS];
+    size_t headers_len;
+    size_t content_length;
+    size_t len;
+} br_request_t;
+
+void br_request_init(br_request_t *req);
+int br_request_parse(br_request_t *req, const char *buf, size_t len);
+const char* br_request_header(const br_request_t *req, const char *buf,
+    const char *name, size_t *len);
+bool br_request_slice_equal(const br_slice_t *slice, const char *buf,
+    const char *str);
+
+#endif /* _REQUEST_H */
@@ -15,6 +15,7 @@
 #include "source-parser.h"
 #include "template-parser.h"
 #include "loader.h"
+#include "stats.h"
 #include "../common/error.h"
 #include "../common/file.h"
 #include "../common/utils.h"
@@ -64,10 +65,14 @@ blogc_template_parse_from_file(const char *f, bc_error_t **err)
         return NULL;
 
     size_t len;
+    blogc_stats_phase_t phase = blogc_stats_push(BLOGC_STATS_READ);
     char *s = bc_file_get_contents(f, true, &len, err);
+    blogc_stats_pop(phase);
     if (s == NULL)
         return NULL;
+    phase = blogc_stats_push(BLOGC_STATS_TEMPLATE_PARSE);
     bc_slist_t *rv = blogc_template_parse(s, len, err);
+    blogc_stats_pop(phase);
     free(s);
     return rv;
 }
@@ -80,10 +85,14 @@ blogc_source_parse_from_file(const char *f, bc_error_t **err)
         return NULL;
 
     size_t len;
+    blogc_stats_phase_t phase = blogc_stats_push(BLOGC_STATS_READ);
     char *s = bc_file_get_contents(f, true, &len, err);
+    blogc_stats_pop(phase);
     if (s == NULL)
         return NULL;
+    phase = blogc_stats_push(BLOGC_STATS_SOURCE_PARSE);
     bc_trie_t *rv = blogc_source_parse(s, len, err);
+    blogc_stats_pop(phase);
 
     // set FILENAME variable
     if (rv != NULL) {
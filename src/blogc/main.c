@@ -25,8 +25,11 @@
 #include "debug.h"
 #include "template-parser.h"
 #include "loader.h"
+#include "minifier.h"
 #include "renderer.h"
+#include "stats.h"
 #include "../common/error.h"
+#include "../common/file.h"
 #include "../common/utf8.h"
 #include "../common/utils.h"
 
@@ -49,7 +52,9 @@ blogc_print_help(void)
         "[-m] "
 #endif
         "[-h] [-v] [-d] [-i] [-l] [-D KEY=VALUE ...] [-p KEY] [-t TEMPLATE]\n"
-        "          [-o OUTPUT] [SOURCE ...] - A blog compiler.\n"
+        "          [-o OUTPUT] [--stats[=FORMAT]] [--skip-unchanged] [--minify]\n"
+        "          [SOURCE ...]\n"
+        "          - A blog compiler.\n"
         "\n"
         "positional arguments:\n"
         "    SOURCE        source file(s)\n"
@@ -65,6 +70,14 @@ blogc_print_help(void)
         "                  after source parsing and exit\n"
         "    -t TEMPLATE   template file\n"
         "    -o OUTPUT     output file\n"
+        "    --stats[=FORMAT]\n"
+        "                  print timing and memory statistics to stderr. FORMAT\n"
+        "                  can be 'text' (default) or 'json'\n"
+        "    --skip-unchanged\n"
+        "                  don't rewrite OUTPUT if its content is unchanged, and\n"
+        "                  replace it atomically otherwise\n"
+        "    --minify      minify HTML output, collapsing whitespace and removing\n"
+        "                  comments\n"
 #ifdef MAKE_EMBEDDED
         "    -m            call and pass arguments to embedded blogc-make\n"
 #endif
@@ -81,7 +94,8 @@ blogc_print_usage(void)
         "[-m] "
 #endif
         "[-h] [-v] [-d] [-i] [-l] [-D KEY=VALUE ...] [-p KEY] [-t TEMPLATE]\n"
-        "             [-o OUTPUT] [SOURCE ...]\n");
+        "             [-o OUTPUT] [--stats[=FORMAT]] [--skip-unchanged]\n"
+        "             [--minify] [SOURCE ...]\n");
 }
 
 
@@ -155,6 +169,9 @@ main(int argc, char **argv)
     bool debug = false;
     bool input_stdin = false;
     bool listing = false;
+    bool stats_json = false;
+    bool skip_unchanged = false;
+    bool minify = false;
     char *template = NULL;
     char *output = NULL;
     char *print = NULL;
@@ -223,6 +240,7 @@ main(int argc, char **argv)
                         }
                         for (unsigned int j = 0; pieces[0][j] != '\0'; j++) {
                             if (!((pieces[0][j] >= 'A' && pieces[0][j] <= 'Z') ||
+                                (j > 0 && pieces[0][j] >= '0' && pieces[0][j] <= '9') ||
                                 pieces[0][j] == '_'))
                             {
                                 fprintf(stderr, "blogc: error: invalid value "
@@ -238,6 +256,31 @@ main(int argc, char **argv)
                         pieces = NULL;
                     }
                     break;
+                case '-':
+                    if (0 == strcmp(argv[i], "--stats") ||
+                        0 == strcmp(argv[i], "--stats=text"))
+                    {
+                        blogc_stats_enable();
+                        break;
+                    }
+                    if (0 == strcmp(argv[i], "--stats=json")) {
+                        blogc_stats_enable();
+                        stats_json = true;
+                        break;
+                    }
+                    if (0 == strcmp(argv[i], "--skip-unchanged")) {
+                        skip_unchanged = true;
+                        break;
+                    }
+                    if (0 == strcmp(argv[i], "--minify")) {
+                        minify = true;
+                        break;
+                    }
+                    blogc_print_usage();
+                    fprintf(stderr, "blogc: error: invalid argument: %s\n",
+                        argv[i]);
+                    rv = 3;
+                    goto cleanup;
 #ifdef MAKE_EMBEDDED
                 case 'm':
                     embedded = true;
@@ -291,6 +334,8 @@ main(int argc, char **argv)
         goto cleanup2;
     }
 
+    blogc_stats_set_sources(bc_slist_length(s));
+
     if (print != NULL) {
         const char *val = bc_trie_lookup(config, print);
         if (val == NULL) {
@@ -321,10 +366,31 @@ main(int argc, char **argv)
     if (debug)
         blogc_debug_template(l);
 
+    blogc_stats_phase_t phase = blogc_stats_push(BLOGC_STATS_RENDER);
     char *out = blogc_render(l, s, config, listing);
+    if (out != NULL && minify)
+        blogc_minify_html(out, strlen(out));
+    blogc_stats_pop(phase);
+
+    if (out != NULL)
+        blogc_stats_set_output_bytes(strlen(out));
 
     bool write_to_stdout = (output == NULL || (0 == strcmp(output, "-")));
 
+    phase = blogc_stats_push(BLOGC_STATS_WRITE);
+
+    if (!write_to_stdout && skip_unchanged) {
+        blogc_mkdir_recursive(output);
+        bc_file_write_if_changed(output, out, out != NULL ? strlen(out) : 0,
+            &err);
+        if (err != NULL) {
+            bc_error_print(err, "blogc");
+            rv = 3;
+        }
+        blogc_stats_pop(phase);
+        goto cleanup4;
+    }
+
     FILE *fp = stdout;
     if (!write_to_stdout) {
         blogc_mkdir_recursive(output);
@@ -333,6 +399,7 @@ main(int argc, char **argv)
             fprintf(stderr, "blogc: error: failed to open output file (%s): %s\n",
                 output, strerror(errno));
             rv = 3;
+            blogc_stats_pop(phase);
             goto cleanup4;
         }
     }
@@ -342,12 +409,18 @@ main(int argc, char **argv)
 
     if (!write_to_stdout)
         fclose(fp);
+    else
+        fflush(fp);
+
+    blogc_stats_pop(phase);
 
 cleanup4:
     free(out);
 cleanup3:
     blogc_template_free_stmts(l);
 cleanup2:
+    if (rv == 0)
+        blogc_stats_print(stats_json);
     bc_slist_free_full(s, (bc_free_func_t) bc_trie_free);
     bc_error_free(err);
 cleanup:
@@ -0,0 +1,173 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "minifier.h"
+
+// the content of these elements is copied verbatim.
+static const char* raw_tags[] = {
+    "pre",
+    "textarea",
+    "script",
+    "style",
+    NULL,
+};
+
+
+static bool
+is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+
+static bool
+is_alpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+
+static bool
+match_tag_name(const char *buf, size_t len, const char *name)
+{
+    size_t i;
+    for (i = 0; name[i] != '\0'; i++) {
+        if (i >= len)
+            return false;
+        char c = buf[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != name[i])
+            return false;
+    }
+    return i == len || is_space(buf[i]) || buf[i] == '>' || buf[i] == '/';
+}
+
+
+static size_t
+find_closing_tag(const char *buf, size_t len, size_t start, const char *name)
+{
+    for (size_t i = start; i + 1 < len; i++) {
+        if (buf[i] == '<' && buf[i + 1] == '/' &&
+            match_tag_name(buf + i + 2, len - i - 2, name))
+            return i;
+    }
+    return len;
+}
+
+
+size_t
+blogc_minify_html(char *buf, size_t len)
+{
+    // single pass over the buffer, in place. the output is never longer than
+    // the input, so the write position never passes the read position.
+    if (buf == NULL)
+        return 0;
+
+    size_t r = 0;
+    size_t w = 0;
+    bool last_space = false;
+
+    while (r < len) {
+
+        if (is_space(buf[r])) {
+            bool newline = false;
+            for (; r < len && is_space(buf[r]); r++)
+                if (buf[r] == '\n')
+                    newline = true;
+
+            // a run of whitespace is replaced by a single character, that is
+            // a newline if the run had one, to keep the output readable.
+            if (last_space) {
+                if (newline)
+                    buf[w - 1] = '\n';
+                continue;
+            }
+            buf[w++] = newline ? '\n' : ' ';
+            last_space = true;
+            continue;
+        }
+
+        if (buf[r] != '<' || r + 1 >= len || !(is_alpha(buf[r + 1]) ||
+            buf[r + 1] == '/' || buf[r + 1] == '!' || buf[r + 1] == '?'))
+        {
+            buf[w++] = buf[r++];
+            last_space = false;
+            continue;
+        }
+
+        if (r + 3 < len && 0 == strncmp(buf + r, "<!--", 4)) {
+            size_t end = r + 4;
+            for (; end + 2 < len; end++)
+                if (0 == strncmp(buf + end, "-->", 3))
+                    break;
+            end = end + 2 < len ? end + 3 : len;
+
+            // conditional comments are meaningful for some browsers.
+            if (r + 4 < len && buf[r + 4] == '[') {
+                memmove(buf + w, buf + r, end - r);
+                w += end - r;
+                last_space = false;
+            }
+            r = end;
+            continue;
+        }
+
+        const char *raw = NULL;
+        if (is_alpha(buf[r + 1])) {
+            for (size_t i = 0; raw_tags[i] != NULL; i++) {
+                if (match_tag_name(buf + r + 1, len - r - 1, raw_tags[i])) {
+                    raw = raw_tags[i];
+                    break;
+                }
+            }
+        }
+
+        // the tag itself. whitespace between attributes is collapsed, but
+        // quoted attribute values are copied verbatim.
+        char quote = '\0';
+        buf[w++] = buf[r++];
+        while (r < len) {
+            char c = buf[r];
+            if (quote != '\0') {
+                if (c == quote)
+                    quote = '\0';
+                buf[w++] = buf[r++];
+                continue;
+            }
+            if (c == '"' || c == '\'') {
+                quote = c;
+                buf[w++] = buf[r++];
+                continue;
+            }
+            if (is_space(c)) {
+                for (; r < len && is_space(buf[r]); r++);
+                buf[w++] = ' ';
+                continue;
+            }
+            buf[w++] = buf[r++];
+            if (c == '>')
+                break;
+        }
+        last_space = false;
+
+        if (raw != NULL) {
+            size_t end = find_closing_tag(buf, len, r, raw);
+            memmove(buf + w, buf + r, end - r);
+            w += end - r;
+            r = end;
+        }
+    }
+
+    if (w < len)
+        buf[w] = '\0';
+    return w;
+}
@@ -0,0 +1,16 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifndef _MINIFIER_H
+#define _MINIFIER_H
+
+#include <stddef.h>
+
+size_t blogc_minify_html(char *buf, size_t len);
+
+#endif /* _MINIFIER_H */
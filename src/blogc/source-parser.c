@@ -11,6 +11,7 @@
 
 #include "content-parser.h"
 #include "source-parser.h"
+#include "stats.h"
 #include "../common/error.h"
 #include "../common/utils.h"
 
@@ -153,8 +154,11 @@ blogc_source_parse(const char *src, size_t src_len, bc_error_t **err)
                     bc_trie_insert(rv, "RAW_CONTENT", tmp);
                     char *first_header = NULL;
                     char *description = NULL;
+                    blogc_stats_phase_t phase = blogc_stats_push(
+                        BLOGC_STATS_CONTENT_PARSE);
                     content = blogc_content_parse(tmp, &end_excerpt,
                         &first_header, &description);
+                    blogc_stats_pop(phase);
                     if (first_header != NULL) {
                         // do not override source-provided first_header.
                         if (NULL == bc_trie_lookup(rv, "FIRST_HEADER")) {
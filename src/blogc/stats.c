@@ -0,0 +1,233 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#ifdef HAVE_MALLOC_H
+#include <malloc.h>
+#endif /* HAVE_MALLOC_H */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include "../common/utils.h"
+#include "stats.h"
+
+// phases may nest (content parsing happens inside source parsing), so each
+// phase accounts only the time and allocations spent while it was the
+// innermost active phase. the sum of all phases plus the time spent outside
+// of any phase is the total.
+
+typedef struct {
+    double wall;
+    double cpu;
+} blogc_stats_clock_t;
+
+typedef struct {
+    size_t calls;
+    double wall;
+    double cpu;
+    size_t allocs;
+    size_t bytes;
+} blogc_stats_entry_t;
+
+static const char *phase_names[] = {
+    [BLOGC_STATS_NONE] = "other",
+    [BLOGC_STATS_READ] = "read",
+    [BLOGC_STATS_SOURCE_PARSE] = "source_parse",
+    [BLOGC_STATS_CONTENT_PARSE] = "content_parse",
+    [BLOGC_STATS_TEMPLATE_PARSE] = "template_parse",
+    [BLOGC_STATS_RENDER] = "render",
+    [BLOGC_STATS_WRITE] = "write",
+};
+
+static struct {
+    bool enabled;
+    blogc_stats_phase_t current;
+    blogc_stats_clock_t start;
+    blogc_stats_clock_t mark;
+    bc_alloc_stats_t alloc_mark;
+    blogc_stats_entry_t phases[BLOGC_STATS_LAST];
+    size_t peak_bytes;
+    size_t sources;
+    size_t output_bytes;
+} stats;
+
+
+static void
+blogc_stats_now(blogc_stats_clock_t *c)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    c->wall = ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    c->cpu = ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+    c->cpu = ((double) clock()) * 1000.0 / CLOCKS_PER_SEC;
+#endif
+#else
+    // no monotonic clock available, wall time will be the same as cpu time.
+    c->cpu = ((double) clock()) * 1000.0 / CLOCKS_PER_SEC;
+    c->wall = c->cpu;
+#endif
+}
+
+
+static void
+blogc_stats_sample_heap(void)
+{
+    // we can't track frees (they are plain free() calls everywhere), then we
+    // ask the allocator for the bytes in use, everytime a phase changes.
+    size_t used = 0;
+#if defined(HAVE_MALLINFO2)
+    struct mallinfo2 mi = mallinfo2();
+    used = mi.uordblks + mi.hblkhd;
+#elif defined(HAVE_MALLINFO)
+    struct mallinfo mi = mallinfo();
+    used = ((size_t) mi.uordblks) + ((size_t) mi.hblkhd);
+#endif
+    if (used > stats.peak_bytes)
+        stats.peak_bytes = used;
+}
+
+
+static void
+blogc_stats_account(void)
+{
+    blogc_stats_clock_t now;
+    bc_alloc_stats_t alloc;
+    blogc_stats_now(&now);
+    bc_alloc_stats_get(&alloc);
+
+    blogc_stats_entry_t *e = &(stats.phases[stats.current]);
+    e->wall += now.wall - stats.mark.wall;
+    e->cpu += now.cpu - stats.mark.cpu;
+    e->allocs += (alloc.allocs + alloc.reallocs) -
+        (stats.alloc_mark.allocs + stats.alloc_mark.reallocs);
+    e->bytes += alloc.bytes - stats.alloc_mark.bytes;
+
+    stats.mark = now;
+    stats.alloc_mark = alloc;
+    blogc_stats_sample_heap();
+}
+
+
+void
+blogc_stats_enable(void)
+{
+    if (stats.enabled)
+        return;
+    bc_alloc_stats_enable(true);
+    stats.enabled = true;
+    stats.current = BLOGC_STATS_NONE;
+    blogc_stats_now(&(stats.start));
+    stats.mark = stats.start;
+    bc_alloc_stats_get(&(stats.alloc_mark));
+}
+
+
+bool
+blogc_stats_enabled(void)
+{
+    return stats.enabled;
+}
+
+
+blogc_stats_phase_t
+blogc_stats_push(blogc_stats_phase_t phase)
+{
+    if (!stats.enabled)
+        return BLOGC_STATS_NONE;
+    blogc_stats_account();
+    blogc_stats_phase_t previous = stats.current;
+    stats.current = phase;
+    stats.phases[phase].calls++;
+    return previous;
+}
+
+
+void
+blogc_stats_pop(blogc_stats_phase_t previous)
+{
+    if (!stats.enabled)
+        return;
+    blogc_stats_account();
+    stats.current = previous;
+}
+
+
+void
+blogc_stats_set_sources(size_t sources)
+{
+    stats.sources = sources;
+}
+
+
+void
+blogc_stats_set_output_bytes(size_t output_bytes)
+{
+    stats.output_bytes = output_bytes;
+}
+
+
+void
+blogc_stats_print(bool json)
+{
+    if (!stats.enabled)
+        return;
+
+    blogc_stats_account();
+
+    blogc_stats_entry_t total = {0, 0, 0, 0, 0};
+    total.wall = stats.mark.wall - stats.start.wall;
+    total.cpu = stats.mark.cpu - stats.start.cpu;
+    for (size_t i = 0; i < BLOGC_STATS_LAST; i++) {
+        total.allocs += stats.phases[i].allocs;
+        total.bytes += stats.phases[i].bytes;
+    }
+
+    if (json) {
+        fprintf(stderr, "{\"phases\": {");
+        for (size_t i = 1; i < BLOGC_STATS_LAST; i++) {
+            blogc_stats_entry_t *e = &(stats.phases[i]);
+            fprintf(stderr, "%s\"%s\": {\"calls\": %zu, \"wall_ms\": %.3f, "
+                "\"cpu_ms\": %.3f, \"allocs\": %zu, \"alloc_bytes\": %zu}",
+                i > 1 ? ", " : "", phase_names[i], e->calls, e->wall, e->cpu,
+                e->allocs, e->bytes);
+        }
+        fprintf(stderr, "}, \"total\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+            "\"allocs\": %zu, \"alloc_bytes\": %zu}, \"sources\": %zu, "
+            "\"output_bytes\": %zu, \"peak_bytes\": %zu}\n", total.wall,
+            total.cpu, total.allocs, total.bytes, stats.sources,
+            stats.output_bytes, stats.peak_bytes);
+        return;
+    }
+
+    fprintf(stderr,
+        "blogc: stats:\n"
+        "    %-16s %6s %12s %12s %10s %14s\n", "phase", "calls", "wall (ms)",
+        "cpu (ms)", "allocs", "alloc bytes");
+    for (size_t i = 1; i < BLOGC_STATS_LAST; i++) {
+        blogc_stats_entry_t *e = &(stats.phases[i]);
+        fprintf(stderr, "    %-16s %6zu %12.3f %12.3f %10zu %14zu\n",
+            phase_names[i], e->calls, e->wall, e->cpu, e->allocs, e->bytes);
+    }
+    fprintf(stderr,
+        "    %-16s %6s %12.3f %12.3f %10zu %14zu\n"
+        "\n"
+        "    sources:       %zu\n"
+        "    output bytes:  %zu\n"
+        "    peak bytes:    %zu\n", "total", "", total.wall, total.cpu,
+        total.allocs, total.bytes, stats.sources, stats.output_bytes,
+        stats.peak_bytes);
+}
@@ -0,0 +1,34 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    BLOGC_STATS_NONE = 0,
+    BLOGC_STATS_READ,
+    BLOGC_STATS_SOURCE_PARSE,
+    BLOGC_STATS_CONTENT_PARSE,
+    BLOGC_STATS_TEMPLATE_PARSE,
+    BLOGC_STATS_RENDER,
+    BLOGC_STATS_WRITE,
+    BLOGC_STATS_LAST,
+} blogc_stats_phase_t;
+
+void blogc_stats_enable(void);
+bool blogc_stats_enabled(void);
+blogc_stats_phase_t blogc_stats_push(blogc_stats_phase_t phase);
+void blogc_stats_pop(blogc_stats_phase_t previous);
+void blogc_stats_set_sources(size_t sources);
+void blogc_stats_set_output_bytes(size_t output_bytes);
+void blogc_stats_print(bool json);
+
+#endif /* _STATS_H */
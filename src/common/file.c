@@ -6,11 +6,16 @@
  * See the file LICENSE.
  */
 
+#include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "file.h"
 #include "error.h"
 #include "utf8.h"
@@ -64,3 +69,138 @@ bc_file_get_contents(const char *path, bool utf8, size_t *len, bc_error_t **err)
 
     return bc_string_free(str, false);
 }
+
+
+uint64_t
+bc_file_get_hash(const char *path, bc_error_t **err)
+{
+    if (path == NULL || err == NULL || *err != NULL)
+        return 0;
+
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        int tmp_errno = errno;
+        *err = bc_error_new_printf(BC_ERROR_FILE,
+            "Failed to open file (%s): %s", path, strerror(tmp_errno));
+        return 0;
+    }
+
+    uint64_t rv = BC_HASH_INIT;
+    char buffer[BC_FILE_CHUNK_SIZE];
+
+    while (!feof(fp)) {
+        size_t read_len = fread(buffer, sizeof(char), BC_FILE_CHUNK_SIZE, fp);
+        if (ferror(fp)) {
+            int tmp_errno = errno;
+            *err = bc_error_new_printf(BC_ERROR_FILE,
+                "Failed to read file (%s): %s", path, strerror(tmp_errno));
+            fclose(fp);
+            return 0;
+        }
+        rv = bc_hash(rv, buffer, read_len);
+    }
+    fclose(fp);
+
+    return rv;
+}
+
+
+int
+bc_file_open_temp(const char *path, char **tmp_path, bc_error_t **err)
+{
+    // creates a temporary file in the same directory of path, to be renamed
+    // to path later. the file is created with open() instead of mkstemp(),
+    // so the kernel applies the umask to its permissions, like fopen() does.
+    // reading the umask requires changing it for the whole process, what
+    // isn't safe when called from several threads.
+    if (path == NULL || tmp_path == NULL || err == NULL || *err != NULL)
+        return -1;
+
+    uint32_t seed = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16) ^
+        (uint32_t) (uintptr_t) tmp_path;
+    int fd = -1;
+    int tmp_errno = 0;
+    *tmp_path = NULL;
+    for (size_t i = 0; i < 100; i++) {
+        seed = seed * 1103515245 + 12345;
+        free(*tmp_path);
+        *tmp_path = bc_strdup_printf("%s.%06x", path, (seed >> 8) & 0xffffff);
+        fd = open(*tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd >= 0)
+            return fd;
+        tmp_errno = errno;
+        if (tmp_errno != EEXIST)
+            break;
+    }
+
+    *err = bc_error_new_printf(BC_ERROR_FILE,
+        "Failed to create temporary file (%s): %s", *tmp_path,
+        strerror(tmp_errno));
+    free(*tmp_path);
+    *tmp_path = NULL;
+    return -1;
+}
+
+
+bool
+bc_file_write_if_changed(const char *path, const char *content, size_t len,
+    bc_error_t **err)
+{
+    // returns true if the file was written. files with the same content are
+    // left untouched, to keep their modification times. changed files are
+    // replaced atomically.
+    if (path == NULL || err == NULL || *err != NULL)
+        return false;
+
+    if (content == NULL)
+        content = "";
+
+    struct stat buf;
+    if (0 == stat(path, &buf) && S_ISREG(buf.st_mode) &&
+        (size_t) buf.st_size == len)
+    {
+        bc_error_t *tmp_err = NULL;
+        size_t cur_len;
+        char *cur = bc_file_get_contents(path, false, &cur_len, &tmp_err);
+        if (tmp_err == NULL) {
+            bool equal = cur_len == len && 0 == memcmp(cur, content, len);
+            free(cur);
+            if (equal)
+                return false;
+        }
+        bc_error_free(tmp_err);
+    }
+
+    char *tmp_path = NULL;
+    int fd = bc_file_open_temp(path, &tmp_path, err);
+    if (fd < 0)
+        return false;
+
+    const char *ptr = content;
+    size_t remaining = len;
+    while (remaining > 0) {
+        ssize_t nwritten = write(fd, ptr, remaining);
+        if (nwritten < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        ptr += nwritten;
+        remaining -= nwritten;
+    }
+
+    if (remaining > 0 || 0 != close(fd) || 0 != rename(tmp_path, path)) {
+        int tmp_errno = errno;
+        *err = bc_error_new_printf(BC_ERROR_FILE,
+            "Failed to write file (%s): %s", path, strerror(tmp_errno));
+        if (remaining > 0)
+            close(fd);
+        unlink(tmp_path);
+        free(tmp_path);
+        return false;
+    }
+
+    free(tmp_path);
+    return true;
+}
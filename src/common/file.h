@@ -11,10 +11,15 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "error.h"
 
 #define BC_FILE_CHUNK_SIZE 1024
 
 char* bc_file_get_contents(const char *path, bool utf8, size_t *len, bc_error_t **err);
+uint64_t bc_file_get_hash(const char *path, bc_error_t **err);
+int bc_file_open_temp(const char *path, char **tmp_path, bc_error_t **err);
+bool bc_file_write_if_changed(const char *path, const char *content, size_t len,
+    bc_error_t **err);
 
 #endif /* _FILE_H */
@@ -6,6 +6,14 @@
  * See the file LICENSE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#ifdef HAVE_MALLOC_H
+#include <malloc.h>
+#endif /* HAVE_MALLOC_H */
+
 #define BC_STRING_CHUNK_SIZE 128
 
 #include <string.h>
@@ -16,11 +24,46 @@
 
 #include "utils.h"
 
+// allocation counters are only enabled by single-threaded callers (blogc
+// --stats), so there's no locking here.
+static bool alloc_stats_enabled = false;
+static bc_alloc_stats_t alloc_stats = {0, 0, 0};
+
+
+static inline void
+bc_alloc_stats_account(size_t size, bool realloc)
+{
+    if (!alloc_stats_enabled)
+        return;
+    if (realloc)
+        alloc_stats.reallocs++;
+    else
+        alloc_stats.allocs++;
+    alloc_stats.bytes += size;
+}
+
+
+void
+bc_alloc_stats_enable(bool enable)
+{
+    alloc_stats_enabled = enable;
+}
+
+
+void
+bc_alloc_stats_get(bc_alloc_stats_t *stats)
+{
+    if (stats == NULL)
+        return;
+    *stats = alloc_stats;
+}
+
 
 void*
 bc_malloc(size_t size)
 {
     // simple things simple!
+    bc_alloc_stats_account(size, false);
     void *rv = malloc(size);
     if (rv == NULL) {
         fprintf(stderr, "fatal: Failed to allocate memory!\n");
@@ -34,6 +77,15 @@ void*
 bc_realloc(void *ptr, size_t size)
 {
     // simple things even simpler :P
+    if (alloc_stats_enabled) {
+        // strings grow in small steps, only the growth is new memory.
+        size_t old_size = 0;
+#ifdef HAVE_MALLOC_USABLE_SIZE
+        if (ptr != NULL)
+            old_size = malloc_usable_size(ptr);
+#endif /* HAVE_MALLOC_USABLE_SIZE */
+        bc_alloc_stats_account(size > old_size ? size - old_size : 0, true);
+    }
     void *rv = realloc(ptr, size);
     if (rv == NULL && size != 0) {
         fprintf(stderr, "fatal: Failed to reallocate memory!\n");
@@ -111,6 +163,7 @@ bc_strdup(const char *s)
     if (s == NULL)
         return NULL;
     size_t l = strlen(s);
+    bc_alloc_stats_account(l + 1, false);
     char *tmp = malloc(l + 1);
     if (tmp == NULL)
         return NULL;
@@ -125,6 +178,7 @@ bc_strndup(const char *s, size_t n)
     if (s == NULL)
         return NULL;
     size_t l = strnlen(s, n);
+    bc_alloc_stats_account(l + 1, false);
     char *tmp = malloc(l + 1);
     if (tmp == NULL)
         return NULL;
@@ -143,6 +197,7 @@ bc_strdup_vprintf(const char *format, va_list ap)
     va_end(ap2);
     if (l < 0)
         return NULL;
+    bc_alloc_stats_account(l + 1, false);
     char *tmp = malloc(l + 1);
     if (!tmp)
         return NULL;
@@ -643,6 +698,21 @@ bc_trie_foreach(bc_trie_t *trie, bc_trie_foreach_func_t func,
 }
 
 
+uint64_t
+bc_hash(uint64_t hash, const void *data, size_t len)
+{
+    // 64 bits fnv-1a. this is not a cryptographic hash, it is only used to
+    // detect content changes. to hash several chunks, pass the result of the
+    // previous call as the initial value of the next one.
+    const unsigned char *d = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= d[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
 char*
 bc_shell_quote(const char *command)
 {
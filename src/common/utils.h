@@ -12,6 +12,7 @@
 #include <stddef.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
 // memory
@@ -21,6 +22,15 @@ typedef void (*bc_free_func_t) (void *ptr);
 void* bc_malloc(size_t size);
 void* bc_realloc(void *ptr, size_t size);
 
+typedef struct {
+    size_t allocs;
+    size_t reallocs;
+    size_t bytes;
+} bc_alloc_stats_t;
+
+void bc_alloc_stats_enable(bool enable);
+void bc_alloc_stats_get(bc_alloc_stats_t *stats);
+
 
 // slist
 
@@ -100,6 +110,13 @@ void bc_trie_foreach(bc_trie_t *trie, bc_trie_foreach_func_t func,
     void *user_data);
 
 
+// hash
+
+#define BC_HASH_INIT 0xcbf29ce484222325ULL
+
+uint64_t bc_hash(uint64_t hash, const void *data, size_t len);
+
+
 // shell
 
 char* bc_shell_quote(const char *command);
@@ -0,0 +1,455 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../src/blogc/content-parser.h"
+#include "../../src/blogc/loader.h"
+#include "../../src/blogc/renderer.h"
+#include "../../src/blogc/source-parser.h"
+#include "../../src/blogc/template-parser.h"
+#include "../../src/common/error.h"
+#include "../../src/common/utils.h"
+#include "corpus.h"
+
+// the numbers reported are the best of all the repetitions, that is the
+// most stable measure we can get without a quiet machine.
+
+typedef struct {
+    bb_corpus_settings_t *settings;
+    char **sources;
+    char **contents;
+    char *template;
+    bc_slist_t *tmpl;
+    bc_slist_t *parsed;
+    bc_trie_t *config;
+    char *dir;
+} bb_ctx_t;
+
+typedef size_t (*bb_func_t) (bb_ctx_t *ctx, size_t *bytes);
+
+
+static double
+bb_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static size_t
+bench_source_parse(bb_ctx_t *ctx, size_t *bytes)
+{
+    for (unsigned int i = 0; i < ctx->settings->posts; i++) {
+        size_t len = strlen(ctx->sources[i]);
+        bc_error_t *err = NULL;
+        bc_trie_t *t = blogc_source_parse(ctx->sources[i], len, &err);
+        if (err != NULL) {
+            bc_error_print(err, "blogc-bench");
+            bc_error_free(err);
+            exit(3);
+        }
+        bc_trie_free(t);
+        *bytes += len;
+    }
+    return ctx->settings->posts;
+}
+
+
+static size_t
+bench_content_parse(bb_ctx_t *ctx, size_t *bytes)
+{
+    for (unsigned int i = 0; i < ctx->settings->posts; i++) {
+        size_t end_excerpt = 0;
+        char *first_header = NULL;
+        char *description = NULL;
+        free(blogc_content_parse(ctx->contents[i], &end_excerpt, &first_header,
+            &description));
+        free(first_header);
+        free(description);
+        *bytes += strlen(ctx->contents[i]);
+    }
+    return ctx->settings->posts;
+}
+
+
+static size_t
+bench_template_parse(bb_ctx_t *ctx, size_t *bytes)
+{
+    size_t len = strlen(ctx->template);
+    for (unsigned int i = 0; i < ctx->settings->posts; i++) {
+        bc_error_t *err = NULL;
+        bc_slist_t *t = blogc_template_parse(ctx->template, len, &err);
+        if (err != NULL) {
+            bc_error_print(err, "blogc-bench");
+            bc_error_free(err);
+            exit(3);
+        }
+        blogc_template_free_stmts(t);
+        *bytes += len;
+    }
+    return ctx->settings->posts;
+}
+
+
+static size_t
+bench_render_entry(bb_ctx_t *ctx, size_t *bytes)
+{
+    size_t rv = 0;
+    for (bc_slist_t *tmp = ctx->parsed; tmp != NULL; tmp = tmp->next) {
+        bc_slist_t l = {.next = NULL, .data = tmp->data};
+        char *out = blogc_render(ctx->tmpl, &l, ctx->config, false);
+        *bytes += strlen(out);
+        free(out);
+        rv++;
+    }
+    return rv;
+}
+
+
+static size_t
+bench_render_listing(bb_ctx_t *ctx, size_t *bytes)
+{
+    // render pages with 10 posts, like blogc-make does by default.
+    size_t rv = 0;
+    bc_slist_t *tmp = ctx->parsed;
+    while (tmp != NULL) {
+        bc_slist_t *page = NULL;
+        for (unsigned int i = 0; i < 10 && tmp != NULL; i++, tmp = tmp->next)
+            page = bc_slist_append(page, tmp->data);
+        char *out = blogc_render(ctx->tmpl, page, ctx->config, true);
+        *bytes += strlen(out);
+        free(out);
+        bc_slist_free(page);
+        rv++;
+    }
+    return rv;
+}
+
+
+static size_t
+bench_loader(bb_ctx_t *ctx, size_t *bytes)
+{
+    bc_slist_t *files = NULL;
+    for (unsigned int i = 0; i < ctx->settings->posts; i++) {
+        files = bc_slist_append(files, bc_strdup_printf(
+            "%s/content/post/post%05u.txt", ctx->dir, i + 1));
+        *bytes += strlen(ctx->sources[i]);
+    }
+
+    bc_trie_t *config = bc_trie_new(free);
+    bc_trie_insert(config, "FILTER_PAGE", bc_strdup("1"));
+    bc_trie_insert(config, "FILTER_PER_PAGE", bc_strdup("10"));
+
+    bc_error_t *err = NULL;
+    bc_slist_t *l = blogc_source_parse_from_files(config, files, &err);
+    if (err != NULL) {
+        bc_error_print(err, "blogc-bench");
+        bc_error_free(err);
+        exit(3);
+    }
+
+    bc_slist_free_full(l, (bc_free_func_t) bc_trie_free);
+    bc_slist_free_full(files, free);
+    bc_trie_free(config);
+    return ctx->settings->posts;
+}
+
+
+static size_t
+bench_make(bb_ctx_t *ctx, bool rebuild)
+{
+    const char *blogc_make = getenv("BLOGC_MAKE");
+
+    char *cmd = bc_strdup_printf("rm -rf '%s/_build'", ctx->dir);
+    if (!rebuild && 0 != system(cmd)) {
+        fprintf(stderr, "blogc-bench: error: failed to clean output "
+            "directory\n");
+        exit(3);
+    }
+    free(cmd);
+
+    cmd = bc_strdup_printf("OUTPUT_DIR='%s/_build' '%s' -f '%s/blogcfile' "
+        "> /dev/null", ctx->dir, blogc_make, ctx->dir);
+    if (0 != system(cmd)) {
+        fprintf(stderr, "blogc-bench: error: blogc-make failed: %s\n", cmd);
+        exit(3);
+    }
+    free(cmd);
+
+    return ctx->settings->posts;
+}
+
+
+static size_t
+bench_make_build(bb_ctx_t *ctx, size_t *bytes)
+{
+    return bench_make(ctx, false);
+}
+
+
+static size_t
+bench_make_rebuild(bb_ctx_t *ctx, size_t *bytes)
+{
+    return bench_make(ctx, true);
+}
+
+
+static void
+bb_run(bb_ctx_t *ctx, const char *name, bb_func_t func, unsigned int repeat)
+{
+    double best = -1;
+    size_t ops = 0;
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < repeat; i++) {
+        bytes = 0;
+        double start = bb_now();
+        ops = func(ctx, &bytes);
+        double elapsed = bb_now() - start;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    if (best <= 0)
+        best = 1e-9;
+
+    printf("%-16s %8zu %12.3f %12.3f", name, ops, best * 1e3,
+        ops > 0 ? (best * 1e6) / ops : 0);
+    if (bytes > 0)
+        printf(" %10.2f", (bytes / (1024.0 * 1024.0)) / best);
+    printf("\n");
+    fflush(stdout);
+}
+
+
+static void
+print_help(void)
+{
+    printf(
+        "usage:\n"
+        "    blogc-bench [-h] [-n POSTS] [-s SIZE] [-t TAGS] [-f FEATURES]\n"
+        "                [-c COMPLEXITY] [-r REPEAT] [-S SEED] [-o DIR]\n"
+        "                - A benchmark for blogc, using a synthetic website.\n"
+        "\n"
+        "optional arguments:\n"
+        "    -h            show this help message and exit\n"
+        "    -n POSTS      number of posts (default: 500)\n"
+        "    -s SIZE       number of markdown blocks per post (default: 20)\n"
+        "    -t TAGS       number of tags (default: 20)\n"
+        "    -f FEATURES   comma-separated list of markdown features to use:\n"
+        "                  headers, lists, code, quotes, hr, emphasis, links,\n"
+        "                  images, all or none (default: all)\n"
+        "    -c COMPLEXITY number of extra template sections (default: 4)\n"
+        "    -r REPEAT     number of repetitions of each benchmark, the best\n"
+        "                  one is reported (default: 5)\n"
+        "    -S SEED       seed for the random generator (default: 1)\n"
+        "    -o DIR        directory to write the synthetic website to\n"
+        "                  (default: temporary directory)\n"
+        "\n"
+        "environment variables:\n"
+        "    BLOGC_MAKE    path to blogc-make binary. full builds are only\n"
+        "                  benchmarked if set\n");
+}
+
+
+static bool
+parse_uint(const char *str, unsigned int *val)
+{
+    if (str == NULL)
+        return false;
+    char *endptr;
+    errno = 0;
+    unsigned long v = strtoul(str, &endptr, 10);
+    if (errno != 0 || *endptr != '\0' || endptr == str || v > UINT32_MAX)
+        return false;
+    *val = v;
+    return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int rv = 0;
+
+    bb_corpus_settings_t settings = {
+        .posts = 500,
+        .post_size = 20,
+        .tags = 20,
+        .features = BB_FEATURE_ALL,
+        .template_complexity = 4,
+        .seed = 1,
+    };
+    unsigned int repeat = 5;
+    unsigned int seed = 1;
+    const char *features = "all";
+    char *dir = NULL;
+    bool remove_dir = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0') {
+            print_help();
+            fprintf(stderr, "blogc-bench: error: invalid argument: %s\n",
+                argv[i]);
+            return 3;
+        }
+        if (argv[i][1] == 'h') {
+            print_help();
+            return 0;
+        }
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[++i] : NULL;
+        bool ok = true;
+        switch (arg[1]) {
+            case 'n':
+                ok = parse_uint(val, &settings.posts) && settings.posts > 0;
+                break;
+            case 's':
+                ok = parse_uint(val, &settings.post_size) &&
+                    settings.post_size > 0;
+                break;
+            case 't':
+                ok = parse_uint(val, &settings.tags);
+                break;
+            case 'f':
+                features = val;
+                ok = bb_corpus_parse_features(val, &settings.features);
+                break;
+            case 'c':
+                ok = parse_uint(val, &settings.template_complexity);
+                break;
+            case 'r':
+                ok = parse_uint(val, &repeat) && repeat > 0;
+                break;
+            case 'S':
+                ok = parse_uint(val, &seed);
+                settings.seed = seed;
+                break;
+            case 'o':
+                ok = val != NULL;
+                if (ok) {
+                    free(dir);
+                    dir = bc_strdup(val);
+                }
+                break;
+            default:
+                ok = false;
+        }
+        if (!ok) {
+            print_help();
+            fprintf(stderr, "blogc-bench: error: invalid value for argument: "
+                "%s\n", arg);
+            free(dir);
+            return 3;
+        }
+    }
+
+    if (dir == NULL) {
+        const char *tmpdir = getenv("TMPDIR");
+        dir = bc_strdup_printf("%s/blogc-bench-XXXXXX",
+            tmpdir != NULL ? tmpdir : "/tmp");
+        if (NULL == mkdtemp(dir)) {
+            fprintf(stderr, "blogc-bench: error: failed to create temporary "
+                "directory (%s): %s\n", dir, strerror(errno));
+            free(dir);
+            return 3;
+        }
+        remove_dir = true;
+    }
+
+    bb_ctx_t ctx = {
+        .settings = &settings,
+        .sources = bc_malloc(settings.posts * sizeof(char*)),
+        .contents = bc_malloc(settings.posts * sizeof(char*)),
+        .template = bb_corpus_template(&settings),
+        .tmpl = NULL,
+        .parsed = NULL,
+        .config = bc_trie_new(free),
+        .dir = dir,
+    };
+
+    size_t corpus_bytes = 0;
+    for (unsigned int i = 0; i < settings.posts; i++) {
+        ctx.sources[i] = bb_corpus_source(&settings, i);
+        ctx.contents[i] = bb_corpus_content(&settings, i);
+        corpus_bytes += strlen(ctx.sources[i]);
+    }
+
+    if (!bb_corpus_write(&settings, dir)) {
+        rv = 3;
+        goto cleanup;
+    }
+
+    bc_trie_insert(ctx.config, "SITE_TITLE", bc_strdup("Benchmark"));
+    bc_trie_insert(ctx.config, "SITE_TAGLINE", bc_strdup("A synthetic website"));
+    bc_trie_insert(ctx.config, "AUTHOR_NAME", bc_strdup("Benchmark"));
+    bc_trie_insert(ctx.config, "BASE_URL", bc_strdup(""));
+    bc_trie_insert(ctx.config, "MAKE_TYPE", bc_strdup("post"));
+    bc_trie_insert(ctx.config, "DATE_FORMAT", bc_strdup("%b %d, %Y"));
+
+    bc_error_t *err = NULL;
+    ctx.tmpl = blogc_template_parse(ctx.template, strlen(ctx.template), &err);
+    for (unsigned int i = 0; err == NULL && i < settings.posts; i++)
+        ctx.parsed = bc_slist_append(ctx.parsed, blogc_source_parse(
+            ctx.sources[i], strlen(ctx.sources[i]), &err));
+    if (err != NULL) {
+        bc_error_print(err, "blogc-bench");
+        bc_error_free(err);
+        rv = 3;
+        goto cleanup;
+    }
+
+    printf("posts: %u, size: %u, tags: %u, features: %s, complexity: %u, "
+        "seed: %u, repeat: %u\n", settings.posts, settings.post_size,
+        settings.tags, features, settings.template_complexity, seed, repeat);
+    printf("corpus: %s (%zu bytes of sources)\n\n", dir, corpus_bytes);
+    printf("%-16s %8s %12s %12s %10s\n", "benchmark", "ops", "best (ms)",
+        "us/op", "MiB/s");
+
+    bb_run(&ctx, "source_parse", bench_source_parse, repeat);
+    bb_run(&ctx, "content_parse", bench_content_parse, repeat);
+    bb_run(&ctx, "template_parse", bench_template_parse, repeat);
+    bb_run(&ctx, "render_entry", bench_render_entry, repeat);
+    bb_run(&ctx, "render_listing", bench_render_listing, repeat);
+    bb_run(&ctx, "loader", bench_loader, repeat);
+
+    if (getenv("BLOGC_MAKE") != NULL) {
+        bb_run(&ctx, "make_build", bench_make_build, repeat);
+        bb_run(&ctx, "make_rebuild", bench_make_rebuild, repeat);
+    }
+
+cleanup:
+    for (unsigned int i = 0; i < settings.posts; i++) {
+        free(ctx.sources[i]);
+        free(ctx.contents[i]);
+    }
+    free(ctx.sources);
+    free(ctx.contents);
+    free(ctx.template);
+    blogc_template_free_stmts(ctx.tmpl);
+    bc_slist_free_full(ctx.parsed, (bc_free_func_t) bc_trie_free);
+    bc_trie_free(ctx.config);
+    if (remove_dir) {
+        char *cmd = bc_strdup_printf("rm -rf '%s'", dir);
+        if (0 != system(cmd))
+            fprintf(stderr, "blogc-bench: warning: failed to remove temporary "
+                "directory: %s\n", dir);
+        free(cmd);
+    }
+    free(dir);
+    return rv;
+}
@@ -0,0 +1,467 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "../../src/common/utils.h"
+#include "corpus.h"
+
+// everything generated here must be deterministic for a given set of
+// settings, otherwise numbers can't be compared between commits. each post
+// has its own random generator, seeded from the global seed and the post
+// index, so the content of a post does not depend on the other posts.
+
+static const char *words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+    "et", "dolore", "magna", "aliqua", "enim", "ad", "minim", "veniam",
+    "quis", "nostrud", "exercitation", "ullamco", "laboris", "nisi",
+    "aliquip", "ex", "ea", "commodo", "consequat", "duis", "aute", "irure",
+    "in", "reprehenderit", "voluptate", "velit", "esse", "cillum", "fugiat",
+    "nulla", "pariatur", "excepteur", "sint", "occaecat", "cupidatat", "non",
+    "proident", "sunt", "culpa", "qui", "officia", "deserunt", "mollit",
+    "anim", "id", "est", "laborum", "blogc", "compiler",
+};
+
+#define WORDS_LEN (sizeof(words) / sizeof(words[0]))
+
+static const struct feature_map {
+    const char *name;
+    bb_feature_t feature;
+} features_map[] = {
+    {"headers", BB_FEATURE_HEADERS},
+    {"lists", BB_FEATURE_LISTS},
+    {"code", BB_FEATURE_CODE},
+    {"quotes", BB_FEATURE_QUOTES},
+    {"hr", BB_FEATURE_HR},
+    {"emphasis", BB_FEATURE_EMPHASIS},
+    {"links", BB_FEATURE_LINKS},
+    {"images", BB_FEATURE_IMAGES},
+    {"all", BB_FEATURE_ALL},
+    {"none", 0},
+    {NULL, 0},
+};
+
+
+static uint32_t
+rng_next(uint32_t *state)
+{
+    // xorshift32
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+
+static unsigned int
+rng_range(uint32_t *state, unsigned int min, unsigned int max)
+{
+    return min + (rng_next(state) % (max - min + 1));
+}
+
+
+static uint32_t
+rng_seed(uint32_t seed, unsigned int index)
+{
+    uint32_t rv = (seed * 2654435761u) ^ ((index + 1) * 2246822519u);
+    return rv == 0 ? 1 : rv;
+}
+
+
+static void
+append_words(bc_string_t *str, uint32_t *rng, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        if (i > 0)
+            bc_string_append_c(str, ' ');
+        bc_string_append(str, words[rng_next(rng) % WORDS_LEN]);
+    }
+}
+
+
+static void
+append_paragraph(bc_string_t *str, uint32_t *rng, unsigned int features)
+{
+    unsigned int count = rng_range(rng, 30, 80);
+    for (unsigned int i = 0; i < count; i++) {
+        if (i > 0)
+            bc_string_append_c(str, (i % 12) == 0 ? '\n' : ' ');
+        const char *w = words[rng_next(rng) % WORDS_LEN];
+        switch (rng_next(rng) % 16) {
+            case 0:
+                if (features & BB_FEATURE_EMPHASIS) {
+                    bc_string_append_printf(str, "*%s*", w);
+                    continue;
+                }
+                break;
+            case 1:
+                if (features & BB_FEATURE_EMPHASIS) {
+                    bc_string_append_printf(str, "**%s**", w);
+                    continue;
+                }
+                break;
+            case 2:
+                if (features & BB_FEATURE_EMPHASIS) {
+                    bc_string_append_printf(str, "`%s()`", w);
+                    continue;
+                }
+                break;
+            case 3:
+                if (features & BB_FEATURE_LINKS) {
+                    bc_string_append_printf(str, "[%s](http://example.org/%s/)",
+                        w, w);
+                    continue;
+                }
+                break;
+            case 4:
+                if (features & BB_FEATURE_IMAGES) {
+                    bc_string_append_printf(str, "![%s](/images/%s.png)", w, w);
+                    continue;
+                }
+                break;
+        }
+        bc_string_append(str, w);
+    }
+    bc_string_append_c(str, '\n');
+}
+
+
+char*
+bb_corpus_tag(unsigned int index)
+{
+    return bc_strdup_printf("tag%u", index + 1);
+}
+
+
+bool
+bb_corpus_parse_features(const char *str, unsigned int *features)
+{
+    if (str == NULL || features == NULL)
+        return false;
+
+    unsigned int rv = 0;
+    char **pieces = bc_str_split(str, ',', 0);
+    for (size_t i = 0; pieces[i] != NULL; i++) {
+        char *f = bc_str_strip(pieces[i]);
+        if (f[0] == '\0')
+            continue;
+        size_t j;
+        for (j = 0; features_map[j].name != NULL; j++) {
+            if (0 == strcmp(f, features_map[j].name)) {
+                rv |= features_map[j].feature;
+                break;
+            }
+        }
+        if (features_map[j].name == NULL) {
+            bc_strv_free(pieces);
+            return false;
+        }
+    }
+    bc_strv_free(pieces);
+    *features = rv;
+    return true;
+}
+
+
+char*
+bb_corpus_content(bb_corpus_settings_t *settings, unsigned int index)
+{
+    if (settings == NULL)
+        return NULL;
+
+    uint32_t rng = rng_seed(settings->seed, index);
+    unsigned int f = settings->features;
+
+    bc_string_t *rv = bc_string_new();
+
+    for (unsigned int i = 0; i < settings->post_size; i++) {
+        if (i > 0)
+            bc_string_append_c(rv, '\n');
+
+        // the first block is always a paragraph, to generate a description
+        unsigned int block = i == 0 ? 0 : rng_next(&rng) % 10;
+
+        switch (block) {
+            case 1:
+                if (f & BB_FEATURE_HEADERS) {
+                    for (unsigned int j = rng_range(&rng, 1, 3); j > 0; j--)
+                        bc_string_append_c(rv, '#');
+                    bc_string_append_c(rv, ' ');
+                    append_words(rv, &rng, rng_range(&rng, 2, 6));
+                    bc_string_append_c(rv, '\n');
+                    continue;
+                }
+                break;
+            case 2:
+                if (f & BB_FEATURE_LISTS) {
+                    for (unsigned int j = rng_range(&rng, 3, 8); j > 0; j--) {
+                        bc_string_append(rv, "* ");
+                        append_words(rv, &rng, rng_range(&rng, 3, 10));
+                        bc_string_append_c(rv, '\n');
+                    }
+                    continue;
+                }
+                break;
+            case 3:
+                if (f & BB_FEATURE_LISTS) {
+                    unsigned int count = rng_range(&rng, 3, 8);
+                    for (unsigned int j = 0; j < count; j++) {
+                        bc_string_append_printf(rv, "%u. ", j + 1);
+                        append_words(rv, &rng, rng_range(&rng, 3, 10));
+                        bc_string_append_c(rv, '\n');
+                    }
+                    continue;
+                }
+                break;
+            case 4:
+                if (f & BB_FEATURE_CODE) {
+                    for (unsigned int j = rng_range(&rng, 3, 12); j > 0; j--) {
+                        const char *w1 = words[rng_next(&rng) % WORDS_LEN];
+                        const char *w2 = words[rng_next(&rng) % WORDS_LEN];
+                        bc_string_append_printf(rv,
+                            "    if (%s < 10) { %s = \"<%s>\"; }\n", w1, w2,
+                            w1);
+                    }
+                    continue;
+                }
+                break;
+            case 5:
+                if (f & BB_FEATURE_QUOTES) {
+                    for (unsigned int j = rng_range(&rng, 2, 4); j > 0; j--) {
+                        bc_string_append(rv, "> ");
+                        append_words(rv, &rng, rng_range(&rng, 5, 15));
+                        bc_string_append_c(rv, '\n');
+                    }
+                    continue;
+                }
+                break;
+            case 6:
+                if (f & BB_FEATURE_HR) {
+                    bc_string_append(rv, "***\n");
+                    continue;
+                }
+                break;
+        }
+        append_paragraph(rv, &rng, f);
+    }
+
+    return bc_string_free(rv, false);
+}
+
+
+char*
+bb_corpus_source(bb_corpus_settings_t *settings, unsigned int index)
+{
+    if (settings == NULL)
+        return NULL;
+
+    // tags use a separated generator, so they don't change the content.
+    uint32_t rng = rng_seed(settings->seed ^ 0x5bd1e995, index);
+
+    bc_string_t *rv = bc_string_new();
+    bc_string_append_printf(rv,
+        "TITLE: Post %u\n"
+        "DATE: %04u-%02u-%02u %02u:%02u:00\n"
+        "AUTHOR: Author %u\n", index + 1, 2000 + (index / 336) % 100,
+        (index / 28) % 12 + 1, index % 28 + 1, index % 24, index % 60,
+        index % 7);
+
+    if (settings->tags > 0) {
+        bc_string_append(rv, "TAGS:");
+        for (unsigned int i = rng_range(&rng, 1, 3); i > 0; i--) {
+            char *tag = bb_corpus_tag(rng_next(&rng) % settings->tags);
+            bc_string_append_printf(rv, " %s", tag);
+            free(tag);
+        }
+        bc_string_append_c(rv, '\n');
+    }
+
+    bc_string_append(rv, "----------\n");
+
+    char *content = bb_corpus_content(settings, index);
+    bc_string_append(rv, content);
+    free(content);
+
+    return bc_string_free(rv, false);
+}
+
+
+char*
+bb_corpus_template(bb_corpus_settings_t *settings)
+{
+    if (settings == NULL)
+        return NULL;
+
+    bc_string_t *rv = bc_string_new();
+    bc_string_append(rv,
+        "<!DOCTYPE html>\n"
+        "<html>\n"
+        "  <head>\n"
+        "    <title>{% ifdef TITLE %}{{ TITLE }} - {% endif %}{{ SITE_TITLE }}"
+            "</title>\n"
+        "    {% ifdef DESCRIPTION %}<meta name=\"description\" "
+            "content=\"{{ DESCRIPTION }}\">{% endif %}\n"
+        "  </head>\n"
+        "  <body>\n"
+        "    <h1>{{ SITE_TITLE }}</h1>\n"
+        "    <h2>{{ SITE_TAGLINE }}</h2>\n"
+        "    {% block entry %}\n"
+        "    <h3>{{ TITLE }}</h3>\n"
+        "    <p>{{ DATE_FORMATTED }}</p>\n"
+        "    {{ CONTENT }}\n");
+
+    for (unsigned int i = 0; i < settings->template_complexity; i++) {
+        bc_string_append_printf(rv,
+            "    <div class=\"section-%u\">\n"
+            "      {%% ifdef TAGS %%}<ul>{%% foreach TAGS %%}"
+                "<li><a href=\"{{ BASE_URL }}/tag/{{ FOREACH_ITEM }}/\">"
+                "{{ FOREACH_ITEM }}</a></li>{%% endforeach %%}</ul>{%% endif %%}\n"
+            "      {%% if MAKE_TYPE == \"post\" %%}<p>{{ AUTHOR }}</p>"
+                "{%% else %%}<p>{{ AUTHOR_NAME }}</p>{%% endif %%}\n"
+            "      {%% ifndef MAKE_ENV_DEV %%}<p>{{ TITLE_%u }}</p>{%% endif %%}\n"
+            "    </div>\n", i, i);
+    }
+
+    bc_string_append(rv,
+        "    {% endblock %}\n"
+        "    {% block listing_once %}<ul>{% endblock %}\n"
+        "    {% block listing %}\n"
+        "    <li><a href=\"{{ BASE_URL }}/post/{{ FILENAME }}/\">{{ TITLE }}</a> "
+            "- {{ DATE_FORMATTED }}\n");
+
+    for (unsigned int i = 0; i < settings->template_complexity; i++) {
+        bc_string_append_printf(rv,
+            "      {%% ifdef TAGS %%}{%% foreach TAGS %%}<span>{{ FOREACH_ITEM }}"
+                "</span>{%% endforeach %%}{%% endif %%}\n"
+            "      {%% ifdef DESCRIPTION %%}<p class=\"d-%u\">{{ DESCRIPTION }}"
+                "</p>{%% endif %%}\n", i);
+    }
+
+    bc_string_append(rv,
+        "    </li>\n"
+        "    {% endblock %}\n"
+        "    {% block listing_once %}</ul>{% endblock %}\n"
+        "  </body>\n"
+        "</html>\n");
+
+    return bc_string_free(rv, false);
+}
+
+
+char*
+bb_corpus_blogcfile(bb_corpus_settings_t *settings)
+{
+    if (settings == NULL)
+        return NULL;
+
+    bc_string_t *rv = bc_string_new();
+    bc_string_append(rv,
+        "[global]\n"
+        "AUTHOR_NAME = Benchmark\n"
+        "AUTHOR_EMAIL = bench@example.org\n"
+        "SITE_TITLE = Benchmark\n"
+        "SITE_TAGLINE = A synthetic website\n"
+        "BASE_DOMAIN = http://example.org\n"
+        "\n"
+        "[settings]\n"
+        "posts_per_page = 10\n"
+        "\n"
+        "[posts]\n");
+
+    for (unsigned int i = 0; i < settings->posts; i++)
+        bc_string_append_printf(rv, "post%05u\n", i + 1);
+
+    if (settings->tags > 0) {
+        bc_string_append(rv, "\n[tags]\n");
+        for (unsigned int i = 0; i < settings->tags; i++) {
+            char *tag = bb_corpus_tag(i);
+            bc_string_append_printf(rv, "%s\n", tag);
+            free(tag);
+        }
+    }
+
+    return bc_string_free(rv, false);
+}
+
+
+static bool
+write_file(const char *dir, const char *filename, const char *content)
+{
+    char *path = bc_strdup_printf("%s/%s", dir, filename);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "blogc-bench: error: failed to open file (%s): %s\n",
+            path, strerror(errno));
+        free(path);
+        return false;
+    }
+    fputs(content, fp);
+    bool rv = 0 == fclose(fp);
+    if (!rv)
+        fprintf(stderr, "blogc-bench: error: failed to write file (%s): %s\n",
+            path, strerror(errno));
+    free(path);
+    return rv;
+}
+
+
+static bool
+make_dir(const char *dir, const char *name)
+{
+    char *path = bc_strdup_printf("%s/%s", dir, name);
+    bool rv = (0 == mkdir(path, 0777)) || (errno == EEXIST);
+    if (!rv)
+        fprintf(stderr, "blogc-bench: error: failed to create directory "
+            "(%s): %s\n", path, strerror(errno));
+    free(path);
+    return rv;
+}
+
+
+bool
+bb_corpus_write(bb_corpus_settings_t *settings, const char *dir)
+{
+    if (settings == NULL || dir == NULL)
+        return false;
+
+    if (!make_dir(dir, "templates") || !make_dir(dir, "content") ||
+        !make_dir(dir, "content/post"))
+        return false;
+
+    char *tmp = bb_corpus_blogcfile(settings);
+    bool rv = write_file(dir, "blogcfile", tmp);
+    free(tmp);
+    if (!rv)
+        return false;
+
+    tmp = bb_corpus_template(settings);
+    rv = write_file(dir, "templates/main.tmpl", tmp);
+    free(tmp);
+    if (!rv)
+        return false;
+
+    for (unsigned int i = 0; i < settings->posts; i++) {
+        char *fname = bc_strdup_printf("content/post/post%05u.txt", i + 1);
+        tmp = bb_corpus_source(settings, i);
+        rv = write_file(dir, fname, tmp);
+        free(tmp);
+        free(fname);
+        if (!rv)
+            return false;
+    }
+
+    return true;
+}
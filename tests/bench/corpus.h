@@ -0,0 +1,44 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifndef _BENCH_CORPUS_H
+#define _BENCH_CORPUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    BB_FEATURE_HEADERS  = 1 << 0,
+    BB_FEATURE_LISTS    = 1 << 1,
+    BB_FEATURE_CODE     = 1 << 2,
+    BB_FEATURE_QUOTES   = 1 << 3,
+    BB_FEATURE_HR       = 1 << 4,
+    BB_FEATURE_EMPHASIS = 1 << 5,
+    BB_FEATURE_LINKS    = 1 << 6,
+    BB_FEATURE_IMAGES   = 1 << 7,
+    BB_FEATURE_ALL      = (1 << 8) - 1,
+} bb_feature_t;
+
+typedef struct {
+    unsigned int posts;
+    unsigned int post_size;
+    unsigned int tags;
+    unsigned int features;
+    unsigned int template_complexity;
+    uint32_t seed;
+} bb_corpus_settings_t;
+
+bool bb_corpus_parse_features(const char *str, unsigned int *features);
+char* bb_corpus_tag(unsigned int index);
+char* bb_corpus_content(bb_corpus_settings_t *settings, unsigned int index);
+char* bb_corpus_source(bb_corpus_settings_t *settings, unsigned int index);
+char* bb_corpus_template(bb_corpus_settings_t *settings);
+char* bb_corpus_blogcfile(bb_corpus_settings_t *settings);
+bool bb_corpus_write(bb_corpus_settings_t *settings, const char *dir);
+
+#endif /* _BENCH_CORPUS_H */
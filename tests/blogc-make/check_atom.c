@@ -16,7 +16,6 @@
 
 #include "../../src/blogc-make/atom.h"
 #include "../../src/blogc-make/settings.h"
-#include "../../src/common/file.h"
 #include "../../src/common/error.h"
 #include "../../src/common/utils.h"
 
@@ -30,19 +29,10 @@ test_atom_file(void **state)
     bc_trie_insert(settings->settings, "atom_ext", bc_strdup(".xml"));
     bc_trie_insert(settings->settings, "post_prefix", bc_strdup("post"));
 
-    bc_error_t *err = NULL;
-    char *rv = bm_atom_deploy(settings, &err);
+    char *rv = bm_atom_generate(settings);
 
     assert_non_null(rv);
-    assert_null(err);
-
-    size_t cmp_len;
-    char *cmp = bc_file_get_contents(rv, true, &cmp_len, &err);
-
-    assert_non_null(cmp);
-    assert_null(err);
-
-    assert_string_equal(cmp,
+    assert_string_equal(rv,
         "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
         "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n"
         "  <title type=\"text\">{{ SITE_TITLE }}{% ifdef FILTER_TAG %} - "
@@ -74,8 +64,6 @@ test_atom_file(void **state)
         "  {% endblock %}\n"
         "</feed>\n");
 
-    free(cmp);
-    bm_atom_destroy(rv);
     free(rv);
     bc_trie_free(settings->settings);
     free(settings);
@@ -91,19 +79,10 @@ test_atom_dir(void **state)
     bc_trie_insert(settings->settings, "atom_ext", bc_strdup("/index.xml"));
     bc_trie_insert(settings->settings, "post_prefix", bc_strdup("post"));
 
-    bc_error_t *err = NULL;
-    char *rv = bm_atom_deploy(settings, &err);
+    char *rv = bm_atom_generate(settings);
 
     assert_non_null(rv);
-    assert_null(err);
-
-    size_t cmp_len;
-    char *cmp = bc_file_get_contents(rv, true, &cmp_len, &err);
-
-    assert_non_null(cmp);
-    assert_null(err);
-
-    assert_string_equal(cmp,
+    assert_string_equal(rv,
         "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
         "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n"
         "  <title type=\"text\">{{ SITE_TITLE }}{% ifdef FILTER_TAG %} - "
@@ -135,8 +114,6 @@ test_atom_dir(void **state)
         "  {% endblock %}\n"
         "</feed>\n");
 
-    free(cmp);
-    bm_atom_destroy(rv);
     free(rv);
     bc_trie_free(settings->settings);
     free(settings);
@@ -84,7 +84,7 @@ test_build_blogc_cmd_with_settings(void **state)
         "main.tmpl", "foo.html", false, true);
     assert_string_equal(rv,
         "LC_ALL='en_US.utf8' blogc -D FOO='BAR' -D BAR='BAZ' -D LOL='HEHE' -l "
-        "-t 'main.tmpl' -o 'foo.html' -i");
+        "-t 'main.tmpl' -o 'foo.html' --skip-unchanged -i");
     free(rv);
 
     rv = bm_exec_build_blogc_cmd("blogc", settings, variables, false, NULL, NULL,
@@ -93,6 +93,15 @@ test_build_blogc_cmd_with_settings(void **state)
         "LC_ALL='en_US.utf8' blogc -D FOO='BAR' -D BAR='BAZ' -D LOL='HEHE'");
     free(rv);
 
+    bc_trie_insert(settings->settings, "html_minify", bc_strdup("true"));
+    rv = bm_exec_build_blogc_cmd("blogc", settings, variables, false,
+        "main.tmpl", "foo.html", false, false);
+    assert_string_equal(rv,
+        "LC_ALL='en_US.utf8' blogc -D FOO='BAR' -D BAR='BAZ' -D LOL='HEHE' "
+        "-t 'main.tmpl' -o 'foo.html' --skip-unchanged --minify");
+    free(rv);
+    bc_trie_insert(settings->settings, "html_minify", bc_strdup("false"));
+
     rv = bm_exec_build_blogc_cmd("blogc", settings, NULL, false, NULL, NULL,
         false, false);
     assert_string_equal(rv,
@@ -122,7 +131,7 @@ test_build_blogc_cmd_with_settings_and_dev(void **state)
         "main.tmpl", "foo.html", true, true);
     assert_string_equal(rv,
         "LC_ALL='en_US.utf8' blogc -D FOO='BAR' -D BAR='BAZ' -D LOL='HEHE' "
-        "-D MAKE_ENV_DEV=1 -D MAKE_ENV='dev' -l -t 'main.tmpl' -o 'foo.html' -i");
+        "-D MAKE_ENV_DEV=1 -D MAKE_ENV='dev' -l -t 'main.tmpl' -o 'foo.html' --skip-unchanged -i");
     free(rv);
 
     rv = bm_exec_build_blogc_cmd("blogc", settings, variables, false, NULL, NULL,
@@ -155,7 +164,7 @@ test_build_blogc_cmd_without_settings(void **state)
     char *rv = bm_exec_build_blogc_cmd("blogc", NULL, variables, true,
         "main.tmpl", "foo.html", false, true);
     assert_string_equal(rv,
-        "blogc -D LOL='HEHE' -l -t 'main.tmpl' -o 'foo.html' -i");
+        "blogc -D LOL='HEHE' -l -t 'main.tmpl' -o 'foo.html' --skip-unchanged -i");
     free(rv);
 
     rv = bm_exec_build_blogc_cmd("blogc", NULL, variables, false, NULL, NULL,
@@ -0,0 +1,313 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../../src/blogc-make/state.h"
+#include "../../src/common/utils.h"
+
+#define HEADER "blogc-make-state\t2\t" PACKAGE_VERSION "\n"
+
+
+static void
+write_file(const char *path, const char *content)
+{
+    FILE *fp = fopen(path, "w");
+    assert_non_null(fp);
+    fputs(content, fp);
+    assert_int_equal(fclose(fp), 0);
+}
+
+
+static void
+test_state_parse(void **state)
+{
+    const char *a =
+        HEADER
+        "F\t00000000000000ff\t10\t1234\t5678\tcontent/foo.txt\n"
+        "T\tfoo bar\n"
+        "F\t00000000000000fe\t10\t1234\t5678\tcontent/bar.txt\n"
+        "O\t0000000000000abc\t20\t4321\t8765\tfoo/index.html\n"
+        "I\tblogcfile\n"
+        "I\tcontent/foo.txt\n"
+        "O\t0000000000000def\t30\t1111\t2222\tbar/index.html\n";
+    bm_state_t *s = bm_state_new("/proj", "/proj/_build");
+    assert_true(bm_state_parse(s, a, strlen(a)));
+    assert_int_equal(bc_trie_size(s->files), 2);
+    assert_int_equal(bc_trie_size(s->outputs), 2);
+    bm_state_file_t *f = bc_trie_lookup(s->files, "content/foo.txt");
+    assert_non_null(f);
+    assert_true(f->hash == 0xff);
+    assert_int_equal(f->size, 10);
+    assert_int_equal(f->tv_sec, 1234);
+    assert_int_equal(f->tv_nsec, 5678);
+    assert_string_equal(f->tags, "foo bar");
+    f = bc_trie_lookup(s->files, "content/bar.txt");
+    assert_non_null(f);
+    assert_true(f->hash == 0xfe);
+    assert_null(f->tags);
+    bm_state_output_t *o = bc_trie_lookup(s->outputs, "foo/index.html");
+    assert_non_null(o);
+    assert_true(o->key == 0xabc);
+    assert_int_equal(o->size, 20);
+    assert_int_equal(bc_slist_length(o->inputs), 2);
+    assert_string_equal(o->inputs->data, "blogcfile");
+    assert_string_equal(o->inputs->next->data, "content/foo.txt");
+    o = bc_trie_lookup(s->outputs, "bar/index.html");
+    assert_non_null(o);
+    assert_true(o->key == 0xdef);
+    assert_null(o->inputs);
+    assert_true(bm_state_has_output(s, "/proj/_build/bar/index.html"));
+    assert_false(bm_state_has_output(s, "/proj/_build/baz/index.html"));
+    bm_state_free(s);
+}
+
+
+static void
+test_state_parse_invalid(void **state)
+{
+    const char *a =
+        "blogc-make-state\t1\t0.0.0\n"
+        "O\t0000000000000abc\t20\t4321\t8765\tfoo/index.html\n";
+    bm_state_t *s = bm_state_new("/proj", "/proj/_build");
+    assert_false(bm_state_parse(s, a, strlen(a)));
+    assert_int_equal(bc_trie_size(s->outputs), 0);
+    a =
+        HEADER
+        "O\t0000000000000abc\t20\t4321\t8765\tfoo/index.html\n"
+        "O\tbola\t20\t4321\t8765\tbar/index.html\n";
+    assert_false(bm_state_parse(s, a, strlen(a)));
+    assert_int_equal(bc_trie_size(s->outputs), 0);
+    a =
+        HEADER
+        "I\tcontent/foo.txt\n";
+    assert_false(bm_state_parse(s, a, strlen(a)));
+    assert_false(bm_state_parse(s, "", 0));
+    bm_state_free(s);
+}
+
+
+static void
+test_state_dump(void **state)
+{
+    const char *a =
+        HEADER
+        "O\t0000000000000abc\t20\t4321\t8765\tfoo/index.html\n"
+        "I\tblogcfile\n"
+        "I\tcontent/foo.txt\n";
+    bm_state_t *s = bm_state_new("/proj", "/proj/_build");
+    assert_true(bm_state_parse(s, a, strlen(a)));
+    char *t = bm_state_dump(s);
+    assert_string_equal(t, a);
+    free(t);
+    bm_state_free(s);
+}
+
+
+static void
+test_state_prune(void **state)
+{
+    const char *a =
+        HEADER
+        "O\t0000000000000abc\t20\t4321\t8765\tfoo/index.html\n"
+        "O\t0000000000000def\t30\t1111\t2222\tbar/index.html\n"
+        "O\t0000000000000123\t30\t1111\t2222\tbaz/index.html\n";
+    bm_state_t *s = bm_state_new("/proj", "/proj/_build");
+    assert_true(bm_state_parse(s, a, strlen(a)));
+    bc_slist_t *l = bc_slist_append(NULL, "/proj/_build/foo/index.html");
+    l = bc_slist_append(l, "/proj/_build/baz/index.html");
+    bc_slist_t *r = bm_state_prune(s, l);
+    assert_non_null(r);
+    assert_string_equal(r->data, "bar/index.html");
+    assert_null(r->next);
+    assert_true(s->changed);
+    assert_int_equal(bc_trie_size(s->outputs), 2);
+    assert_true(bm_state_has_output(s, "/proj/_build/foo/index.html"));
+    assert_false(bm_state_has_output(s, "/proj/_build/bar/index.html"));
+    assert_true(bm_state_has_output(s, "/proj/_build/baz/index.html"));
+    bc_slist_free_full(r, free);
+    bc_slist_free(l);
+    bm_state_free(s);
+}
+
+
+static void
+test_state_get_outputs(void **state)
+{
+    const char *a =
+        HEADER
+        "O\t0000000000000abc\t20\t4321\t8765\tfoo/index.html\n"
+        "I\tcontent/foo.txt\n"
+        "I\ttemplates/main.html\n"
+        "O\t0000000000000def\t30\t1111\t2222\tbar/index.html\n"
+        "I\tcontent/bar.txt\n"
+        "I\ttemplates/main.html\n"
+        "O\t0000000000000123\t30\t1111\t2222\tassets/a.css\n"
+        "I\tassets/a.css\n";
+    bm_state_t *s = bm_state_new("/proj", "/proj/_build");
+    assert_true(bm_state_parse(s, a, strlen(a)));
+    bc_slist_t *l = bc_slist_append(NULL, "/proj/content/foo.txt");
+    bc_trie_t *t = bm_state_get_outputs(s, l);
+    assert_int_equal(bc_trie_size(t), 1);
+    assert_non_null(bc_trie_lookup(t, "/proj/_build/foo/index.html"));
+    bc_trie_free(t);
+    l = bc_slist_append(l, "/proj/templates/main.html");
+    t = bm_state_get_outputs(s, l);
+    assert_int_equal(bc_trie_size(t), 2);
+    assert_non_null(bc_trie_lookup(t, "/proj/_build/foo/index.html"));
+    assert_non_null(bc_trie_lookup(t, "/proj/_build/bar/index.html"));
+    bc_trie_free(t);
+    bc_slist_free(l);
+    l = bc_slist_append(NULL, "/proj/content/baz.txt");
+    t = bm_state_get_outputs(s, l);
+    assert_int_equal(bc_trie_size(t), 0);
+    bc_trie_free(t);
+    bc_slist_free(l);
+    bm_state_free(s);
+}
+
+
+static void
+test_state_parse_tags(void **state)
+{
+    const char *a =
+        "TITLE: Foo\n"
+        "TAGS: foo bar\n"
+        "----------\n"
+        "TAGS: baz\n";
+    char *t = bm_state_parse_tags(a, strlen(a));
+    assert_string_equal(t, "foo bar");
+    free(t);
+    a =
+        "\xEF\xBB\xBFTAGS:   foo  \r\n"
+        "  TAGS: bar\r\n"
+        "---\r\n"
+        "bola\r\n";
+    t = bm_state_parse_tags(a, strlen(a));
+    assert_string_equal(t, "bar");
+    free(t);
+    a =
+        "TITLE: Foo\n"
+        "----------\n"
+        "TAGS: baz\n";
+    t = bm_state_parse_tags(a, strlen(a));
+    assert_string_equal(t, "");
+    free(t);
+    t = bm_state_parse_tags("", 0);
+    assert_string_equal(t, "");
+    free(t);
+}
+
+
+static void
+test_state_need_rebuild(void **state)
+{
+    char dir[] = "/tmp/check_state_XXXXXX";
+    assert_non_null(mkdtemp(dir));
+
+    char *output_dir = bc_strdup_printf("%s/_build", dir);
+    char *foo = bc_strdup_printf("%s/foo.txt", dir);
+    char *bar = bc_strdup_printf("%s/bar.txt", dir);
+    char *out = bc_strdup_printf("%s/_build/foo.html", dir);
+    char *state_file = bc_strdup_printf("%s/_build/%s", dir, BM_STATE_FILENAME);
+
+    write_file(foo, "foo");
+    write_file(bar, "bar");
+    bc_slist_t *inputs = bc_slist_append(NULL, foo);
+    inputs = bc_slist_append(inputs, bar);
+
+    bm_state_t *s = bm_state_load(dir, output_dir);
+    assert_non_null(s);
+
+    // never built
+    assert_true(bm_state_need_rebuild(s, out, inputs, "bola"));
+    assert_int_equal(mkdir(output_dir, 0777), 0);
+    write_file(out, "built");
+    bm_state_set_built(s, out);
+    assert_true(bm_state_has_output(s, out));
+    assert_false(bm_state_need_rebuild(s, out, inputs, "bola"));
+
+    // different arguments
+    assert_true(bm_state_need_rebuild(s, out, inputs, "guda"));
+
+    // rewriting an input with the same content doesn't require a rebuild,
+    // even after reloading the state from disk.
+    bc_error_t *err = NULL;
+    assert_true(bm_state_save(s, &err));
+    assert_null(err);
+    bm_state_free(s);
+    write_file(foo, "foo");
+    s = bm_state_load(dir, output_dir);
+    bm_state_invalidate(s);
+    assert_true(bm_state_has_output(s, out));
+    assert_false(bm_state_need_rebuild(s, out, inputs, "bola"));
+
+    // changing content requires a rebuild
+    write_file(bar, "baz");
+    assert_false(bm_state_need_rebuild(s, out, inputs, "bola"));
+    bm_state_invalidate(s);
+    assert_true(bm_state_need_rebuild(s, out, inputs, "bola"));
+    write_file(out, "built again");
+    bm_state_set_built(s, out);
+    assert_false(bm_state_need_rebuild(s, out, inputs, "bola"));
+
+    // changing the output requires a rebuild
+    write_file(out, "changed by someone else");
+    assert_true(bm_state_need_rebuild(s, out, inputs, "bola"));
+
+    // missing inputs require a rebuild, to let blogc fail
+    unlink(bar);
+    bm_state_invalidate(s);
+    assert_true(bm_state_need_rebuild(s, out, inputs, "bola"));
+
+    bm_state_clear(s);
+    assert_false(bm_state_has_output(s, out));
+    assert_true(0 != access(state_file, F_OK));
+    bm_state_free(s);
+
+    unlink(foo);
+    unlink(out);
+    rmdir(output_dir);
+    rmdir(dir);
+
+    bc_slist_free(inputs);
+    free(output_dir);
+    free(foo);
+    free(bar);
+    free(out);
+    free(state_file);
+}
+
+
+int
+main(void)
+{
+    const UnitTest tests[] = {
+        unit_test(test_state_parse),
+        unit_test(test_state_parse_invalid),
+        unit_test(test_state_dump),
+        unit_test(test_state_prune),
+        unit_test(test_state_get_outputs),
+        unit_test(test_state_parse_tags),
+        unit_test(test_state_need_rebuild),
+    };
+    return run_tests(tests);
+}
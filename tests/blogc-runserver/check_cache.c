@@ -0,0 +1,195 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "../../src/common/utils.h"
+#include "../../src/blogc-runserver/cache.h"
+
+
+static void
+write_file(const char *path, const char *content)
+{
+    FILE *fp = fopen(path, "w");
+    assert_non_null(fp);
+    fputs(content, fp);
+    assert_int_equal(fclose(fp), 0);
+}
+
+
+static void
+test_cache_get(void **state)
+{
+    char dir[] = "/tmp/check_cache_XXXXXX";
+    assert_non_null(mkdtemp(dir));
+
+    char *foo = bc_strdup_printf("%s/foo.css", dir);
+    char *sub = bc_strdup_printf("%s/sub", dir);
+    char *index = bc_strdup_printf("%s/sub/index.html", dir);
+    char *empty = bc_strdup_printf("%s/empty", dir);
+
+    write_file(foo, "foo");
+    assert_int_equal(mkdir(sub, 0777), 0);
+    write_file(index, "<h1>sub</h1>");
+    assert_int_equal(mkdir(empty, 0777), 0);
+
+    br_cache_t *cache = br_cache_new(dir);
+    unsigned short status = 200;
+
+    br_cache_entry_t *e1 = br_cache_get(cache, "/foo.css", &status);
+    assert_non_null(e1);
+    assert_int_equal(status, 200);
+    assert_string_equal(e1->path, "/foo.css");
+    assert_true(bc_str_ends_with(e1->real_path, "/foo.css"));
+    assert_string_equal(e1->content_type, "text/css");
+    assert_int_equal(e1->file.st.st_size, 3);
+    assert_false(e1->add_slash);
+    assert_true(e1->file.fd >= 0);
+    assert_true(bc_str_starts_with(e1->file.etag, "\""));
+    assert_true(bc_str_ends_with(e1->file.etag, "\""));
+    assert_true(bc_str_ends_with(e1->last_modified, " GMT"));
+
+    // hot path
+    br_cache_entry_t *e2 = br_cache_get(cache, "/foo.css", &status);
+    assert_true(e1 == e2);
+    br_cache_release(e2);
+
+    // changed file is loaded again, the old entry stays usable while
+    // referenced
+    write_file(foo, "foobar");
+    e2 = br_cache_get(cache, "/foo.css", &status);
+    assert_non_null(e2);
+    assert_true(e1 != e2);
+    assert_int_equal(e2->file.st.st_size, 6);
+    assert_true(0 != strcmp(e1->file.etag, e2->file.etag));
+    char buf[4];
+    assert_int_equal(pread(e1->file.fd, buf, 3, 0), 3);
+    br_cache_release(e1);
+    br_cache_release(e2);
+
+    // index resolution
+    e1 = br_cache_get(cache, "/sub", &status);
+    assert_non_null(e1);
+    assert_true(e1->add_slash);
+    assert_true(bc_str_ends_with(e1->real_path, "/sub/index.html"));
+    assert_string_equal(e1->content_type, "text/html");
+    e2 = br_cache_get(cache, "/sub/", &status);
+    assert_non_null(e2);
+    assert_false(e2->add_slash);
+    assert_true(e1 != e2);
+    br_cache_release(e1);
+    br_cache_release(e2);
+
+    // errors
+    assert_null(br_cache_get(cache, "/bola.css", &status));
+    assert_int_equal(status, 404);
+    status = 200;
+    assert_null(br_cache_get(cache, "/..", &status));
+    assert_int_equal(status, 404);
+    status = 200;
+    assert_null(br_cache_get(cache, "/empty", &status));
+    assert_int_equal(status, 403);
+
+    br_cache_free(cache);
+
+    unlink(foo);
+    unlink(index);
+    rmdir(sub);
+    rmdir(empty);
+    rmdir(dir);
+
+    free(foo);
+    free(sub);
+    free(index);
+    free(empty);
+}
+
+
+static void
+test_cache_get_fd_limit(void **state)
+{
+    char dir[] = "/tmp/check_cache_XXXXXX";
+    assert_non_null(mkdtemp(dir));
+    char *files[40];
+    for (size_t i = 0; i < 40; i++) {
+        files[i] = bc_strdup_printf("%s/f%zu.txt", dir, i);
+        write_file(files[i], "bola");
+        char *gz = bc_strdup_printf("%s.gz", files[i]);
+        write_file(gz, "guda");
+        free(gz);
+    }
+
+    br_cache_t *cache = br_cache_new(dir);
+    unsigned short status = 200;
+
+    // only a few files can be opened now, older entries are evicted to make
+    // room.
+    struct rlimit old_rl;
+    assert_int_equal(getrlimit(RLIMIT_NOFILE, &old_rl), 0);
+    int fd = dup(0);
+    assert_true(fd >= 0);
+    close(fd);
+    struct rlimit rl = old_rl;
+    rl.rlim_cur = fd + 8;
+    assert_int_equal(setrlimit(RLIMIT_NOFILE, &rl), 0);
+
+    for (size_t i = 0; i < 40; i++) {
+        char *path = bc_strdup_printf("/f%zu.txt", i);
+        br_cache_entry_t *e = br_cache_get(cache, path, &status);
+        assert_non_null(e);
+        assert_true(e->gzip.fd >= 0);
+        br_cache_release(e);
+        free(path);
+    }
+
+    // entries still referenced can't be evicted.
+    br_cache_entry_t *entries[40];
+    size_t n = 0;
+    for (; n < 40; n++) {
+        char *path = bc_strdup_printf("/f%zu.txt", n);
+        entries[n] = br_cache_get(cache, path, &status);
+        free(path);
+        if (entries[n] == NULL)
+            break;
+    }
+    assert_true(n > 0 && n < 40);
+    assert_int_equal(status, 503);
+    for (size_t i = 0; i < n; i++)
+        br_cache_release(entries[i]);
+
+    assert_int_equal(setrlimit(RLIMIT_NOFILE, &old_rl), 0);
+    br_cache_free(cache);
+
+    for (size_t i = 0; i < 40; i++) {
+        char *gz = bc_strdup_printf("%s.gz", files[i]);
+        unlink(gz);
+        unlink(files[i]);
+        free(gz);
+        free(files[i]);
+    }
+    rmdir(dir);
+}
+
+
+int
+main(void)
+{
+    const UnitTest tests[] = {
+        unit_test(test_cache_get),
+        unit_test(test_cache_get_fd_limit),
+    };
+    return run_tests(tests);
+}
@@ -16,44 +16,6 @@
 #include "../../src/blogc-runserver/httpd-utils.h"
 
 
-ssize_t
-__wrap_read(int fd, void *buf, size_t count)
-{
-    assert_int_equal(fd, mock_type(int));
-    const char *mock_buf = mock_type(const char*);
-    strcpy(buf, mock_buf);
-    assert_int_equal(count, READLINE_BUFFER_SIZE);
-    return strlen(mock_buf) > 0 ? strlen(mock_buf) : -1;
-}
-
-
-static void
-test_readline(void **state)
-{
-    char *t;
-    will_return(__wrap_read, 1234);
-    will_return(__wrap_read, "bola");
-    t = br_readline(1234);
-    assert_string_equal(t, "bola");
-    free(t);
-    will_return(__wrap_read, 1234);
-    will_return(__wrap_read, "bola1\nguda\nxd");
-    t = br_readline(1234);
-    assert_string_equal(t, "bola1");
-    free(t);
-    will_return(__wrap_read, 1234);
-    will_return(__wrap_read, "bola2\rguda\rxd");
-    t = br_readline(1234);
-    assert_string_equal(t, "bola2");
-    free(t);
-    will_return(__wrap_read, 1234);
-    will_return(__wrap_read, "bola3\r\nguda\r\nxd");
-    t = br_readline(1234);
-    assert_string_equal(t, "bola3");
-    free(t);
-}
-
-
 static void
 test_hextoi(void **state)
 {
@@ -119,14 +81,97 @@ test_get_extension(void **state)
 }
 
 
+static int
+parse_range(const char *value, off_t size, br_range_t *ranges)
+{
+    return br_parse_range(value, strlen(value), size, ranges, 4);
+}
+
+
+static void
+test_parse_range(void **state)
+{
+    br_range_t r[4];
+    assert_int_equal(parse_range("bytes=0-499", 1000, r), 1);
+    assert_int_equal(r[0].start, 0);
+    assert_int_equal(r[0].end, 500);
+    assert_int_equal(parse_range("bytes=500-", 1000, r), 1);
+    assert_int_equal(r[0].start, 500);
+    assert_int_equal(r[0].end, 1000);
+    assert_int_equal(parse_range("bytes=-200", 1000, r), 1);
+    assert_int_equal(r[0].start, 800);
+    assert_int_equal(r[0].end, 1000);
+    assert_int_equal(parse_range("bytes=-2000", 1000, r), 1);
+    assert_int_equal(r[0].start, 0);
+    assert_int_equal(r[0].end, 1000);
+    assert_int_equal(parse_range("bytes=900-99999999999999999999999", 1000, r), 1);
+    assert_int_equal(r[0].start, 900);
+    assert_int_equal(r[0].end, 1000);
+    assert_int_equal(parse_range("Bytes=0-0, 2-3 ,, -1", 1000, r), 3);
+    assert_int_equal(r[0].start, 0);
+    assert_int_equal(r[0].end, 1);
+    assert_int_equal(r[1].start, 2);
+    assert_int_equal(r[1].end, 4);
+    assert_int_equal(r[2].start, 999);
+    assert_int_equal(r[2].end, 1000);
+
+    // unsatisfiable ranges are dropped
+    assert_int_equal(parse_range("bytes=1000-", 1000, r), 0);
+    assert_int_equal(parse_range("bytes=-0", 1000, r), 0);
+    assert_int_equal(parse_range("bytes=0-", 0, r), 0);
+    assert_int_equal(parse_range("bytes=2000-3000, 10-19", 1000, r), 1);
+    assert_int_equal(r[0].start, 10);
+    assert_int_equal(r[0].end, 20);
+
+    // invalid headers are ignored
+    assert_int_equal(parse_range("", 1000, r), -1);
+    assert_int_equal(parse_range("bytes=", 1000, r), -1);
+    assert_int_equal(parse_range("items=0-1", 1000, r), -1);
+    assert_int_equal(parse_range("bytes=-", 1000, r), -1);
+    assert_int_equal(parse_range("bytes=5-1", 1000, r), -1);
+    assert_int_equal(parse_range("bytes=a-1", 1000, r), -1);
+    assert_int_equal(parse_range("bytes=1-2x", 1000, r), -1);
+    assert_int_equal(parse_range("bytes=0-0,1-1,2-2,3-3,4-4", 1000, r), -1);
+}
+
+
+static bool
+accept_encoding(const char *value, const char *coding)
+{
+    return br_accept_encoding(value, strlen(value), coding);
+}
+
+
+static void
+test_accept_encoding(void **state)
+{
+    assert_true(accept_encoding("gzip", "gzip"));
+    assert_true(accept_encoding("gzip, deflate, br", "br"));
+    assert_true(accept_encoding("deflate,GZIP;q=0.5", "gzip"));
+    assert_true(accept_encoding("*", "gzip"));
+    assert_true(accept_encoding("br;q=0, *", "gzip"));
+    assert_true(accept_encoding("gzip;q=1.0, *;q=0", "gzip"));
+    assert_true(accept_encoding("gzip ; q=0.001", "gzip"));
+    assert_false(accept_encoding("", "gzip"));
+    assert_false(accept_encoding("identity", "gzip"));
+    assert_false(accept_encoding("gzip", "br"));
+    assert_false(accept_encoding("x-gzip", "gzip"));
+    assert_false(accept_encoding("gzip;q=0", "gzip"));
+    assert_false(accept_encoding("gzip;q=0.000, br", "gzip"));
+    assert_false(accept_encoding("*;q=0", "gzip"));
+    assert_false(accept_encoding("gzip;q=0, *", "gzip"));
+}
+
+
 int
 main(void)
 {
     const UnitTest tests[] = {
-        unit_test(test_readline),
         unit_test(test_hextoi),
         unit_test(test_urldecode),
         unit_test(test_get_extension),
+        unit_test(test_parse_range),
+        unit_test(test_accept_encoding),
     };
     return run_tests(tests);
 }
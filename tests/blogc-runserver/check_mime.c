@@ -10,8 +10,10 @@
 #include <stddef.h>
 #include <setjmp.h>
 #include <cmocka.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include "../../src/common/error.h"
 #include "../../src/blogc-runserver/mime.h"
 
 
@@ -31,6 +33,45 @@ test_guess_content_type(void **state)
     assert_string_equal(br_mime_guess_content_type("foo.jpg"), "image/jpeg");
     assert_string_equal(br_mime_guess_content_type("foo.mp4"), "video/mp4");
     assert_string_equal(br_mime_guess_content_type("foo.bola"), "application/octet-stream");
+    assert_string_equal(br_mime_guess_content_type("foo.3gp"), "video/3gpp");
+    assert_string_equal(br_mime_guess_content_type("foo.zip"), "application/zip");
+    assert_string_equal(br_mime_guess_content_type("foo.HTML"), "text/html");
+    assert_string_equal(br_mime_guess_content_type("foo.Jpg"), "image/jpeg");
+    assert_string_equal(br_mime_guess_content_type("foo"), "application/octet-stream");
+    assert_string_equal(br_mime_guess_content_type("foo."), "application/octet-stream");
+}
+
+
+static void
+test_load(void **state)
+{
+    char path[] = "/tmp/check_mime_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    FILE *fp = fdopen(fd, "w");
+    assert_non_null(fp);
+    fputs(
+        "# comment\n"
+        "\n"
+        "text/x-bola\tbola BOLA2  # trailing comment\n"
+        "text/x-css css\r\n"
+        "application/x-empty\n"
+        "text/x-guda bola\n", fp);
+    assert_int_equal(fclose(fp), 0);
+
+    bc_error_t *err = NULL;
+    assert_true(br_mime_load(path, &err));
+    assert_null(err);
+    assert_string_equal(br_mime_guess_content_type("foo.bola"), "text/x-guda");
+    assert_string_equal(br_mime_guess_content_type("foo.bola2"), "text/x-bola");
+    assert_string_equal(br_mime_guess_content_type("foo.CSS"), "text/x-css");
+    assert_string_equal(br_mime_guess_content_type("foo.html"), "text/html");
+    assert_string_equal(br_mime_guess_content_type("foo.chunda"), "application/octet-stream");
+    unlink(path);
+
+    assert_false(br_mime_load(path, &err));
+    assert_non_null(err);
+    bc_error_free(err);
 }
 
 
@@ -87,6 +128,7 @@ main(void)
     const UnitTest tests[] = {
         unit_test(test_guess_content_type),
         unit_test(test_guess_index),
+        unit_test(test_load),
     };
     return run_tests(tests);
 }
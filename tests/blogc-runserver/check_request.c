@@ -0,0 +1,205 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../src/common/utils.h"
+#include "../../src/blogc-runserver/request.h"
+
+
+static int
+parse(br_request_t *req, const char *str)
+{
+    br_request_init(req);
+    return br_request_parse(req, str, strlen(str));
+}
+
+
+static void
+test_request_parse(void **state)
+{
+    br_request_t req;
+    const char *str =
+        "GET /foo/bar?baz=1 HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Accept-Encoding:  gzip, br \r\n"
+        "\r\n";
+    assert_int_equal(parse(&req, str), 1);
+    assert_int_equal(req.len, strlen(str));
+    assert_true(br_request_slice_equal(&(req.method), str, "GET"));
+    assert_true(br_request_slice_equal(&(req.target), str, "/foo/bar?baz=1"));
+    assert_true(br_request_slice_equal(&(req.version), str, "HTTP/1.1"));
+    assert_true(br_request_slice_equal(&(req.line), str,
+        "GET /foo/bar?baz=1 HTTP/1.1"));
+    assert_int_equal(req.headers_len, 2);
+    assert_true(br_request_slice_equal(&(req.headers[0].name), str, "Host"));
+    assert_true(br_request_slice_equal(&(req.headers[0].value), str,
+        "localhost"));
+    assert_true(br_request_slice_equal(&(req.headers[1].name), str,
+        "Accept-Encoding"));
+    assert_true(br_request_slice_equal(&(req.headers[1].value), str,
+        "gzip, br"));
+
+    size_t len;
+    const char *value = br_request_header(&req, str, "accept-encoding", &len);
+    assert_non_null(value);
+    assert_int_equal(len, 8);
+    assert_int_equal(strncmp(value, "gzip, br", len), 0);
+    assert_null(br_request_header(&req, str, "Range", &len));
+
+    // bare line feeds, leading empty lines and pipelined requests.
+    str =
+        "\r\n"
+        "\n"
+        "HEAD / HTTP/1.0\n"
+        "\n"
+        "GET /bola HTTP/1.1\r\n"
+        "\r\n";
+    assert_int_equal(parse(&req, str), 1);
+    assert_int_equal(req.len, 20);
+    assert_true(br_request_slice_equal(&(req.method), str, "HEAD"));
+    assert_true(br_request_slice_equal(&(req.target), str, "/"));
+    assert_true(br_request_slice_equal(&(req.version), str, "HTTP/1.0"));
+    assert_int_equal(req.headers_len, 0);
+    assert_int_equal(parse(&req, str + req.len), 1);
+    assert_true(br_request_slice_equal(&(req.target), str + 20, "/bola"));
+}
+
+
+static void
+test_request_parse_incremental(void **state)
+{
+    br_request_t req;
+    const char *str =
+        "GET /foo HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Content-Length: 4\r\n"
+        "\r\n"
+        "bola";
+    size_t len = strlen(str);
+
+    // data arriving one byte at a time.
+    br_request_init(&req);
+    for (size_t i = 1; i < len; i++)
+        assert_int_equal(br_request_parse(&req, str, i), 0);
+    assert_int_equal(br_request_parse(&req, str, len), 1);
+    assert_int_equal(req.len, len);
+    assert_int_equal(req.content_length, 4);
+    assert_int_equal(req.headers_len, 2);
+    assert_true(br_request_slice_equal(&(req.target), str, "/foo"));
+    assert_true(br_request_slice_equal(&(req.headers[1].value), str, "4"));
+
+    // more data doesn't change a complete request.
+    assert_int_equal(br_request_parse(&req, "GET /foo HTTP/1.1\r\n", 19), 1);
+    assert_int_equal(req.len, len);
+}
+
+
+static void
+test_request_parse_invalid(void **state)
+{
+    br_request_t req;
+    assert_int_equal(parse(&req, "GET /foo\r\n\r\n"), -1);
+    assert_int_equal(parse(&req, "GET /foo HTTP/1.1 bola\r\n\r\n"), -1);
+    assert_int_equal(parse(&req, "GET  /foo HTTP/1.1\r\n\r\n"), -1);
+    assert_int_equal(parse(&req, "GET /foo HTTP/a.b\r\n\r\n"), -1);
+    assert_int_equal(parse(&req, "GET /foo http/1.1\r\n\r\n"), -1);
+    assert_int_equal(parse(&req, "G(T /foo HTTP/1.1\r\n\r\n"), -1);
+    assert_int_equal(parse(&req, "GET /foo HTTP/1.1\r\nHost\r\n\r\n"), -1);
+    assert_int_equal(parse(&req, "GET /foo HTTP/1.1\r\nHost : a\r\n\r\n"),
+        -1);
+    assert_int_equal(parse(&req, "GET /foo HTTP/1.1\r\n: a\r\n\r\n"), -1);
+    assert_int_equal(parse(&req,
+        "GET /foo HTTP/1.1\r\nHost: a\r\n b\r\n\r\n"), -1);
+    assert_int_equal(parse(&req,
+        "GET /foo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"), -1);
+    assert_int_equal(parse(&req,
+        "GET /foo HTTP/1.1\r\nContent-Length: -1\r\n\r\n"), -1);
+    assert_int_equal(parse(&req,
+        "GET /foo HTTP/1.1\r\nContent-Length: 1a\r\n\r\n"), -1);
+    assert_int_equal(parse(&req,
+        "GET /foo HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n"),
+        -1);
+    assert_int_equal(parse(&req,
+        "GET /foo HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n"
+        "\r\n"), -1);
+    assert_int_equal(parse(&req,
+        "GET /foo HTTP/1.1\r\nContent-Length: 0\r\nContent-Length: 1\r\n"
+        "\r\n"), -1);
+    assert_int_equal(parse(&req,
+        "GET /foo HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 1\r\n"
+        "\r\na"), 1);
+
+    // errors are sticky.
+    assert_int_equal(br_request_parse(&req, "GET / HTTP/1.1\r\n\r\n", 18), 1);
+    assert_int_equal(parse(&req, "GET /foo\r\n"), -1);
+    assert_int_equal(br_request_parse(&req, "GET / HTTP/1.1\r\n\r\n", 18), -1);
+
+    const char nul[] = "GET /f\0o HTTP/1.1\r\n\r\n";
+    br_request_init(&req);
+    assert_int_equal(br_request_parse(&req, nul, sizeof(nul) - 1), -1);
+}
+
+
+static void
+test_request_parse_limits(void **state)
+{
+    br_request_t req;
+
+    bc_string_t *str = bc_string_new();
+    bc_string_append(str, "GET / HTTP/1.1\r\n");
+    for (size_t i = 0; i < REQUEST_MAX_HEADERS; i++)
+        bc_string_append_printf(str, "X-Foo-%zu: bar\r\n", i);
+    br_request_init(&req);
+    assert_int_equal(br_request_parse(&req, str->str, str->len), 0);
+    bc_string_append(str, "\r\n");
+    assert_int_equal(br_request_parse(&req, str->str, str->len), 1);
+    assert_int_equal(req.headers_len, REQUEST_MAX_HEADERS);
+    bc_string_free(str, true);
+
+    str = bc_string_new();
+    bc_string_append(str, "GET / HTTP/1.1\r\n");
+    for (size_t i = 0; i <= REQUEST_MAX_HEADERS; i++)
+        bc_string_append_printf(str, "X-Foo-%zu: bar\r\n", i);
+    bc_string_append(str, "\r\n");
+    assert_int_equal(parse(&req, str->str), -1);
+    bc_string_free(str, true);
+
+    // unterminated lines can't grow past the limit.
+    str = bc_string_new();
+    bc_string_append(str, "GET /");
+    while (str->len <= REQUEST_MAX_SIZE)
+        bc_string_append(str, "aaaaaaaa");
+    br_request_init(&req);
+    assert_int_equal(br_request_parse(&req, str->str, REQUEST_MAX_SIZE), 0);
+    assert_int_equal(br_request_parse(&req, str->str, str->len), -1);
+    bc_string_free(str, true);
+
+    str = bc_string_new();
+    bc_string_append_printf(str,
+        "GET / HTTP/1.1\r\nContent-Length: %d\r\n\r\n", REQUEST_MAX_SIZE);
+    assert_int_equal(parse(&req, str->str), -1);
+    bc_string_free(str, true);
+}
+
+
+int
+main(void)
+{
+    const UnitTest tests[] = {
+        unit_test(test_request_parse),
+        unit_test(test_request_parse_incremental),
+        unit_test(test_request_parse_invalid),
+        unit_test(test_request_parse_limits),
+    };
+    return run_tests(tests);
+}
@@ -0,0 +1,130 @@
+/*
+ * blogc: A blog compiler.
+ * Copyright (C) 2014-2017 Rafael G. Martins <rafael@rafaelmartins.eng.br>
+ *
+ * This program can be distributed under the terms of the BSD License.
+ * See the file LICENSE.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../src/common/utils.h"
+#include "../../src/blogc/minifier.h"
+
+
+static char*
+minify(const char *html)
+{
+    char *buf = bc_strdup(html);
+    size_t len = blogc_minify_html(buf, strlen(buf));
+    assert_int_equal(len, strlen(buf));
+    return buf;
+}
+
+
+static void
+test_minify_html_whitespace(void **state)
+{
+    char *rv = minify(
+        "<html>\n"
+        "    <head>\n"
+        "        <title>  foo   bar </title>\n"
+        "    </head>\n"
+        "    <body>\t<p>asd  \t qwe</p>\n"
+        "\n"
+        "    </body>\n"
+        "</html>\n");
+    assert_string_equal(rv,
+        "<html>\n"
+        "<head>\n"
+        "<title> foo bar </title>\n"
+        "</head>\n"
+        "<body> <p>asd qwe</p>\n"
+        "</body>\n"
+        "</html>\n");
+    free(rv);
+    rv = minify("  \n  ");
+    assert_string_equal(rv, "\n");
+    free(rv);
+    rv = minify("");
+    assert_string_equal(rv, "");
+    free(rv);
+    assert_int_equal(blogc_minify_html(NULL, 0), 0);
+}
+
+
+static void
+test_minify_html_comments(void **state)
+{
+    char *rv = minify(
+        "<p>foo <!-- bar\n"
+        "   baz --> asd<!---->qwe</p>\n"
+        "<!--[if IE]>  <p>ie</p>  <![endif]-->\n"
+        "<p>zxc</p><!-- unterminated  ");
+    assert_string_equal(rv,
+        "<p>foo asdqwe</p>\n"
+        "<!--[if IE]>  <p>ie</p>  <![endif]-->\n"
+        "<p>zxc</p>");
+    free(rv);
+}
+
+
+static void
+test_minify_html_tags(void **state)
+{
+    char *rv = minify(
+        "<a  href=\"foo  bar\"\n"
+        "   title='a   \"b\"  c'  >x  <  y</a>\n"
+        "<!DOCTYPE   html>");
+    assert_string_equal(rv,
+        "<a href=\"foo  bar\" title='a   \"b\"  c' >x < y</a>\n"
+        "<!DOCTYPE html>");
+    free(rv);
+}
+
+
+static void
+test_minify_html_raw(void **state)
+{
+    char *rv = minify(
+        "<div>\n"
+        "    <PRE class=\"code\">  foo\n"
+        "    <!-- bar -->\n"
+        "      baz  </Pre>\n"
+        "    <textarea>\n  a  \n</textarea>\n"
+        "    <script>\n  if (a  <  b) {}  // <!-- -->\n</script  >\n"
+        "    <style>  p  {}  </style>\n"
+        "    <prefix>  a  </prefix>\n"
+        "</div>\n");
+    assert_string_equal(rv,
+        "<div>\n"
+        "<PRE class=\"code\">  foo\n"
+        "    <!-- bar -->\n"
+        "      baz  </Pre>\n"
+        "<textarea>\n  a  \n</textarea>\n"
+        "<script>\n  if (a  <  b) {}  // <!-- -->\n</script >\n"
+        "<style>  p  {}  </style>\n"
+        "<prefix> a </prefix>\n"
+        "</div>\n");
+    free(rv);
+    rv = minify("<pre>  unterminated  \n  ");
+    assert_string_equal(rv, "<pre>  unterminated  \n  ");
+    free(rv);
+}
+
+
+int
+main(void)
+{
+    const UnitTest tests[] = {
+        unit_test(test_minify_html_whitespace),
+        unit_test(test_minify_html_comments),
+        unit_test(test_minify_html_tags),
+        unit_test(test_minify_html_raw),
+    };
+    return run_tests(tests);
+}
@@ -6,6 +6,10 @@
  * See the file LICENSE.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
@@ -17,6 +21,50 @@
 #define BC_STRING_CHUNK_SIZE 128
 
 
+static void
+test_alloc_stats(void **state)
+{
+    bc_alloc_stats_t before, after;
+    bc_alloc_stats_get(&before);
+    free(bc_malloc(10));
+    bc_alloc_stats_get(&after);
+    assert_int_equal(after.allocs, before.allocs);
+    assert_int_equal(after.bytes, before.bytes);
+
+    bc_alloc_stats_enable(true);
+    bc_alloc_stats_get(&before);
+    char *t = bc_malloc(10);
+    t = bc_realloc(t, 1000);
+    free(t);
+    t = bc_strdup("bola");
+    free(t);
+    bc_alloc_stats_get(&after);
+    bc_alloc_stats_enable(false);
+    assert_int_equal(after.allocs - before.allocs, 2);
+    assert_int_equal(after.reallocs - before.reallocs, 1);
+#ifdef HAVE_MALLOC_USABLE_SIZE
+    // only the growth of the block is counted.
+    assert_true(after.bytes - before.bytes < 1015);
+    assert_true(after.bytes - before.bytes >= 900);
+#else
+    assert_int_equal(after.bytes - before.bytes, 1015);
+#endif /* HAVE_MALLOC_USABLE_SIZE */
+
+    // growing a string accounts roughly for its final size.
+    bc_alloc_stats_enable(true);
+    bc_alloc_stats_get(&before);
+    bc_string_t *str = bc_string_new();
+    for (size_t i = 0; i < 1000; i++)
+        bc_string_append_c(str, 'a');
+    bc_string_free(str, true);
+    bc_alloc_stats_get(&after);
+    bc_alloc_stats_enable(false);
+#ifdef HAVE_MALLOC_USABLE_SIZE
+    assert_true(after.bytes - before.bytes < 2048);
+#endif /* HAVE_MALLOC_USABLE_SIZE */
+}
+
+
 static void
 test_slist_append(void **state)
 {
@@ -988,6 +1036,20 @@ test_trie_inserted_after_prefix(void **state)
 }
 
 
+static void
+test_hash(void **state)
+{
+    // reference values for 64 bits fnv-1a
+    assert_true(bc_hash(BC_HASH_INIT, "", 0) == 0xcbf29ce484222325ULL);
+    assert_true(bc_hash(BC_HASH_INIT, "a", 1) == 0xaf63dc4c8601ec8cULL);
+    assert_true(bc_hash(BC_HASH_INIT, "foobar", 6) == 0x85944171f73967e8ULL);
+    assert_true(bc_hash(bc_hash(BC_HASH_INIT, "foo", 3), "bar", 3) ==
+        0x85944171f73967e8ULL);
+    assert_true(bc_hash(BC_HASH_INIT, "foobar", 6) !=
+        bc_hash(BC_HASH_INIT, "foobaz", 6));
+}
+
+
 static void
 test_shell_quote(void **state)
 {
@@ -1021,6 +1083,9 @@ main(void)
 {
     const UnitTest tests[] = {
 
+        // memory
+        unit_test(test_alloc_stats),
+
         // slist
         unit_test(test_slist_append),
         unit_test(test_slist_prepend),
@@ -1062,6 +1127,9 @@ main(void)
         unit_test(test_trie_foreach),
         unit_test(test_trie_inserted_after_prefix),
 
+        // hash
+        unit_test(test_hash),
+
         // shell
         unit_test(test_shell_quote),
     };